@@ -0,0 +1,238 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+// Counting heap allocations per frame.
+//
+// Built with -DALLOC_STATS (make CXXFLAGS=-DALLOC_STATS) this replaces the
+// global operator new and delete with versions that count every allocation
+// and its size, from any thread, and alloc_stats_frame() prints the counts
+// per frame once a second. After the first ALLOC_STATS_WARMUP frames the
+// loops shouldn't allocate at all, so anything allocated past that point is
+// totalled separately to make it stand out.
+//
+// Every form of new and delete is replaced, nothrow, sized and aligned
+// included. Memory that doesn't come from new, like a frame arena's
+// overflow, is counted with alloc_stats_count().
+//
+// Without ALLOC_STATS nothing is replaced and alloc_stats_frame() does
+// nothing. Since it defines operator new, this header goes in one
+// translation unit only, which for the examples is all of them.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <chrono>
+
+// frames the loops get to reach their steady state
+#define ALLOC_STATS_WARMUP 60
+
+struct AllocStats {
+    // since the last alloc_stats_frame()
+    std::atomic<long> allocs;
+    std::atomic<long> bytes;
+
+    long frames;
+    long steadyAllocs;      // allocations after warm-up
+    long steadyBytes;
+
+    // toward the next report
+    double lastReport;     // seconds on the steady clock
+    long reportAllocs;
+    long reportBytes;
+    int reportFrames;
+};
+
+inline AllocStats& alloc_stats()
+{
+    // zero initialized before anything runs, so allocations made during
+    // static initialization are safe to count
+    static AllocStats stats;
+    return stats;
+}
+
+// Count an allocation that didn't go through operator new, like a frame
+// arena's overflow
+inline void alloc_stats_count(size_t size)
+{
+#ifdef ALLOC_STATS
+    alloc_stats().allocs.fetch_add(1, std::memory_order_relaxed);
+    alloc_stats().bytes.fetch_add(size, std::memory_order_relaxed);
+#else
+    (void)size;
+#endif
+}
+
+#ifdef ALLOC_STATS
+
+// Every replacement below allocates and frees through these two, so any new
+// is matched by any delete. Aligned allocations come from aligned_alloc(),
+// which free() takes as well. Releasing stays out of line, since with free()
+// inlined into the callers GCC sees new paired with free and warns
+// (-Wmismatched-new-delete).
+inline void* alloc_stats_allocate(size_t size, size_t align)
+{
+    alloc_stats_count(size);
+    size = size ? size : 1;
+    if (align <= alignof(std::max_align_t))
+        return malloc(size);
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+__attribute__((noinline)) inline void alloc_stats_release(void* p)
+{
+    free(p);
+}
+
+void* operator new(size_t size)
+{
+    void* p = alloc_stats_allocate(size, 0);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = alloc_stats_allocate(size, 0);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return alloc_stats_allocate(size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return alloc_stats_allocate(size, 0);
+}
+
+void operator delete(void* p) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+#ifdef __cpp_aligned_new
+
+void* operator new(size_t size, std::align_val_t align)
+{
+    void* p = alloc_stats_allocate(size, (size_t)align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+    void* p = alloc_stats_allocate(size, (size_t)align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return alloc_stats_allocate(size, (size_t)align);
+}
+
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return alloc_stats_allocate(size, (size_t)align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    alloc_stats_release(p);
+}
+
+#endif
+
+#endif
+
+// Call once per frame
+inline void alloc_stats_frame()
+{
+#ifdef ALLOC_STATS
+    AllocStats& s = alloc_stats();
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (s.frames == 0)
+        s.lastReport = time;
+
+    long allocs = s.allocs.exchange(0, std::memory_order_relaxed);
+    long bytes = s.bytes.exchange(0, std::memory_order_relaxed);
+
+    s.frames++;
+    if (s.frames > ALLOC_STATS_WARMUP) {
+        s.steadyAllocs += allocs;
+        s.steadyBytes += bytes;
+    }
+
+    s.reportAllocs += allocs;
+    s.reportBytes += bytes;
+    s.reportFrames++;
+    if (time - s.lastReport >= 1.0) {
+        printf("allocations per frame %.2f (%.0f bytes), %ld (%ld bytes) since warm-up\n",
+               (float)s.reportAllocs / s.reportFrames, (float)s.reportBytes / s.reportFrames,
+               s.steadyAllocs, s.steadyBytes);
+        s.lastReport = time;
+        s.reportAllocs = s.reportBytes = 0;
+        s.reportFrames = 0;
+    }
+#endif
+}
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// Capturing rendered frames to disk without stalling the pipeline.
+//
+// Every frame the window's framebuffer is resolved into a single-sample
+// framebuffer and read back into one of a ring of pixel buffer objects.
+// That read is asynchronous; a fence marks when it's done. A PBO is only
+// mapped once its fence has signalled, normally a couple of frames later,
+// and the pixels are copied out and handed to writer threads that encode and
+// save them as numbered PPM or PNG files. The render thread only waits if
+// the whole ring is still in flight.
+
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "glstate.h"
+#include "trace.h"
+
+#define CAPTURE_RING 4
+
+// frames waiting for a writer before we start dropping them
+#define CAPTURE_MAX_QUEUED 32
+
+struct CaptureFrame {
+    int index;
+    std::vector<unsigned char> pixels;
+};
+
+struct Capture {
+    int width;
+    int height;
+    std::string dir;
+    bool png;
+
+    GLuint resolveFbo;
+    GLuint resolveRbo;
+
+    GLuint pbo[CAPTURE_RING];
+    GLsync fence[CAPTURE_RING];
+    int frameOf[CAPTURE_RING];
+    int head;
+    int inFlight;
+    int frames;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    // frames waiting for a writer, a fixed ring so queueing never allocates
+    CaptureFrame* queue[CAPTURE_MAX_QUEUED];
+    int queueHead;
+    int queued;
+    std::vector<CaptureFrame*> spare;
+    bool running;
+    std::vector<std::thread> writers;
+
+    long written;
+    long dropped;
+    long stalls;
+};
+
+inline void capture_png_chunk(FILE* f, const char* type, const unsigned char* data, uint32_t size)
+{
+    unsigned char be[4] = { (unsigned char)(size >> 24), (unsigned char)(size >> 16),
+                            (unsigned char)(size >> 8), (unsigned char)size };
+    fwrite(be, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    if (size > 0)
+        fwrite(data, 1, size, f);
+
+    uLong crc = crc32(0, (const Bytef*)type, 4);
+    crc = crc32(crc, data, size);
+    unsigned char crcBytes[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+                                  (unsigned char)(crc >> 8), (unsigned char)crc };
+    fwrite(crcBytes, 1, 4, f);
+}
+
+// Write RGBA pixels, bottom row first as GL reads them, as an RGB image.
+// rows and deflated are the writer's scratch space, kept from frame to frame
+// so writing doesn't allocate once they're big enough.
+inline void capture_write(const Capture& c, const CaptureFrame& frame,
+                          std::vector<unsigned char>& rows, std::vector<unsigned char>& deflated)
+{
+    TRACE_SCOPE("capture_write");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame_%05d.%s", c.dir.c_str(), frame.index, c.png ? "png" : "ppm");
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        printf("couldn't write %s\n", path);
+        return;
+    }
+
+    int w = c.width, h = c.height;
+    // PNG rows start with a filter type byte
+    int rowBytes = 3 * w + (c.png ? 1 : 0);
+    rows.resize(rowBytes * h);
+    for (int y = 0; y < h; y++) {
+        const unsigned char* in = frame.pixels.data() + (h - 1 - y) * 4 * w;
+        unsigned char* out = rows.data() + y * rowBytes;
+        if (c.png)
+            *out++ = 0;
+        for (int x = 0; x < w; x++) {
+            out[3*x] = in[4*x];
+            out[3*x + 1] = in[4*x + 1];
+            out[3*x + 2] = in[4*x + 2];
+        }
+    }
+
+    if (c.png) {
+        uLongf len = compressBound(rows.size());
+        deflated.resize(len);
+        compress2(deflated.data(), &len, rows.data(), rows.size(), Z_BEST_SPEED);
+
+        const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        unsigned char ihdr[13] = {
+            (unsigned char)(w >> 24), (unsigned char)(w >> 16), (unsigned char)(w >> 8), (unsigned char)w,
+            (unsigned char)(h >> 24), (unsigned char)(h >> 16), (unsigned char)(h >> 8), (unsigned char)h,
+            8, 2, 0, 0, 0  // 8 bit RGB, deflate, no interlacing
+        };
+        fwrite(signature, 1, 8, f);
+        capture_png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+        capture_png_chunk(f, "IDAT", deflated.data(), len);
+        capture_png_chunk(f, "IEND", NULL, 0);
+    } else {
+        fprintf(f, "P6\n%d %d\n255\n", w, h);
+        fwrite(rows.data(), 1, rows.size(), f);
+    }
+    fclose(f);
+}
+
+inline void capture_writer_run(Capture* c)
+{
+    TRACE_THREAD("capture writer");
+    std::vector<unsigned char> rows, deflated;
+    std::unique_lock<std::mutex> guard(c->lock);
+    while (true) {
+        c->wake.wait(guard, [c] { return c->queued > 0 || !c->running; });
+        if (c->queued == 0)
+            break;
+
+        CaptureFrame* frame = c->queue[c->queueHead];
+        c->queueHead = (c->queueHead + 1) % CAPTURE_MAX_QUEUED;
+        c->queued--;
+
+        guard.unlock();
+        capture_write(*c, *frame, rows, deflated);
+        guard.lock();
+
+        c->written++;
+        c->spare.push_back(frame);
+    }
+}
+
+inline void capture_init(Capture& c, int width, int height, const char* dir, bool png)
+{
+    c.width = width;
+    c.height = height;
+    c.dir = dir;
+    c.png = png;
+
+    glGenRenderbuffers(1, &c.resolveRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, c.resolveRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &c.resolveFbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, c.resolveFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, c.resolveRbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("capture framebuffer incomplete!\n");
+        exit(1);
+    }
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(CAPTURE_RING, c.pbo);
+    for (int i = 0; i < CAPTURE_RING; i++) {
+        glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, c.pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL, GL_STREAM_READ);
+        c.fence[i] = 0;
+    }
+    glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    c.head = 0;
+    c.inFlight = 0;
+    c.frames = 0;
+    c.written = 0;
+    c.dropped = 0;
+    c.stalls = 0;
+    c.queueHead = 0;
+    c.queued = 0;
+
+    // PNG encoding is the slow part, so spread it over a few threads
+    int threads = 1;
+    if (png)
+        threads = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+
+    // at most every queued frame and one per writer ever come back
+    c.spare.reserve(CAPTURE_MAX_QUEUED + threads);
+    c.running = true;
+    for (int i = 0; i < threads; i++)
+        c.writers.push_back(std::thread(capture_writer_run, &c));
+}
+
+// Hand every finished readback to the writers. With `wait`, block until at
+// least the oldest one is done.
+inline void capture_collect(Capture& c, bool wait)
+{
+    while (c.inFlight > 0) {
+        int slot = (c.head - c.inFlight + CAPTURE_RING) % CAPTURE_RING;
+        GLenum status = glClientWaitSync(c.fence[slot], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? 1000000000ull : 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+            break;
+        wait = false;
+
+        glDeleteSync(c.fence[slot]);
+        c.fence[slot] = 0;
+        c.inFlight--;
+
+        CaptureFrame* frame = NULL;
+        {
+            std::lock_guard<std::mutex> guard(c.lock);
+            if (c.queued >= CAPTURE_MAX_QUEUED) {
+                c.dropped++;
+                continue;
+            }
+            if (!c.spare.empty()) {
+                frame = c.spare.back();
+                c.spare.pop_back();
+            }
+        }
+        if (!frame)
+            frame = new CaptureFrame();
+
+        glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, c.pbo[slot]);
+        void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * c.width * c.height, GL_MAP_READ_BIT);
+        if (!pixels) {
+            // the driver couldn't give us the readback, so the frame is lost
+            glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+            std::lock_guard<std::mutex> guard(c.lock);
+            c.dropped++;
+            c.spare.push_back(frame);
+            continue;
+        }
+        frame->index = c.frameOf[slot];
+        frame->pixels.resize(4 * c.width * c.height);
+        memcpy(frame->pixels.data(), pixels, frame->pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        {
+            std::lock_guard<std::mutex> guard(c.lock);
+            c.queue[(c.queueHead + c.queued) % CAPTURE_MAX_QUEUED] = frame;
+            c.queued++;
+        }
+        c.wake.notify_one();
+    }
+}
+
+// Start reading back what's in the window's framebuffer. Call once the frame
+// is drawn, before swapping.
+inline void capture_frame(Capture& c)
+{
+    TRACE_SCOPE("capture_frame");
+    capture_collect(c, false);
+    if (c.inFlight == CAPTURE_RING) {
+        c.stalls++;
+        capture_collect(c, true);
+    }
+
+    int slot = c.head;
+
+    // resolve the multisampled window into a plain framebuffer, reading
+    // straight from a multisampled one isn't allowed
+    glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+    glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, c.resolveFbo);
+    glBlitFramebuffer(0, 0, c.width, c.height, 0, 0, c.width, c.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, c.resolveFbo);
+    glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, c.pbo[slot]);
+    glReadPixels(0, 0, c.width, c.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glstate_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+    c.fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    c.frameOf[slot] = c.frames++;
+    c.head = (c.head + 1) % CAPTURE_RING;
+    c.inFlight++;
+}
+
+// Wait for all readbacks and writes to finish
+inline void capture_finish(Capture& c)
+{
+    while (c.inFlight > 0)
+        capture_collect(c, true);
+
+    {
+        std::lock_guard<std::mutex> guard(c.lock);
+        c.running = false;
+    }
+    c.wake.notify_all();
+    for (size_t i = 0; i < c.writers.size(); i++)
+        c.writers[i].join();
+    c.writers.clear();
+
+    for (size_t i = 0; i < c.spare.size(); i++)
+        delete c.spare[i];
+    c.spare.clear();
+
+    glstate_delete_buffers(CAPTURE_RING, c.pbo);
+    glstate_delete_framebuffers(1, &c.resolveFbo);
+    glDeleteRenderbuffers(1, &c.resolveRbo);
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+// The column model from py/ripples.py on the CPU, on a width x height grid.
+// A single row (height 1) is the original chain of columns. The update is the
+// same one sim_frag.glsl does on the GPU: all heights move first, then the
+// velocities are updated from the new heights.
+//
+// After a disturbance most of a big domain soon sits at rest, so the
+// simulation can also put resting regions to sleep, see columns_sleep_init().
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// sleeping goes by tiles this many columns on a side, or spans this long
+// when there's a single row
+#define COLUMNS_TILE 64
+#define COLUMNS_SPAN 4096
+
+struct Columns {
+    int width;
+    int height;
+    std::vector<float> heights;
+    std::vector<float> velocities;
+
+    float k;
+    float dashpot;
+    float neighborK;
+
+    // Sleeping, off until columns_sleep_init(). Tiles where every height,
+    // velocity and pull from the neighbors is under epsilon aren't stepped.
+    float epsilon;
+    int tileWidth;
+    int tileHeight;
+    int tilesX;
+    int tilesY;
+    std::vector<int> active;            // tiles the next step covers
+    std::vector<int> nextActive;
+    std::vector<unsigned char> awake;   // whether each tile is in `active`
+};
+
+inline void columns_init(Columns& c, int width, int height, float k, float dashpot, float neighborK)
+{
+    c.width = width;
+    c.height = height;
+    c.heights.assign(width * height, 0.0f);
+    c.velocities.assign(width * height, 0.0f);
+    c.k = k;
+    c.dashpot = dashpot;
+    c.neighborK = neighborK;
+    c.epsilon = 0.0f;
+}
+
+inline void columns_wake_tile(Columns& c, int tx, int ty)
+{
+    int t = ty * c.tilesX + tx;
+    if (!c.awake[t]) {
+        c.awake[t] = 1;
+        c.active.push_back(t);
+    }
+}
+
+// Wake every tile touching the columns in [x0, x1] x [y0, y1]
+inline void columns_wake(Columns& c, int x0, int y0, int x1, int y1)
+{
+    if (c.epsilon <= 0.0f)
+        return;
+    x0 = std::max(x0, 0) / c.tileWidth;
+    y0 = std::max(y0, 0) / c.tileHeight;
+    x1 = std::min(x1, c.width - 1) / c.tileWidth;
+    y1 = std::min(y1, c.height - 1) / c.tileHeight;
+    for (int ty = y0; ty <= y1; ty++) {
+        for (int tx = x0; tx <= x1; tx++) {
+            columns_wake_tile(c, tx, ty);
+        }
+    }
+}
+
+// Have columns_step_active() skip resting regions. Every tile starts awake
+// and the ones already at rest drop out after a step. A sleeping tile's
+// columns are left where they were, which is off from the exact answer by
+// about epsilon, so epsilon should be well under anything that shows.
+//
+// A tile goes to sleep once all its columns are quiet, and it wakes when a
+// column on the edge of an awake neighbor moves. It wakes a step late: the
+// step that column starts moving, the sleeping column beside it isn't
+// stepped and misses that step's pull from it. Both were quiet the step
+// before, so their heights are within about 2 epsilon and the pull missed is
+// under 3 * neighborK * epsilon, the same order as what sleeping already
+// leaves out. From then on the tile steps normally. Anything that writes to
+// the heights or velocities other than columns_drop() has to call
+// columns_wake() for what it touched.
+inline void columns_sleep_init(Columns& c, float epsilon)
+{
+    c.epsilon = epsilon;
+    c.tileWidth = c.height == 1 ? COLUMNS_SPAN : COLUMNS_TILE;
+    c.tileHeight = std::min(COLUMNS_TILE, c.height);
+    c.tilesX = (c.width + c.tileWidth - 1) / c.tileWidth;
+    c.tilesY = (c.height + c.tileHeight - 1) / c.tileHeight;
+    c.awake.assign(c.tilesX * c.tilesY, 0);
+    c.active.clear();
+    c.active.reserve(c.tilesX * c.tilesY);
+    c.nextActive.clear();
+    c.nextActive.reserve(c.tilesX * c.tilesY);
+    columns_wake(c, 0, 0, c.width - 1, c.height - 1);
+}
+
+inline void columns_step(Columns& c)
+{
+    int w = c.width;
+    int h = c.height;
+    float* height = c.heights.data();
+    float* velocity = c.velocities.data();
+
+    for (int i = 0; i < w * h; i++) {
+        height[i] += velocity[i];
+    }
+
+    // a missing neighbor at the border pulls with no force, like a Column
+    // without a left or right
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int i = y * w + x;
+            float self = height[i];
+            float neighbors = 0.0f;
+            if (x > 0)     neighbors += self - height[i - 1];
+            if (x < w - 1) neighbors += self - height[i + 1];
+            if (y > 0)     neighbors += self - height[i - w];
+            if (y < h - 1) neighbors += self - height[i + w];
+
+            velocity[i] -= self*c.k + velocity[i]*c.dashpot + neighbors*c.neighborK;
+        }
+    }
+}
+
+// columns_step() over the awake tiles only, so the cost goes with the
+// disturbed area rather than the whole domain. Without sleeping it's just
+// columns_step().
+inline void columns_step_active(Columns& c)
+{
+    if (c.epsilon <= 0.0f) {
+        columns_step(c);
+        return;
+    }
+
+    int w = c.width;
+    int h = c.height;
+    float* height = c.heights.data();
+    float* velocity = c.velocities.data();
+    float eps = c.epsilon;
+
+    for (size_t n = 0; n < c.active.size(); n++) {
+        int t = c.active[n];
+        int x0 = (t % c.tilesX) * c.tileWidth;
+        int y0 = (t / c.tilesX) * c.tileHeight;
+        int x1 = std::min(x0 + c.tileWidth, w);
+        int y1 = std::min(y0 + c.tileHeight, h);
+        for (int y = y0; y < y1; y++) {
+            for (int i = y * w + x0; i < y * w + x1; i++) {
+                height[i] += velocity[i];
+            }
+        }
+        c.awake[t] = 0;
+    }
+
+    // tiles stay awake while anything in them moves, and wake the neighbor
+    // past any edge that moves
+    for (size_t n = 0; n < c.active.size(); n++) {
+        int t = c.active[n];
+        int tx = t % c.tilesX;
+        int ty = t / c.tilesX;
+        int x0 = tx * c.tileWidth;
+        int y0 = ty * c.tileHeight;
+        int x1 = std::min(x0 + c.tileWidth, w);
+        int y1 = std::min(y0 + c.tileHeight, h);
+        bool moving = false;
+        bool left = false, right = false, below = false, above = false;
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int i = y * w + x;
+                float self = height[i];
+                float neighbors = 0.0f;
+                if (x > 0)     neighbors += self - height[i - 1];
+                if (x < w - 1) neighbors += self - height[i + 1];
+                if (y > 0)     neighbors += self - height[i - w];
+                if (y < h - 1) neighbors += self - height[i + w];
+
+                velocity[i] -= self*c.k + velocity[i]*c.dashpot + neighbors*c.neighborK;
+
+                if (fabsf(self) >= eps || fabsf(velocity[i]) >= eps || fabsf(neighbors) >= eps) {
+                    moving = true;
+                    left |= x == x0;
+                    right |= x == x1 - 1;
+                    below |= y == y0;
+                    above |= y == y1 - 1;
+                }
+            }
+        }
+
+        if (!moving)
+            continue;
+        if (!c.awake[t]) {
+            c.awake[t] = 1;
+            c.nextActive.push_back(t);
+        }
+        int wake[4][2] = { { tx - 1, ty }, { tx + 1, ty }, { tx, ty - 1 }, { tx, ty + 1 } };
+        bool edges[4] = { left, right, below, above };
+        for (int e = 0; e < 4; e++) {
+            int nx = wake[e][0], ny = wake[e][1];
+            if (!edges[e] || nx < 0 || ny < 0 || nx >= c.tilesX || ny >= c.tilesY)
+                continue;
+            int neighbor = ny * c.tilesX + nx;
+            if (!c.awake[neighbor]) {
+                c.awake[neighbor] = 1;
+                c.nextActive.push_back(neighbor);
+            }
+        }
+    }
+
+    c.active.swap(c.nextActive);
+    c.nextActive.clear();
+}
+
+// Add a smooth bump of height `amount` centered on (x, y), same shape as
+// drop_frag.glsl
+inline void columns_drop(Columns& c, float x, float y, float radius, float amount)
+{
+    int r = (int)ceil(radius);
+    for (int j = (int)y - r; j <= (int)y + r; j++) {
+        for (int i = (int)x - r; i <= (int)x + r; i++) {
+            if (i < 0 || j < 0 || i >= c.width || j >= c.height)
+                continue;
+            float d = sqrtf((i + 0.5f - x)*(i + 0.5f - x) + (j + 0.5f - y)*(j + 0.5f - y)) / radius;
+            if (d < 1.0f)
+                c.heights[j * c.width + i] += amount * (0.5f + 0.5f * cosf(3.14159265f * d));
+        }
+    }
+    columns_wake(c, (int)x - r, (int)y - r, (int)x + r, (int)y + r);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef DRAW_SORT_H
+#define DRAW_SORT_H
+
+// Opaque draws sorted front to back, so the depth test throws away what's
+// hidden before it's shaded instead of after.
+//
+// Every frame each draw is added with its distance from the camera, in the
+// order it would otherwise have been drawn. draw_sort_sort() quantizes the
+// distances to DRAW_SORT_BITS bits across the range actually seen and sorts
+// on them with an LSD radix sort, a byte a pass, which is linear in the
+// number of draws and keeps draws at the same distance in the order they
+// were added. Afterwards draw_sort_at(s, k) is the kth draw to make.
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// bits of depth a key keeps, a multiple of 8, and no more than the 24 a float has
+#define DRAW_SORT_BITS 16
+
+struct DrawSort {
+    std::vector<float> depths;
+    std::vector<uint64_t> entries;      // key << 32 | draw
+    std::vector<uint64_t> scratch;
+};
+
+inline void draw_sort_begin(DrawSort& s)
+{
+    s.depths.clear();
+}
+
+// The next draw is `depth` away from the camera
+inline void draw_sort_add(DrawSort& s, float depth)
+{
+    s.depths.push_back(depth);
+}
+
+inline void draw_sort_sort(DrawSort& s)
+{
+    size_t count = s.depths.size();
+    s.entries.resize(count);
+    s.scratch.resize(count);
+    if (count == 0)
+        return;
+
+    float nearest = s.depths[0], furthest = s.depths[0];
+    for (size_t i = 1; i < count; i++) {
+        nearest = std::min(nearest, s.depths[i]);
+        furthest = std::max(furthest, s.depths[i]);
+    }
+    float scale = furthest > nearest ? (float)((1ull << DRAW_SORT_BITS) - 1) / (furthest - nearest) : 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t key = (uint32_t)((s.depths[i] - nearest) * scale);
+        s.entries[i] = (uint64_t)key << 32 | (uint32_t)i;
+    }
+
+    // the key's bytes from the lowest up, each pass stable
+    for (int bit = 32; bit < 32 + DRAW_SORT_BITS; bit += 8) {
+        size_t offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        for (size_t i = 0; i < count; i++)
+            offsets[(s.entries[i] >> bit) & 0xff]++;
+        size_t first = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t n = offsets[b];
+            offsets[b] = first;
+            first += n;
+        }
+        for (size_t i = 0; i < count; i++)
+            s.scratch[offsets[(s.entries[i] >> bit) & 0xff]++] = s.entries[i];
+        s.entries.swap(s.scratch);
+    }
+}
+
+inline int draw_sort_at(const DrawSort& s, size_t k)
+{
+    return (int)(uint32_t)s.entries[k];
+}
+
+inline size_t draw_sort_count(const DrawSort& s)
+{
+    return s.entries.size();
+}
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef DYNRES_H
+#define DYNRES_H
+
+// Dynamic resolution: holding a GPU frame time budget by rendering less.
+//
+// The scene is drawn into an offscreen target instead of the window, at some
+// fraction of the window's resolution, and then stretched over the window by
+// a last fullscreen pass (upscale_vert.glsl / upscale_frag.glsl). Timer
+// queries measure how long the GPU spends on each frame, and a controller
+// nudges the scale down when frames run over the budget and back up when
+// there is room to spare. Once the scale is pinned at one end the MSAA level
+// is stepped too.
+//
+// The targets are always allocated at the full window size and rendering
+// just uses the bottom left corner of them, so changing the scale is free.
+// Only changing the sample count reallocates.
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+#include "glstate.h"
+
+#define DYNRES_QUERIES 4
+
+// frames to wait after changing the sample count before changing it again
+#define DYNRES_SETTLE_FRAMES 30
+
+struct DynRes {
+    int width;
+    int height;
+    float budget;       // ms
+
+    float scale;
+    float minScale;
+    float maxScale;
+    int samples;
+    int maxSamples;
+    int renderWidth;
+    int renderHeight;
+
+    // controller state
+    float gpuTime;      // smoothed ms, corrected to the current scale
+    float lastGpuTime;  // latest raw measurement
+    int settle;
+    const char* state;
+
+    // what the scene is drawn into. With MSAA it's multisampled renderbuffers
+    // that get resolved into resolveTex, otherwise resolveTex directly.
+    GLuint fbo;
+    GLuint colorRbo;
+    GLuint depthRbo;
+    GLuint resolveFbo;
+    GLuint resolveTex;
+
+    GLuint program;
+    GLint uniScale;
+    GLint uniLimit;
+    GLuint vao;
+
+    // GL_TIME_ELAPSED queries in flight, oldest first. Without timer
+    // queries the CPU time between frames stands in for the GPU time.
+    bool timerQueries;
+    GLuint queries[DYNRES_QUERIES];
+    float queryScale[DYNRES_QUERIES];
+    int queryHead;
+    int queriesInFlight;
+    bool measuring;
+    std::chrono::steady_clock::time_point lastBegin;
+};
+
+inline void dynres_allocate(DynRes& d)
+{
+    if (d.fbo) {
+        glstate_delete_framebuffers(1, &d.fbo);
+        glstate_delete_framebuffers(1, &d.resolveFbo);
+        glDeleteRenderbuffers(1, &d.colorRbo);
+        glDeleteRenderbuffers(1, &d.depthRbo);
+        glstate_delete_textures(1, &d.resolveTex);
+        d.colorRbo = 0;
+    }
+
+    glGenTextures(1, &d.resolveTex);
+    glstate_bind_texture(0, GL_TEXTURE_2D, d.resolveTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, d.width, d.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // the upscale is a plain bilinear stretch
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenFramebuffers(1, &d.resolveFbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, d.resolveFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, d.resolveTex, 0);
+
+    glGenFramebuffers(1, &d.fbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, d.fbo);
+    if (d.samples > 1) {
+        glGenRenderbuffers(1, &d.colorRbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, d.colorRbo);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, d.samples, GL_RGBA8, d.width, d.height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, d.colorRbo);
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, d.resolveTex, 0);
+    }
+
+    // with stencil, for scenes like ex5's reflection
+    glGenRenderbuffers(1, &d.depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, d.depthRbo);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, d.samples > 1 ? d.samples : 0,
+                                     GL_DEPTH24_STENCIL8, d.width, d.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, d.depthRbo);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("dynamic resolution framebuffer incomplete!\n");
+        exit(1);
+    }
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// `program` is upscale_vert.glsl + upscale_frag.glsl linked together.
+// `maxSamples` of 0 or 1 means no MSAA.
+inline void dynres_init(DynRes& d, int width, int height, float budget, int maxSamples, GLuint program)
+{
+    d.width = width;
+    d.height = height;
+    d.budget = budget;
+
+    d.scale = 1.0f;
+    d.minScale = 0.25f;
+    d.maxScale = 1.0f;
+    d.maxSamples = std::max(1, maxSamples);
+    d.samples = d.maxSamples;
+    d.renderWidth = width;
+    d.renderHeight = height;
+
+    d.gpuTime = 0.0f;
+    d.lastGpuTime = 0.0f;
+    d.settle = 0;
+    d.state = "hold";
+
+    // nothing allocated yet, for dynres_allocate() and dynres_destroy()
+    d.fbo = d.colorRbo = d.depthRbo = 0;
+    d.resolveFbo = d.resolveTex = 0;
+    d.vao = 0;
+    dynres_allocate(d);
+
+    d.program = program;
+    d.uniScale = glGetUniformLocation(program, "Scale");
+    d.uniLimit = glGetUniformLocation(program, "Limit");
+    glstate_use_program(program);
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    glGenVertexArrays(1, &d.vao);
+
+    d.timerQueries = GLEW_ARB_timer_query;
+    if (d.timerQueries) {
+        glGenQueries(DYNRES_QUERIES, d.queries);
+    } else {
+        printf("no timer queries, dynamic resolution will go by CPU frame time\n");
+    }
+    d.queryHead = 0;
+    d.queriesInFlight = 0;
+    d.measuring = false;
+    d.lastBegin = std::chrono::steady_clock::now();
+}
+
+// Feed one frame time measurement, taken at `measuredScale`, to the controller
+inline void dynres_control(DynRes& d, float ms, float measuredScale)
+{
+    d.lastGpuTime = ms;
+
+    // most of the cost goes with the pixel count, so correct measurements
+    // made at an older scale to what they would be now
+    float corrected = ms * (d.scale * d.scale) / (measuredScale * measuredScale);
+    if (d.gpuTime == 0.0f) {
+        d.gpuTime = corrected;
+    } else {
+        d.gpuTime += 0.2f * (corrected - d.gpuTime);
+    }
+
+    if (d.settle > 0) {
+        d.settle--;
+    }
+
+    // aim a little under the budget and leave a dead band around that so the
+    // scale doesn't wobble every frame. Go down quickly and up slowly.
+    float target = 0.9f * d.budget;
+    float scale = d.scale;
+    if (d.gpuTime > d.budget || d.gpuTime < 0.8f * d.budget) {
+        scale *= std::sqrt(target / d.gpuTime);
+        scale = std::max(d.scale * 0.8f, std::min(d.scale * 1.05f, scale));
+    }
+    scale = std::max(d.minScale, std::min(d.maxScale, scale));
+
+    if (scale < d.scale) {
+        d.state = "down";
+    } else if (scale > d.scale) {
+        d.state = "up";
+    } else {
+        d.state = "hold";
+    }
+
+    // out of room on the scale, trade MSAA instead
+    int samples = d.samples;
+    if (d.settle == 0) {
+        if (scale == d.minScale && d.gpuTime > d.budget && d.samples > 1) {
+            samples = d.samples / 2;
+        } else if (scale == d.maxScale && d.gpuTime < 0.5f * d.budget && d.samples < d.maxSamples) {
+            samples = d.samples * 2;
+        }
+    }
+    if (samples != d.samples) {
+        d.state = samples < d.samples ? "fewer samples" : "more samples";
+        d.samples = samples;
+        d.settle = DYNRES_SETTLE_FRAMES;
+        dynres_allocate(d);
+    } else if (scale == d.minScale && d.gpuTime > d.budget) {
+        d.state = "over budget";
+    }
+
+    d.scale = scale;
+    d.renderWidth = std::max(1, (int)(d.width * scale + 0.5f));
+    d.renderHeight = std::max(1, (int)(d.height * scale + 0.5f));
+}
+
+// Pick up finished measurements, update the scale, and bind the offscreen
+// target with the viewport set to the part of it being rendered. The caller
+// clears and draws the scene as usual.
+inline void dynres_begin(DynRes& d)
+{
+    if (d.timerQueries) {
+        while (d.queriesInFlight > 0) {
+            int slot = (d.queryHead - d.queriesInFlight + DYNRES_QUERIES) % DYNRES_QUERIES;
+            GLint available = 0;
+            glGetQueryObjectiv(d.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                break;
+            }
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(d.queries[slot], GL_QUERY_RESULT, &ns);
+            d.queriesInFlight--;
+            dynres_control(d, ns / 1e6f, d.queryScale[slot]);
+        }
+
+        // if every query is still in flight just skip timing this frame
+        d.measuring = d.queriesInFlight < DYNRES_QUERIES;
+        if (d.measuring) {
+            d.queryScale[d.queryHead] = d.scale;
+            glBeginQuery(GL_TIME_ELAPSED, d.queries[d.queryHead]);
+        }
+    } else {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float ms = std::chrono::duration<float, std::milli>(now - d.lastBegin).count();
+        d.lastBegin = now;
+        dynres_control(d, ms, d.scale);
+    }
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, d.fbo);
+    glstate_viewport(0, 0, d.renderWidth, d.renderHeight);
+}
+
+// Resolve what was drawn and stretch it over the window. Leaves the window's
+// framebuffer bound with a full size viewport.
+inline void dynres_end(DynRes& d)
+{
+    if (d.samples > 1) {
+        glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, d.fbo);
+        glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, d.resolveFbo);
+        glBlitFramebuffer(0, 0, d.renderWidth, d.renderHeight, 0, 0, d.renderWidth, d.renderHeight,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, d.width, d.height);
+
+    GLboolean depthTest = glstate_is_enabled(GL_DEPTH_TEST);
+    glstate_disable(GL_DEPTH_TEST);
+
+    glstate_use_program(d.program);
+    glstate_bind_vertex_array(d.vao);
+    glstate_bind_texture(0, GL_TEXTURE_2D, d.resolveTex);
+
+    // only the rendered corner of the texture is used, and filtering must
+    // not reach past its edge
+    float sx = (float)d.renderWidth / d.width;
+    float sy = (float)d.renderHeight / d.height;
+    glUniform2f(d.uniScale, sx, sy);
+    glUniform2f(d.uniLimit, sx - 0.5f / d.width, sy - 0.5f / d.height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (depthTest) {
+        glstate_enable(GL_DEPTH_TEST);
+    }
+
+    if (d.measuring) {
+        glEndQuery(GL_TIME_ELAPSED);
+        d.queryHead = (d.queryHead + 1) % DYNRES_QUERIES;
+        d.queriesInFlight++;
+        d.measuring = false;
+    }
+}
+
+inline void dynres_status(const DynRes& d, char* buffer, size_t size)
+{
+    snprintf(buffer, size, "%s %.2f ms (budget %.2f), scale %.2f (%dx%d), %dx MSAA, %s",
+             d.timerQueries ? "gpu" : "cpu", d.gpuTime, d.budget, d.scale,
+             d.renderWidth, d.renderHeight, d.samples, d.state);
+}
+
+inline void dynres_destroy(DynRes& d)
+{
+    if (d.timerQueries) {
+        glDeleteQueries(DYNRES_QUERIES, d.queries);
+    }
+    glstate_delete_framebuffers(1, &d.fbo);
+    glstate_delete_framebuffers(1, &d.resolveFbo);
+    if (d.colorRbo) {
+        glDeleteRenderbuffers(1, &d.colorRbo);
+    }
+    glDeleteRenderbuffers(1, &d.depthRbo);
+    glstate_delete_textures(1, &d.resolveTex);
+    glstate_delete_vertex_arrays(1, &d.vao);
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef FIELD_STREAM_H
+#define FIELD_STREAM_H
+
+// Recorded height fields, played back straight out of a memory mapping.
+//
+// Unlike the simulation streams in sim_stream.h nothing here is encoded: a
+// frame is width x height floats as they are, so showing one means handing
+// a pointer into the mapping to glTexSubImage2D and nothing else, and files
+// can be far bigger than memory. The file is
+//
+//   FieldHeader                   padded out to FIELD_ALIGN
+//   frame 0                       width * height floats
+//   frame 1                       each frame starting on a FIELD_ALIGN boundary
+//   ...
+//   uint64_t frameOffsets[frames]
+//
+// with header.indexOffset saying where the offsets start.
+//
+// While playing, the reader asks the kernel with madvise(MADV_WILLNEED) to
+// start reading the next few frames in before they're needed, and lets go
+// of the frames it's done with (MADV_DONTNEED), so what's resident stays a
+// window around the current frame however long the file is.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#define FIELD_VERSION 1
+
+// frames start on multiples of this, which is a page on anything we run on
+#define FIELD_ALIGN 4096
+
+// frames madvise()d ahead of the one being shown
+#define FIELD_PREFETCH 8
+
+// widest and tallest field a reader takes
+#define FIELD_MAX_SIZE 8192
+
+struct FieldHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t frames;
+    uint64_t indexOffset;
+    double dt;
+};
+
+inline uint64_t field_align(uint64_t offset)
+{
+    return (offset + FIELD_ALIGN - 1) / FIELD_ALIGN * FIELD_ALIGN;
+}
+
+struct FieldWriter {
+    FILE* file;
+    FieldHeader header;
+    std::vector<uint64_t> offsets;
+    uint64_t offset;
+};
+
+inline bool field_writer_open(FieldWriter& w, const char* path, int width, int height, double dt)
+{
+    w.file = fopen(path, "wb");
+    if (!w.file) {
+        printf("couldn't create %s\n", path);
+        return false;
+    }
+    memset(&w.header, 0, sizeof(w.header));
+    memcpy(w.header.magic, "FELD", 4);
+    w.header.version = FIELD_VERSION;
+    w.header.width = width;
+    w.header.height = height;
+    w.header.dt = dt;
+    w.offsets.clear();
+    w.offset = field_align(sizeof(FieldHeader));
+    return true;
+}
+
+inline void field_writer_push(FieldWriter& w, const float* heights)
+{
+    fseek(w.file, w.offset, SEEK_SET);
+    size_t bytes = (size_t)w.header.width * w.header.height * sizeof(float);
+    fwrite(heights, 1, bytes, w.file);
+    w.offsets.push_back(w.offset);
+    w.offset = field_align(w.offset + bytes);
+}
+
+inline void field_writer_close(FieldWriter& w)
+{
+    w.header.frames = w.offsets.size();
+    w.header.indexOffset = w.offset;
+    fseek(w.file, w.offset, SEEK_SET);
+    fwrite(w.offsets.data(), sizeof(uint64_t), w.offsets.size(), w.file);
+    fseek(w.file, 0, SEEK_SET);
+    fwrite(&w.header, sizeof(w.header), 1, w.file);
+    fclose(w.file);
+}
+
+struct FieldReader {
+    int fd;
+    unsigned char* data;
+    size_t size;
+    FieldHeader header;
+    const uint64_t* offsets;
+    size_t frameBytes;
+
+    // frames [released, prefetched) have been asked for and not let go of
+    long released;
+    long prefetched;
+
+    // toward the next report
+    uint64_t bytes;
+    long frames;
+    struct rusage usage;
+    std::chrono::steady_clock::time_point lastReport;
+};
+
+inline bool field_reader_open(FieldReader& r, const char* path)
+{
+    r.fd = open(path, O_RDONLY);
+    if (r.fd < 0) {
+        printf("couldn't open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    fstat(r.fd, &st);
+    r.size = st.st_size;
+    if (r.size < sizeof(FieldHeader)) {
+        printf("%s is too short to be a field\n", path);
+        close(r.fd);
+        return false;
+    }
+
+    r.data = (unsigned char*)mmap(NULL, r.size, PROT_READ, MAP_SHARED, r.fd, 0);
+    if (r.data == MAP_FAILED) {
+        printf("couldn't map %s\n", path);
+        close(r.fd);
+        return false;
+    }
+
+    // the index has to fit after the frames, written without overflowing
+    memcpy(&r.header, r.data, sizeof(r.header));
+    bool valid = memcmp(r.header.magic, "FELD", 4) == 0 && r.header.version == FIELD_VERSION &&
+                 r.header.width > 0 && r.header.width <= FIELD_MAX_SIZE &&
+                 r.header.height > 0 && r.header.height <= FIELD_MAX_SIZE && r.header.frames > 0 &&
+                 r.header.indexOffset % sizeof(uint64_t) == 0 && r.header.indexOffset <= r.size &&
+                 r.header.frames <= (r.size - r.header.indexOffset) / sizeof(uint64_t);
+    r.frameBytes = (size_t)r.header.width * r.header.height * sizeof(float);
+
+    // and every frame, on its boundary, between the header and the index
+    r.offsets = (const uint64_t*)(r.data + r.header.indexOffset);
+    for (uint64_t i = 0; valid && i < r.header.frames; i++) {
+        uint64_t offset = r.offsets[i];
+        valid = offset % FIELD_ALIGN == 0 && offset >= field_align(sizeof(FieldHeader)) &&
+                offset <= r.header.indexOffset && r.frameBytes <= r.header.indexOffset - offset;
+    }
+    if (!valid) {
+        printf("%s is not a complete field\n", path);
+        munmap(r.data, r.size);
+        close(r.fd);
+        return false;
+    }
+
+    // the kernel's own read ahead for whatever the prefetch doesn't cover
+    madvise(r.data, r.size, MADV_SEQUENTIAL);
+
+    r.released = r.prefetched = 0;
+    r.bytes = 0;
+    r.frames = 0;
+    getrusage(RUSAGE_SELF, &r.usage);
+    r.lastReport = std::chrono::steady_clock::now();
+    return true;
+}
+
+// madvise() the pages under frame n, which start on a page but may not end
+// on one
+inline void field_reader_advise(FieldReader& r, long n, int advice)
+{
+    madvise(r.data + r.offsets[n], field_align(r.frameBytes), advice);
+}
+
+// Frame n, wrapping around at the end, as a pointer into the mapping. Asks
+// for the frames after it and lets go of the ones before. n counts up
+// through the loops, so a window straddling the end still moves forward.
+inline const float* field_reader_frame(FieldReader& r, long n)
+{
+    long frames = (long)r.header.frames;
+
+    // jumped backwards: start the window over
+    if (n < r.released) {
+        for (long i = r.released; i < r.prefetched; i++)
+            field_reader_advise(r, i % frames, MADV_DONTNEED);
+        r.released = r.prefetched = n;
+    }
+    for (long i = r.released; i < std::min(n, r.prefetched); i++)
+        field_reader_advise(r, i % frames, MADV_DONTNEED);
+    r.released = n;
+    r.prefetched = std::max(r.prefetched, n);
+    for (; r.prefetched <= n + FIELD_PREFETCH; r.prefetched++)
+        field_reader_advise(r, r.prefetched % frames, MADV_WILLNEED);
+
+    r.bytes += r.frameBytes;
+    r.frames++;
+    return (const float*)(r.data + r.offsets[n % frames]);
+}
+
+// Once a second, how fast frames have been going through and how often
+// touching them faulted. Major faults had to wait for the disk.
+inline void field_reader_report(FieldReader& r)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - r.lastReport).count();
+    if (seconds < 1.0)
+        return;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("field: %5.1f frames/s, %7.1f MB/s, %ld major and %ld minor page faults\n",
+           r.frames / seconds, r.bytes / seconds / 1e6,
+           usage.ru_majflt - r.usage.ru_majflt, usage.ru_minflt - r.usage.ru_minflt);
+    r.usage = usage;
+    r.bytes = 0;
+    r.frames = 0;
+    r.lastReport = now;
+}
+
+// Drop the whole file from the page cache, for timing reads from disk
+inline void field_reader_evict(FieldReader& r)
+{
+    madvise(r.data, r.size, MADV_DONTNEED);
+    posix_fadvise(r.fd, 0, r.size, POSIX_FADV_DONTNEED);
+    r.released = r.prefetched = 0;
+}
+
+inline void field_reader_close(FieldReader& r)
+{
+    munmap(r.data, r.size);
+    close(r.fd);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+// A linear allocator for things that only live for one frame.
+//
+// Allocating just bumps an offset into one block of memory, freeing does
+// nothing, and frame_arena_reset() at the top of the frame takes everything
+// back at once. So once the block is big enough a frame never touches the
+// heap, however many transient lists it builds.
+//
+// If a frame asks for more than fits, the rest comes from the heap (and is
+// freed at the reset) and the block is regrown to fit at the next reset, so
+// running out costs a few allocations once rather than failing. Those show
+// up in alloc_stats.h's counts like any other allocation.
+//
+// FrameAllocator lets standard containers live in the arena, e.g.
+//
+//     FrameVector<int> visible(FrameAllocator<int>(arena));
+//
+// Nothing allocated from the arena may be used after the next reset.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "alloc_stats.h"
+
+struct FrameArena {
+    char* memory;
+    size_t capacity;
+    size_t used;
+    size_t highWater;       // most any frame has asked for
+
+    // what didn't fit this frame
+    std::vector<void*> overflow;
+    size_t overflowBytes;
+};
+
+inline void frame_arena_init(FrameArena& a, size_t capacity)
+{
+    a.memory = (char*)malloc(capacity);
+    a.capacity = capacity;
+    a.used = 0;
+    a.highWater = 0;
+    a.overflowBytes = 0;
+    if (!a.memory) {
+        printf("couldn't allocate a %zu byte frame arena\n", capacity);
+        exit(1);
+    }
+}
+
+inline void* frame_arena_alloc(FrameArena& a, size_t size, size_t align = alignof(std::max_align_t))
+{
+    size_t offset = (a.used + align - 1) & ~(align - 1);
+    if (offset + size <= a.capacity) {
+        a.used = offset + size;
+        return a.memory + offset;
+    }
+
+    // aligned_alloc() wants a size that's a multiple of the alignment
+    align = std::max(align, alignof(std::max_align_t));
+    void* p = aligned_alloc(align, (std::max(size, (size_t)1) + align - 1) / align * align);
+    if (!p) {
+        printf("frame arena overflow of %zu bytes failed\n", size);
+        exit(1);
+    }
+    a.overflow.push_back(p);
+    a.overflowBytes += size + align;     // with room for the padding
+    alloc_stats_count(size);
+    return p;
+}
+
+// Start a new frame, invalidating everything allocated in the last one
+inline void frame_arena_reset(FrameArena& a)
+{
+    size_t asked = a.used + a.overflowBytes;
+    a.highWater = std::max(a.highWater, asked);
+
+    for (size_t i = 0; i < a.overflow.size(); i++)
+        free(a.overflow[i]);
+    a.overflow.clear();
+
+    // grow with some room to spare, so a frame that's just slightly
+    // bigger doesn't overflow again
+    if (a.overflowBytes > 0) {
+        free(a.memory);
+        a.capacity = std::max(2 * a.capacity, asked + asked / 2);
+        a.memory = (char*)malloc(a.capacity);
+        if (!a.memory) {
+            printf("couldn't grow the frame arena to %zu bytes\n", a.capacity);
+            exit(1);
+        }
+    }
+
+    a.used = 0;
+    a.overflowBytes = 0;
+}
+
+inline void frame_arena_destroy(FrameArena& a)
+{
+    frame_arena_reset(a);
+    free(a.memory);
+    a.memory = NULL;
+}
+
+// Standard allocator interface over a FrameArena
+template <class T>
+struct FrameAllocator {
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    explicit FrameAllocator(FrameArena& arena) : arena(&arena) {}
+    template <class U>
+    FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n)
+    {
+        return (T*)frame_arena_alloc(*arena, n * sizeof(T), alignof(T));
+    }
+
+    // all given back at the reset
+    void deallocate(T*, size_t) {}
+};
+
+template <class T, class U>
+inline bool operator==(const FrameAllocator<T>& a, const FrameAllocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template <class T, class U>
+inline bool operator!=(const FrameAllocator<T>& a, const FrameAllocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+template <class T>
+using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+#endif
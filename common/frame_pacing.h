@@ -0,0 +1,206 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+// Frame pacing and input latency.
+//
+// The loops go poll input, update, draw, swap: frame_pacing_poll() at the
+// top and frame_pacing_swap() at the bottom, so what's shown is always the
+// frame that was just drawn from the input that was just read.
+//
+// With a swap interval the swap waits for that many refreshes (0 turns vsync
+// off). With maxQueued a fence goes in after every swap, and the next frame
+// doesn't poll input until fewer than maxQueued frames are still waiting on
+// the GPU. Drivers will otherwise let the CPU run a few frames ahead, and each
+// queued frame is a frame's worth of latency between reading the input and
+// showing it; 1 means every frame starts from an idle GPU.
+//
+// The latency measurement runs on the GPU's clock: right after polling,
+// glGetInteger64v(GL_TIMESTAMP) reads what the GPU clock says at that moment,
+// and a glQueryCounter after the frame's last command records when the GPU
+// got through it. The results are picked up a few frames later without
+// waiting on them, and reported once a second.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#include "trace.h"
+
+#define FRAME_PACING_MAX_QUEUED 8
+#define FRAME_PACING_QUERIES 8
+
+// longest a frame waits on the oldest queued one, in ns
+#define FRAME_PACING_TIMEOUT 1000000000ull
+
+struct FramePacing {
+    int maxQueued;          // 0 for whatever the driver does
+    bool latency;
+    bool timerQueries;
+
+    // fences after each swap still in flight, oldest first
+    GLsync fences[FRAME_PACING_MAX_QUEUED];
+    int fenceHead;
+    int fencesInFlight;
+
+    // timestamp queries still in flight, each with the GPU time its frame's
+    // input was sampled
+    GLuint queries[FRAME_PACING_QUERIES];
+    GLint64 queryInput[FRAME_PACING_QUERIES];
+    int queryHead;
+    int queriesInFlight;
+    GLint64 input;
+
+    // toward the next report
+    std::chrono::steady_clock::time_point lastReport;
+    double latencyTotal;    // ms
+    double latencyWorst;
+    int latencySamples;
+    double waitTotal;       // ms spent waiting on queued frames
+    int frames;
+};
+
+#define FRAME_PACING_USAGE "[--swap-interval N] [--max-queued N] [--latency]"
+
+// For the argument loops: takes --swap-interval N, --max-queued N or
+// --latency at argv[i], false if it's none of those
+inline bool frame_pacing_arg(int argc, char** argv, int& i, int& swapInterval, int& maxQueued, bool& latency)
+{
+    if (strcmp(argv[i], "--swap-interval") == 0 && i + 1 < argc) {
+        swapInterval = std::max(0, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--max-queued") == 0 && i + 1 < argc) {
+        maxQueued = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--latency") == 0) {
+        latency = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// swapInterval < 0 leaves the driver's default alone
+inline void frame_pacing_init(FramePacing& p, int swapInterval, int maxQueued, bool latency)
+{
+    if (swapInterval >= 0) {
+        glfwSwapInterval(swapInterval);
+    }
+    p.maxQueued = std::min(std::max(maxQueued, 0), FRAME_PACING_MAX_QUEUED);
+    p.latency = latency;
+    p.fenceHead = p.fencesInFlight = 0;
+    p.queryHead = p.queriesInFlight = 0;
+    p.input = 0;
+
+    p.timerQueries = latency && GLEW_ARB_timer_query;
+    if (p.timerQueries) {
+        glGenQueries(FRAME_PACING_QUERIES, p.queries);
+    } else if (latency) {
+        printf("no timer queries, can't measure latency\n");
+    }
+
+    p.lastReport = std::chrono::steady_clock::now();
+    p.latencyTotal = p.latencyWorst = 0.0;
+    p.latencySamples = 0;
+    p.waitTotal = 0.0;
+    p.frames = 0;
+}
+
+// Start a frame: wait for a free slot if too many are queued, then read
+// the input
+inline void frame_pacing_poll(FramePacing& p)
+{
+    if (p.maxQueued > 0 && p.fencesInFlight >= p.maxQueued) {
+        TRACE_SCOPE("frame pacing wait");
+        auto t_start = std::chrono::steady_clock::now();
+        int oldest = (p.fenceHead - p.fencesInFlight + FRAME_PACING_MAX_QUEUED) % FRAME_PACING_MAX_QUEUED;
+        glClientWaitSync(p.fences[oldest], GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_PACING_TIMEOUT);
+        glDeleteSync(p.fences[oldest]);
+        p.fencesInFlight--;
+        p.waitTotal += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+    }
+
+    TRACE_BEGIN("glfwPollEvents");
+    glfwPollEvents();
+    TRACE_END();
+
+    if (p.timerQueries) {
+        glGetInteger64v(GL_TIMESTAMP, &p.input);
+    }
+}
+
+// Pick up whichever timestamps have landed
+inline void frame_pacing_collect(FramePacing& p)
+{
+    while (p.queriesInFlight > 0) {
+        int oldest = (p.queryHead - p.queriesInFlight + FRAME_PACING_QUERIES) % FRAME_PACING_QUERIES;
+        GLint available = 0;
+        glGetQueryObjectiv(p.queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 done;
+        glGetQueryObjectui64v(p.queries[oldest], GL_QUERY_RESULT, &done);
+        p.queriesInFlight--;
+
+        double ms = (double)((GLint64)done - p.queryInput[oldest]) / 1e6;
+        p.latencyTotal += ms;
+        p.latencyWorst = std::max(p.latencyWorst, ms);
+        p.latencySamples++;
+    }
+}
+
+// Finish a frame: timestamp the end of its commands, swap, fence
+inline void frame_pacing_swap(FramePacing& p, GLFWwindow* window)
+{
+    // when the GPU is so far behind that every query is still out, this
+    // frame goes unmeasured
+    if (p.timerQueries && p.queriesInFlight < FRAME_PACING_QUERIES) {
+        glQueryCounter(p.queries[p.queryHead], GL_TIMESTAMP);
+        p.queryInput[p.queryHead] = p.input;
+        p.queryHead = (p.queryHead + 1) % FRAME_PACING_QUERIES;
+        p.queriesInFlight++;
+    }
+
+    TRACE_BEGIN("glfwSwapBuffers");
+    glfwSwapBuffers(window);
+    TRACE_END();
+
+    if (p.maxQueued > 0) {
+        p.fences[p.fenceHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        p.fenceHead = (p.fenceHead + 1) % FRAME_PACING_MAX_QUEUED;
+        p.fencesInFlight++;
+    }
+
+    if (p.timerQueries) {
+        frame_pacing_collect(p);
+    }
+
+    p.frames++;
+    auto t_now = std::chrono::steady_clock::now();
+    if ((p.latency || p.maxQueued > 0) && t_now - p.lastReport >= std::chrono::seconds(1)) {
+        if (p.latencySamples > 0) {
+            printf("input to GPU done %6.2f ms average, %6.2f ms worst, ",
+                   p.latencyTotal / p.latencySamples, p.latencyWorst);
+        }
+        printf("%.1f fps, %.2f ms per frame waiting on queued frames\n",
+               p.frames / std::chrono::duration<double>(t_now - p.lastReport).count(), p.waitTotal / p.frames);
+        p.lastReport = t_now;
+        p.latencyTotal = p.latencyWorst = 0.0;
+        p.latencySamples = 0;
+        p.waitTotal = 0.0;
+        p.frames = 0;
+    }
+}
+
+inline void frame_pacing_destroy(FramePacing& p)
+{
+    while (p.fencesInFlight > 0) {
+        int oldest = (p.fenceHead - p.fencesInFlight + FRAME_PACING_MAX_QUEUED) % FRAME_PACING_MAX_QUEUED;
+        glDeleteSync(p.fences[oldest]);
+        p.fencesInFlight--;
+    }
+    if (p.timerQueries) {
+        glDeleteQueries(FRAME_PACING_QUERIES, p.queries);
+    }
+}
+
+#endif
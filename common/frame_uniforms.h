@@ -0,0 +1,84 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+// Per frame data shared by every program, in one uniform buffer.
+//
+// The camera, the time and the viewport are the same for everything drawn in
+// a frame, so rather than setting them on each program they're written once
+// per frame into a uniform buffer that stays bound to FRAME_UNIFORMS_BINDING.
+// Each program's "Frame" block is pointed at that binding once, after it's
+// linked. Shaders declare the block as
+//
+//     layout(std140) uniform Frame {
+//         mat4 view;
+//         mat4 proj;
+//         mat4 viewProj;
+//         vec4 viewport;
+//         float time;
+//     };
+//
+// which has to match FrameUniforms below field for field.
+
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+
+#define FRAME_UNIFORMS_BINDING 0
+
+// std140: each mat4 is four vec4 columns, a vec4 is 16 bytes aligned and a
+// lone float only needs 4, with the block rounded up to 16 bytes
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::mat4 viewProj;     // proj * view, once rather than per vertex
+    glm::vec4 viewport;     // x, y, width, height in pixels
+    float time;
+    float pad[3];
+};
+
+struct FrameUniformBuffer {
+    FrameUniforms data;
+    GLuint ubo;
+};
+
+inline void frame_uniforms_init(FrameUniformBuffer& f)
+{
+    f.data = FrameUniforms();
+    glGenBuffers(1, &f.ubo);
+    glstate_bind_buffer(GL_UNIFORM_BUFFER, f.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, f.ubo);
+}
+
+// Point `program`'s Frame block at the shared binding. Programs that don't
+// use the block are left alone.
+inline void frame_uniforms_bind_program(GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, "Frame");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, index, FRAME_UNIFORMS_BINDING);
+    }
+}
+
+inline void frame_uniforms_set_camera(FrameUniformBuffer& f, const glm::mat4& view, const glm::mat4& proj)
+{
+    f.data.view = view;
+    f.data.proj = proj;
+    f.data.viewProj = proj * view;
+}
+
+// Send this frame's values, once per frame before anything is drawn
+inline void frame_uniforms_update(FrameUniformBuffer& f, float time, int width, int height)
+{
+    f.data.viewport = glm::vec4(0.0f, 0.0f, width, height);
+    f.data.time = time;
+    glstate_bind_buffer(GL_UNIFORM_BUFFER, f.ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &f.data);
+}
+
+inline void frame_uniforms_destroy(FrameUniformBuffer& f)
+{
+    glstate_delete_buffers(1, &f.ubo);
+}
+
+#endif
@@ -0,0 +1,422 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+// A shadow copy of the GL state we touch every frame, so calls that wouldn't
+// change anything never reach the driver.
+//
+// Each glstate_* function mirrors the GL call of the same name. It compares
+// against what it last set and only forwards the call if something changed,
+// counting forwarded ("issued") and dropped ("filtered") calls as it goes.
+// Anything that changes state behind the cache's back has to be followed by
+// glstate_invalidate(), after which the next call of each kind goes through
+// unconditionally.
+//
+// Each thread has a cache of its own, for the context current on it, reached
+// through glstate().
+
+#include <cmath>
+
+#define GLSTATE_TEXTURE_UNITS 16
+
+// shadowed enable bits, everything else is passed straight through
+#define GLSTATE_CAPS 8
+static const GLenum glstate_caps[GLSTATE_CAPS] = {
+    GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_SCISSOR_TEST,
+    GL_CULL_FACE, GL_MULTISAMPLE, GL_PRIMITIVE_RESTART, GL_RASTERIZER_DISCARD
+};
+
+#define GLSTATE_BUFFER_TARGETS 9
+static const GLenum glstate_buffer_targets[GLSTATE_BUFFER_TARGETS] = {
+    GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER,
+    GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_COPY_READ_BUFFER,
+    GL_COPY_WRITE_BUFFER, GL_TEXTURE_BUFFER, GL_DRAW_INDIRECT_BUFFER
+};
+
+#define GLSTATE_TEXTURE_TARGETS 4
+static const GLenum glstate_texture_targets[GLSTATE_TEXTURE_TARGETS] = {
+    GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER, GL_TEXTURE_2D_MULTISAMPLE
+};
+
+// names can't be ~0, so that marks a binding we don't know
+#define GLSTATE_UNKNOWN 0xffffffffu
+
+struct GLState {
+    int enabled[GLSTATE_CAPS];      // 0, 1, or -1 for unknown
+    GLuint buffers[GLSTATE_BUFFER_TARGETS];
+    GLuint textures[GLSTATE_TEXTURE_UNITS][GLSTATE_TEXTURE_TARGETS];
+    GLenum activeTexture;
+    GLuint program;
+    GLuint vertexArray;
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+
+    GLint viewport[4];
+    GLint scissor[4];
+
+    GLenum depthFunc;
+    int depthMask;
+    GLfloat clearDepth;
+    GLfloat clearColor[4];
+
+    GLenum stencilFunc;
+    GLint stencilRef;
+    GLuint stencilValueMask;
+    GLenum stencilOp[3];
+    GLuint stencilWriteMask;
+
+    GLenum blendSrc;
+    GLenum blendDst;
+
+    // counts since the last glstate_frame(), binds being the issued buffer
+    // and vertex array bindings
+    long issued;
+    long filtered;
+    long binds;
+
+    // counts over the last whole frame
+    long frameIssued;
+    long frameFiltered;
+    long frameBinds;
+};
+
+inline GLState& glstate()
+{
+    static thread_local GLState state;
+    return state;
+}
+
+// Forget everything, so the next call of each kind is issued
+inline void glstate_invalidate()
+{
+    GLState& s = glstate();
+    for (int i = 0; i < GLSTATE_CAPS; i++)
+        s.enabled[i] = -1;
+    for (int i = 0; i < GLSTATE_BUFFER_TARGETS; i++)
+        s.buffers[i] = GLSTATE_UNKNOWN;
+    for (int i = 0; i < GLSTATE_TEXTURE_UNITS; i++)
+        for (int j = 0; j < GLSTATE_TEXTURE_TARGETS; j++)
+            s.textures[i][j] = GLSTATE_UNKNOWN;
+    s.activeTexture = GLSTATE_UNKNOWN;
+    s.program = GLSTATE_UNKNOWN;
+    s.vertexArray = GLSTATE_UNKNOWN;
+    s.drawFramebuffer = GLSTATE_UNKNOWN;
+    s.readFramebuffer = GLSTATE_UNKNOWN;
+
+    // no valid call sets a negative size and NaN never compares equal, so
+    // none of these match anything
+    s.viewport[2] = -1;
+    s.scissor[2] = -1;
+
+    s.depthFunc = GLSTATE_UNKNOWN;
+    s.depthMask = -1;
+    s.clearDepth = NAN;
+    s.clearColor[0] = NAN;
+
+    s.stencilFunc = GLSTATE_UNKNOWN;
+    s.stencilOp[0] = GLSTATE_UNKNOWN;
+    s.stencilWriteMask = GLSTATE_UNKNOWN;
+    s.stencilValueMask = 0;
+
+    s.blendSrc = GLSTATE_UNKNOWN;
+}
+
+// Call once per frame. The counts for the frame just finished are left in
+// frameIssued and frameFiltered.
+inline void glstate_frame()
+{
+    GLState& s = glstate();
+    s.frameIssued = s.issued;
+    s.frameFiltered = s.filtered;
+    s.frameBinds = s.binds;
+    s.issued = 0;
+    s.filtered = 0;
+    s.binds = 0;
+}
+
+// true if the call has to be issued
+inline bool glstate_changed(bool changed)
+{
+    GLState& s = glstate();
+    if (changed)
+        s.issued++;
+    else
+        s.filtered++;
+    return changed;
+}
+
+inline int glstate_cap_index(GLenum cap)
+{
+    for (int i = 0; i < GLSTATE_CAPS; i++)
+        if (glstate_caps[i] == cap)
+            return i;
+    return -1;
+}
+
+inline void glstate_enable(GLenum cap)
+{
+    int i = glstate_cap_index(cap);
+    if (i < 0) {
+        glstate().issued++;
+        glEnable(cap);
+    } else if (glstate_changed(glstate().enabled[i] != 1)) {
+        glstate().enabled[i] = 1;
+        glEnable(cap);
+    }
+}
+
+inline void glstate_disable(GLenum cap)
+{
+    int i = glstate_cap_index(cap);
+    if (i < 0) {
+        glstate().issued++;
+        glDisable(cap);
+    } else if (glstate_changed(glstate().enabled[i] != 0)) {
+        glstate().enabled[i] = 0;
+        glDisable(cap);
+    }
+}
+
+// What glIsEnabled would say, without asking the driver if we already know
+inline bool glstate_is_enabled(GLenum cap)
+{
+    int i = glstate_cap_index(cap);
+    if (i < 0 || glstate().enabled[i] < 0)
+        return glIsEnabled(cap);
+    return glstate().enabled[i] == 1;
+}
+
+inline int glstate_buffer_index(GLenum target)
+{
+    for (int i = 0; i < GLSTATE_BUFFER_TARGETS; i++)
+        if (glstate_buffer_targets[i] == target)
+            return i;
+    return -1;
+}
+
+inline void glstate_bind_buffer(GLenum target, GLuint buffer)
+{
+    int i = glstate_buffer_index(target);
+    if (i < 0) {
+        glstate().issued++;
+        glstate().binds++;
+        glBindBuffer(target, buffer);
+    } else if (glstate_changed(glstate().buffers[i] != buffer)) {
+        glstate().buffers[i] = buffer;
+        glstate().binds++;
+        glBindBuffer(target, buffer);
+    }
+}
+
+inline void glstate_bind_vertex_array(GLuint vertexArray)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.vertexArray != vertexArray)) {
+        s.vertexArray = vertexArray;
+        s.binds++;
+        glBindVertexArray(vertexArray);
+
+        // the element buffer binding belongs to the vertex array
+        s.buffers[glstate_buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = GLSTATE_UNKNOWN;
+    }
+}
+
+inline void glstate_active_texture(GLenum unit)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.activeTexture != unit)) {
+        s.activeTexture = unit;
+        glActiveTexture(unit);
+    }
+}
+
+// Bind `texture` to texture unit `unit` (0, 1, ... not GL_TEXTURE0 + n) and
+// leave that unit active, so glTexImage2D and friends work on it afterwards
+inline void glstate_bind_texture(int unit, GLenum target, GLuint texture)
+{
+    GLState& s = glstate();
+    int t = 0;
+    while (t < GLSTATE_TEXTURE_TARGETS && glstate_texture_targets[t] != target)
+        t++;
+
+    glstate_active_texture(GL_TEXTURE0 + unit);
+    if (t == GLSTATE_TEXTURE_TARGETS || unit >= GLSTATE_TEXTURE_UNITS) {
+        s.issued++;
+        glBindTexture(target, texture);
+    } else if (glstate_changed(s.textures[unit][t] != texture)) {
+        s.textures[unit][t] = texture;
+        glBindTexture(target, texture);
+    }
+}
+
+inline void glstate_use_program(GLuint program)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.program != program)) {
+        s.program = program;
+        glUseProgram(program);
+    }
+}
+
+inline void glstate_bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+    GLState& s = glstate();
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    if (glstate_changed((draw && s.drawFramebuffer != framebuffer) ||
+                        (read && s.readFramebuffer != framebuffer))) {
+        if (draw)
+            s.drawFramebuffer = framebuffer;
+        if (read)
+            s.readFramebuffer = framebuffer;
+        glBindFramebuffer(target, framebuffer);
+    }
+}
+
+inline void glstate_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint* v = glstate().viewport;
+    if (glstate_changed(v[0] != x || v[1] != y || v[2] != width || v[3] != height)) {
+        v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+        glViewport(x, y, width, height);
+    }
+}
+
+inline void glstate_scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint* v = glstate().scissor;
+    if (glstate_changed(v[0] != x || v[1] != y || v[2] != width || v[3] != height)) {
+        v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+        glScissor(x, y, width, height);
+    }
+}
+
+inline void glstate_depth_func(GLenum func)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.depthFunc != func)) {
+        s.depthFunc = func;
+        glDepthFunc(func);
+    }
+}
+
+inline void glstate_depth_mask(GLboolean flag)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.depthMask != (flag ? 1 : 0))) {
+        s.depthMask = flag ? 1 : 0;
+        glDepthMask(flag);
+    }
+}
+
+inline void glstate_clear_depth(GLfloat depth)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.clearDepth != depth)) {
+        s.clearDepth = depth;
+        glClearDepth(depth);
+    }
+}
+
+inline void glstate_clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+    GLfloat* c = glstate().clearColor;
+    if (glstate_changed(c[0] != r || c[1] != g || c[2] != b || c[3] != a)) {
+        c[0] = r; c[1] = g; c[2] = b; c[3] = a;
+        glClearColor(r, g, b, a);
+    }
+}
+
+inline void glstate_stencil_func(GLenum func, GLint ref, GLuint mask)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.stencilFunc != func || s.stencilRef != ref || s.stencilValueMask != mask)) {
+        s.stencilFunc = func;
+        s.stencilRef = ref;
+        s.stencilValueMask = mask;
+        glStencilFunc(func, ref, mask);
+    }
+}
+
+inline void glstate_stencil_op(GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+    GLenum* op = glstate().stencilOp;
+    if (glstate_changed(op[0] != sfail || op[1] != dpfail || op[2] != dppass)) {
+        op[0] = sfail; op[1] = dpfail; op[2] = dppass;
+        glStencilOp(sfail, dpfail, dppass);
+    }
+}
+
+inline void glstate_stencil_mask(GLuint mask)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.stencilWriteMask != mask)) {
+        s.stencilWriteMask = mask;
+        glStencilMask(mask);
+    }
+}
+
+inline void glstate_blend_func(GLenum src, GLenum dst)
+{
+    GLState& s = glstate();
+    if (glstate_changed(s.blendSrc != src || s.blendDst != dst)) {
+        s.blendSrc = src;
+        s.blendDst = dst;
+        glBlendFunc(src, dst);
+    }
+}
+
+// Deleting an object unbinds it, and its name may come back from the next
+// glGen*, so drop it from the cache too
+inline void glstate_delete_buffers(GLsizei n, const GLuint* buffers)
+{
+    GLState& s = glstate();
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < GLSTATE_BUFFER_TARGETS; j++)
+            if (s.buffers[j] == buffers[i])
+                s.buffers[j] = GLSTATE_UNKNOWN;
+    glDeleteBuffers(n, buffers);
+}
+
+inline void glstate_delete_textures(GLsizei n, const GLuint* textures)
+{
+    GLState& s = glstate();
+    for (int i = 0; i < n; i++)
+        for (int u = 0; u < GLSTATE_TEXTURE_UNITS; u++)
+            for (int t = 0; t < GLSTATE_TEXTURE_TARGETS; t++)
+                if (s.textures[u][t] == textures[i])
+                    s.textures[u][t] = GLSTATE_UNKNOWN;
+    glDeleteTextures(n, textures);
+}
+
+inline void glstate_delete_framebuffers(GLsizei n, const GLuint* framebuffers)
+{
+    GLState& s = glstate();
+    for (int i = 0; i < n; i++) {
+        if (s.drawFramebuffer == framebuffers[i])
+            s.drawFramebuffer = GLSTATE_UNKNOWN;
+        if (s.readFramebuffer == framebuffers[i])
+            s.readFramebuffer = GLSTATE_UNKNOWN;
+    }
+    glDeleteFramebuffers(n, framebuffers);
+}
+
+inline void glstate_delete_vertex_arrays(GLsizei n, const GLuint* vertexArrays)
+{
+    GLState& s = glstate();
+    for (int i = 0; i < n; i++) {
+        if (s.vertexArray == vertexArrays[i]) {
+            s.vertexArray = GLSTATE_UNKNOWN;
+            s.buffers[glstate_buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = GLSTATE_UNKNOWN;
+        }
+    }
+    glDeleteVertexArrays(n, vertexArrays);
+}
+
+inline void glstate_delete_program(GLuint program)
+{
+    if (glstate().program == program)
+        glstate().program = GLSTATE_UNKNOWN;
+    glDeleteProgram(program);
+}
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef GPU_HEAP_H
+#define GPU_HEAP_H
+
+// Vertex, index and instance data sub-allocated out of a few large buffers.
+//
+// Instead of a buffer object for every mesh, data goes into blocks of
+// GPU_HEAP_BLOCK bytes (bigger for a bigger allocation, smaller when that's
+// all the budget has left), and an allocation is a block and a range of
+// bytes in it. Everything in one block can be drawn without binding another
+// buffer: the block is both the array and the element buffer of a vertex
+// array, attribute offsets or a base vertex pick out the vertices and the
+// index offset picks out the indices. Each block keeps its free ranges in
+// order of offset, hands out the first one that fits and merges ranges back
+// together as they're freed.
+//
+// A freed range can't be handed out again straight away, since draws already
+// sent may still read it. The ranges freed during a frame wait behind a
+// fence gpu_heap_frame() puts after the frame's commands, and go back on
+// their free lists once the GPU has passed it. Nothing is deleted until
+// gpu_heap_destroy().
+//
+// What's allocated is tallied by category against a budget for the whole
+// heap, with storage that isn't sub-allocated (textures, say) added through
+// gpu_heap_track(). The budget covers what the heap actually holds on the
+// GPU, the blocks as a whole and the tracked storage, and an allocation that
+// would need more than that fails.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "glstate.h"
+
+// bytes in a block
+#define GPU_HEAP_BLOCK (4 << 20)
+
+// every range starts on a multiple of this, which suits any vertex layout
+// of up to 64 floats and any uniform buffer offset alignment GL allows
+#define GPU_HEAP_ALIGN 256
+
+enum GpuCategory {
+    GPU_VERTEX,
+    GPU_INDEX,
+    GPU_INSTANCE,
+    GPU_UNIFORM,
+    GPU_TEXTURE,
+    GPU_CATEGORIES
+};
+
+static const char* gpu_category_names[GPU_CATEGORIES] = {
+    "vertex", "index", "instance", "uniform", "texture"
+};
+
+struct GpuAlloc {
+    int block;          // -1 for none
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+    GpuCategory category;
+};
+
+struct GpuHeapBlock {
+    GLuint buffer;
+    GLsizeiptr size;
+    std::map<GLintptr, GLsizeiptr> free;    // offset to size, never adjacent
+};
+
+// the ranges freed in one frame, waiting on its fence
+struct GpuHeapRetired {
+    GLsync fence;
+    std::vector<GpuAlloc> ranges;
+};
+
+struct GpuHeap {
+    std::vector<GpuHeapBlock> blocks;
+    GLsizeiptr budget;      // 0 for none
+    GLsizeiptr reserved;    // all the blocks
+
+    long bytes[GPU_CATEGORIES];
+    long allocations[GPU_CATEGORIES];
+
+    std::vector<GpuAlloc> freed;            // this frame's
+    std::vector<GpuHeapRetired> retired;    // oldest first
+    GLsizeiptr retiredBytes;
+    long recycled;                          // ranges back on a free list
+};
+
+inline void gpu_heap_init(GpuHeap& h, GLsizeiptr budget)
+{
+    h.blocks.clear();
+    h.budget = budget;
+    h.reserved = 0;
+    for (int i = 0; i < GPU_CATEGORIES; i++) {
+        h.bytes[i] = 0;
+        h.allocations[i] = 0;
+    }
+    h.freed.clear();
+    h.retired.clear();
+    h.retiredBytes = 0;
+    h.recycled = 0;
+}
+
+inline GLsizeiptr gpu_heap_held(const GpuHeap& h)
+{
+    return h.reserved + h.bytes[GPU_TEXTURE];
+}
+
+inline bool gpu_heap_fits(const GpuHeap& h, GLsizeiptr more)
+{
+    return h.budget <= 0 || gpu_heap_held(h) + more <= h.budget;
+}
+
+// Put a range back on its block's free list, merged with its neighbors
+inline void gpu_heap_release(GpuHeap& h, const GpuAlloc& a)
+{
+    std::map<GLintptr, GLsizeiptr>& free = h.blocks[a.block].free;
+    GLintptr offset = a.offset;
+    GLsizeiptr size = a.size;
+
+    std::map<GLintptr, GLsizeiptr>::iterator next = free.lower_bound(offset);
+    if (next != free.end() && offset + size == next->first) {
+        size += next->second;
+        next = free.erase(next);
+    }
+    if (next != free.begin()) {
+        std::map<GLintptr, GLsizeiptr>::iterator prev = next;
+        --prev;
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    free[offset] = size;
+}
+
+// Recycle everything whose fence has passed, waiting for the oldest one if
+// `wait` and there is one. False if nothing was, which with `wait` means the
+// oldest fence didn't pass within a second or the wait failed.
+inline bool gpu_heap_collect(GpuHeap& h, bool wait)
+{
+    size_t done = 0;
+    for (; done < h.retired.size(); done++) {
+        GpuHeapRetired& r = h.retired[done];
+        GLenum status = glClientWaitSync(r.fence, wait && done == 0 ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait && done == 0 ? 1000000000ull : 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(r.fence);
+        for (size_t i = 0; i < r.ranges.size(); i++) {
+            gpu_heap_release(h, r.ranges[i]);
+            h.retiredBytes -= r.ranges[i].size;
+        }
+        h.recycled += r.ranges.size();
+    }
+    h.retired.erase(h.retired.begin(), h.retired.begin() + done);
+    return done > 0;
+}
+
+// First fit in the existing blocks, or -1
+inline int gpu_heap_fit(GpuHeap& h, GLsizeiptr size, GLintptr& offset)
+{
+    for (size_t b = 0; b < h.blocks.size(); b++) {
+        std::map<GLintptr, GLsizeiptr>& free = h.blocks[b].free;
+        for (std::map<GLintptr, GLsizeiptr>::iterator i = free.begin(); i != free.end(); i++) {
+            if (i->second < size)
+                continue;
+            offset = i->first;
+            GLsizeiptr left = i->second - size;
+            free.erase(i);
+            if (left > 0)
+                free[offset + size] = left;
+            return b;
+        }
+    }
+    return -1;
+}
+
+// Allocate `size` bytes of `category`, false (with a message) if that would
+// go over the budget
+inline bool gpu_heap_alloc(GpuHeap& h, GpuCategory category, GLsizeiptr size, GpuAlloc& a)
+{
+    size = (size + GPU_HEAP_ALIGN - 1) / GPU_HEAP_ALIGN * GPU_HEAP_ALIGN;
+    GLintptr offset = 0;
+    int block = gpu_heap_fit(h, size, offset);
+
+    // rather than grow past the budget, wait for what's been freed, unless
+    // the GPU stops getting through it
+    while (block < 0 && !h.retired.empty() && !gpu_heap_fits(h, size)) {
+        if (!gpu_heap_collect(h, true))
+            break;
+        block = gpu_heap_fit(h, size, offset);
+    }
+
+    if (block < 0) {
+        // a smaller block than usual if that's all the budget has left
+        GpuHeapBlock b;
+        b.size = GPU_HEAP_BLOCK;
+        if (h.budget > 0)
+            b.size = std::min(b.size, h.budget - gpu_heap_held(h));
+        b.size = std::max(b.size, size);
+        if (!gpu_heap_fits(h, b.size)) {
+            printf("gpu heap: %ld bytes of %s data would go over the budget of %.1f MB\n",
+                   (long)size, gpu_category_names[category], h.budget / 1e6);
+            a.block = -1;
+            return false;
+        }
+        glGenBuffers(1, &b.buffer);
+        glstate_bind_buffer(GL_COPY_WRITE_BUFFER, b.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, b.size, NULL, GL_STATIC_DRAW);
+        if (size < b.size)
+            b.free[size] = b.size - size;
+        h.blocks.push_back(b);
+        h.reserved += b.size;
+        block = h.blocks.size() - 1;
+        offset = 0;
+    }
+
+    a.block = block;
+    a.buffer = h.blocks[block].buffer;
+    a.offset = offset;
+    a.size = size;
+    a.category = category;
+    h.bytes[category] += size;
+    h.allocations[category]++;
+    return true;
+}
+
+// Allocate two ranges out of the same block, `a` then `b`, so a mesh's
+// vertices and indices can be drawn through one vertex array with the block
+// as both its buffers. False (with a message) if that would go over the
+// budget. Each range is freed on its own.
+inline bool gpu_heap_alloc_pair(GpuHeap& h, GpuCategory categoryA, GLsizeiptr sizeA, GpuAlloc& a,
+                                GpuCategory categoryB, GLsizeiptr sizeB, GpuAlloc& b)
+{
+    sizeA = (sizeA + GPU_HEAP_ALIGN - 1) / GPU_HEAP_ALIGN * GPU_HEAP_ALIGN;
+    sizeB = (sizeB + GPU_HEAP_ALIGN - 1) / GPU_HEAP_ALIGN * GPU_HEAP_ALIGN;
+    if (!gpu_heap_alloc(h, categoryA, sizeA + sizeB, a)) {
+        b.block = -1;
+        return false;
+    }
+
+    // one range, split in two and tallied as what each half holds
+    b = a;
+    a.size = sizeA;
+    b.offset += sizeA;
+    b.size = sizeB;
+    b.category = categoryB;
+    h.bytes[categoryA] -= sizeB;
+    h.bytes[categoryB] += sizeB;
+    h.allocations[categoryB]++;
+    return true;
+}
+
+// Write into an allocation. Nothing the GPU may still be reading is ever
+// handed out again, so the write doesn't need to wait for the draws already
+// sent from the rest of the block, which glBufferSubData can't know. False
+// (with a message) if the range couldn't be mapped.
+inline bool gpu_heap_upload(const GpuAlloc& a, const void* data, GLsizeiptr size)
+{
+    glstate_bind_buffer(GL_COPY_WRITE_BUFFER, a.buffer);
+    void* p = glMapBufferRange(GL_COPY_WRITE_BUFFER, a.offset, size,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!p) {
+        printf("gpu heap: couldn't map %ld bytes of %s data\n", (long)size, gpu_category_names[a.category]);
+        return false;
+    }
+    memcpy(p, data, size);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    return true;
+}
+
+// Give a range back. It's reused once the frame it was freed in is done on
+// the GPU.
+inline void gpu_heap_free(GpuHeap& h, GpuAlloc& a)
+{
+    if (a.block < 0)
+        return;
+    h.bytes[a.category] -= a.size;
+    h.allocations[a.category]--;
+    h.retiredBytes += a.size;
+    h.freed.push_back(a);
+    a.block = -1;
+}
+
+// Count storage the heap doesn't hand out itself, negative when it goes
+// away. False (with a message) if it doesn't fit the budget.
+inline bool gpu_heap_track(GpuHeap& h, GpuCategory category, long bytes)
+{
+    if (bytes > 0 && category == GPU_TEXTURE && !gpu_heap_fits(h, bytes)) {
+        printf("gpu heap: %ld bytes of %s data would go over the budget of %.1f MB\n",
+               bytes, gpu_category_names[category], h.budget / 1e6);
+        return false;
+    }
+    h.bytes[category] += bytes;
+    h.allocations[category] += bytes > 0 ? 1 : -1;
+    return true;
+}
+
+// Call once per frame, after its draws
+inline void gpu_heap_frame(GpuHeap& h)
+{
+    if (!h.freed.empty()) {
+        GpuHeapRetired r;
+        r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        r.ranges.swap(h.freed);
+        h.retired.push_back(r);
+    }
+    gpu_heap_collect(h, false);
+}
+
+// How much is in use by category, and how broken up the free space is:
+// fragmentation is the share of it that isn't in the largest range, so the
+// part a large allocation can't use
+inline void gpu_heap_report(const GpuHeap& h)
+{
+    GLsizeiptr free = 0, largest = 0;
+    long ranges = 0;
+    for (size_t b = 0; b < h.blocks.size(); b++) {
+        const std::map<GLintptr, GLsizeiptr>& f = h.blocks[b].free;
+        for (std::map<GLintptr, GLsizeiptr>::const_iterator i = f.begin(); i != f.end(); i++) {
+            free += i->second;
+            largest = std::max(largest, i->second);
+            ranges++;
+        }
+    }
+
+    printf("gpu heap: %.2f MB held", gpu_heap_held(h) / 1e6);
+    if (h.budget > 0)
+        printf(" of %.2f MB budget", h.budget / 1e6);
+    printf(" in %d blocks (%.2f MB) and tracked storage,", (int)h.blocks.size(), h.reserved / 1e6);
+    for (int i = 0; i < GPU_CATEGORIES; i++) {
+        if (h.allocations[i] > 0)
+            printf(" %s %.1f KB in %ld,", gpu_category_names[i], h.bytes[i] / 1e3, h.allocations[i]);
+    }
+    printf(" %.1f KB behind %d fences, %ld ranges recycled\n", h.retiredBytes / 1e3, (int)h.retired.size(),
+           h.recycled);
+    printf("gpu heap: %.2f MB free in %ld ranges, largest %.2f MB, fragmentation %.1f%%\n", free / 1e6, ranges,
+           largest / 1e6, free > 0 ? 100.0 * (free - largest) / free : 0.0);
+}
+
+inline void gpu_heap_destroy(GpuHeap& h)
+{
+    for (size_t i = 0; i < h.retired.size(); i++)
+        glDeleteSync(h.retired[i].fence);
+    h.retired.clear();
+    h.freed.clear();
+    for (size_t b = 0; b < h.blocks.size(); b++)
+        glstate_delete_buffers(1, &h.blocks[b].buffer);
+    h.blocks.clear();
+    h.reserved = 0;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef LIGHT_TILES_H
+#define LIGHT_TILES_H
+
+// Point lights binned into screen tiles, for forward+ shading.
+//
+// Every frame light_tiles_cull() works out which tiles of the screen each
+// light's sphere can reach and builds a list of lights per tile, and
+// light_tiles_upload() puts the lists in buffer textures:
+//
+//   Lights        RGBA32F, two texels a light: position and radius, color
+//   LightTiles    RG32I, a texel a tile, row by row from the bottom left:
+//                 where its list starts in LightIndices, and how long it is
+//   LightIndices  R32I, the lists one after the other
+//
+// A fragment shader finds its tile from gl_FragCoord and loops over that
+// tile's list only, so what a fragment costs goes with the lights near it
+// rather than with all of them.
+//
+// The lights are kept as a structure of arrays so the culling can project
+// four of them at once with SSE. The bounds are conservative: a sphere's
+// screen rectangle is taken from the extremes of x / -z and y / -z over the
+// box around it in view space, which never cuts a light off but can be a
+// little large up close.
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "frame_arena.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct LightTiles {
+    int count;
+
+    // in whatever space the shader lights in, padded to a multiple of four
+    std::vector<float> x, y, z, radius;
+    std::vector<glm::vec3> color;
+
+    int width, height;
+    int tileSize;
+    int tilesX, tilesY;
+    GLint maxTexels;
+
+    // from the last cull: each light's tile rectangle, empty if x0 > x1
+    std::vector<int> rects;
+    std::vector<GLint> tiles;       // first and count for each tile
+    std::vector<GLint> indices;
+    std::vector<GLint> cursor;
+    long pairs;                     // light and tile pairs, before any cap
+    bool truncated;
+
+    GLuint buffers[3];
+    GLuint textures[3];
+};
+
+inline void light_tiles_init(LightTiles& t, int count, int width, int height, int tileSize)
+{
+    t.count = count;
+    int padded = (count + 3) & ~3;
+    t.x.assign(padded, 0.0f);
+    t.y.assign(padded, 0.0f);
+    t.z.assign(padded, 0.0f);
+    t.radius.assign(padded, 0.0f);
+    t.color.assign(count, glm::vec3(0.0f));
+
+    t.width = width;
+    t.height = height;
+    t.tileSize = tileSize;
+    t.tilesX = (width + tileSize - 1) / tileSize;
+    t.tilesY = (height + tileSize - 1) / tileSize;
+    t.rects.assign(4 * padded, 0);
+    t.tiles.assign(2 * t.tilesX * t.tilesY, 0);
+    t.cursor.assign(t.tilesX * t.tilesY, 0);
+    t.indices.clear();
+    t.pairs = 0;
+    t.truncated = false;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &t.maxTexels);
+
+    GLenum formats[3] = { GL_RGBA32F, GL_RG32I, GL_R32I };
+    glGenBuffers(3, t.buffers);
+    glGenTextures(3, t.textures);
+    for (int i = 0; i < 3; i++) {
+        glstate_bind_buffer(GL_TEXTURE_BUFFER, t.buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glstate_bind_texture(0, GL_TEXTURE_BUFFER, t.textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], t.buffers[i]);
+    }
+}
+
+inline void light_tiles_set(LightTiles& t, int i, const glm::vec3& position, float radius, const glm::vec3& color)
+{
+    t.x[i] = position.x;
+    t.y[i] = position.y;
+    t.z[i] = position.z;
+    t.radius[i] = radius;
+    t.color[i] = color;
+}
+
+// The screen rectangles, in tiles, of lights [i, i + 4). m takes the lights
+// into view space, and p00 and p11 are the projection's scales.
+inline void light_tiles_bounds(LightTiles& t, int i, const glm::mat4& m, float p00, float p11, float zNear)
+{
+    float bounds[4][4];     // x0, x1, y0, y1 in NDC, four lights each
+    int whole[4];           // reaching behind the near plane
+    int behind[4];          // all of it behind the near plane
+#ifdef __SSE2__
+    __m128 px = _mm_loadu_ps(&t.x[i]);
+    __m128 py = _mm_loadu_ps(&t.y[i]);
+    __m128 pz = _mm_loadu_ps(&t.z[i]);
+    __m128 r = _mm_loadu_ps(&t.radius[i]);
+    __m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m[0][0])), _mm_mul_ps(py, _mm_set1_ps(m[1][0]))),
+                           _mm_add_ps(_mm_mul_ps(pz, _mm_set1_ps(m[2][0])), _mm_set1_ps(m[3][0])));
+    __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m[0][1])), _mm_mul_ps(py, _mm_set1_ps(m[1][1]))),
+                           _mm_add_ps(_mm_mul_ps(pz, _mm_set1_ps(m[2][1])), _mm_set1_ps(m[3][1])));
+    __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m[0][2])), _mm_mul_ps(py, _mm_set1_ps(m[1][2]))),
+                           _mm_add_ps(_mm_mul_ps(pz, _mm_set1_ps(m[2][2])), _mm_set1_ps(m[3][2])));
+    __m128 zero = _mm_setzero_ps();
+    __m128 nearZ = _mm_set1_ps(zNear);
+    __m128 d = _mm_sub_ps(zero, vz);
+    __m128 dNear = _mm_max_ps(_mm_sub_ps(d, r), nearZ);
+    __m128 dFar = _mm_max_ps(_mm_add_ps(d, r), nearZ);
+    __m128 centers[2] = { vx, vy };
+    __m128 scales[2] = { _mm_set1_ps(p00), _mm_set1_ps(p11) };
+    for (int axis = 0; axis < 2; axis++) {
+        // the low side is furthest out where it's nearest if it's negative,
+        // and the other way around; the same for the high side
+        __m128 lo = _mm_sub_ps(centers[axis], r);
+        __m128 hi = _mm_add_ps(centers[axis], r);
+        __m128 loNeg = _mm_cmplt_ps(lo, zero);
+        __m128 hiPos = _mm_cmpgt_ps(hi, zero);
+        __m128 loD = _mm_or_ps(_mm_and_ps(loNeg, dNear), _mm_andnot_ps(loNeg, dFar));
+        __m128 hiD = _mm_or_ps(_mm_and_ps(hiPos, dNear), _mm_andnot_ps(hiPos, dFar));
+        _mm_storeu_ps(bounds[2 * axis], _mm_mul_ps(scales[axis], _mm_div_ps(lo, loD)));
+        _mm_storeu_ps(bounds[2 * axis + 1], _mm_mul_ps(scales[axis], _mm_div_ps(hi, hiD)));
+    }
+    int wholeMask = _mm_movemask_ps(_mm_cmple_ps(_mm_sub_ps(d, r), nearZ));
+    int behindMask = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(d, r), nearZ));
+    for (int k = 0; k < 4; k++) {
+        whole[k] = (wholeMask >> k) & 1;
+        behind[k] = (behindMask >> k) & 1;
+    }
+#else
+    for (int k = 0; k < 4; k++) {
+        glm::vec4 v = m * glm::vec4(t.x[i + k], t.y[i + k], t.z[i + k], 1.0f);
+        float r = t.radius[i + k];
+        float d = -v.z;
+        float dNear = std::max(d - r, zNear), dFar = std::max(d + r, zNear);
+        float centers[2] = { v.x, v.y };
+        float scales[2] = { p00, p11 };
+        for (int axis = 0; axis < 2; axis++) {
+            float lo = centers[axis] - r, hi = centers[axis] + r;
+            bounds[2 * axis][k] = scales[axis] * lo / (lo < 0.0f ? dNear : dFar);
+            bounds[2 * axis + 1][k] = scales[axis] * hi / (hi > 0.0f ? dNear : dFar);
+        }
+        whole[k] = d - r <= zNear;
+        behind[k] = d + r <= zNear;
+    }
+#endif
+
+    for (int k = 0; k < 4; k++) {
+        int* rect = &t.rects[4 * (i + k)];
+        if (i + k >= t.count || behind[k]) {
+            rect[0] = 1; rect[1] = 0;
+            continue;
+        }
+        if (whole[k]) {
+            rect[0] = 0; rect[1] = t.tilesX - 1;
+            rect[2] = 0; rect[3] = t.tilesY - 1;
+            continue;
+        }
+        float x0 = (bounds[0][k] * 0.5f + 0.5f) * t.width, x1 = (bounds[1][k] * 0.5f + 0.5f) * t.width;
+        float y0 = (bounds[2][k] * 0.5f + 0.5f) * t.height, y1 = (bounds[3][k] * 0.5f + 0.5f) * t.height;
+        if (x1 < 0.0f || y1 < 0.0f || x0 >= t.width || y0 >= t.height) {
+            rect[0] = 1; rect[1] = 0;
+            continue;
+        }
+        // clamped before converting, up close they can be far off screen
+        rect[0] = (int)std::max(x0, 0.0f) / t.tileSize;
+        rect[1] = (int)std::min(x1, t.width - 1.0f) / t.tileSize;
+        rect[2] = (int)std::max(y0, 0.0f) / t.tileSize;
+        rect[3] = (int)std::min(y1, t.height - 1.0f) / t.tileSize;
+    }
+}
+
+// Bin the lights for a frame seen through view * model (the lights being in
+// model space) and proj, a perspective projection
+inline void light_tiles_cull(LightTiles& t, const glm::mat4& viewModel, const glm::mat4& proj)
+{
+    // the near plane's distance, from the projection's third column
+    float zNear = proj[3][2] / (proj[2][2] - 1.0f);
+    for (int i = 0; i < t.count; i += 4) {
+        light_tiles_bounds(t, i, viewModel, proj[0][0], proj[1][1], zNear);
+    }
+
+    // count, then hand out ranges, then fill them in
+    int tiles = t.tilesX * t.tilesY;
+    std::fill(t.cursor.begin(), t.cursor.end(), 0);
+    for (int i = 0; i < t.count; i++) {
+        const int* rect = &t.rects[4 * i];
+        for (int ty = rect[2]; rect[0] <= rect[1] && ty <= rect[3]; ty++) {
+            for (int tx = rect[0]; tx <= rect[1]; tx++) {
+                t.cursor[ty * t.tilesX + tx]++;
+            }
+        }
+    }
+    // past GL_MAX_TEXTURE_BUFFER_SIZE the lists are cut short
+    long first = 0;
+    for (int i = 0; i < tiles; i++) {
+        long count = t.cursor[i];
+        t.tiles[2 * i] = (GLint)std::min(first, (long)t.maxTexels);
+        t.tiles[2 * i + 1] = (GLint)std::max(std::min(count, t.maxTexels - first), 0L);
+        t.cursor[i] = t.tiles[2 * i];
+        first += count;
+    }
+    t.pairs = first;
+    t.truncated = first > t.maxTexels;
+    t.indices.resize(std::min(first, (long)t.maxTexels));
+    for (int i = 0; i < t.count; i++) {
+        const int* rect = &t.rects[4 * i];
+        for (int ty = rect[2]; rect[0] <= rect[1] && ty <= rect[3]; ty++) {
+            for (int tx = rect[0]; tx <= rect[1]; tx++) {
+                int tile = ty * t.tilesX + tx;
+                if (t.cursor[tile] < t.tiles[2 * tile] + t.tiles[2 * tile + 1])
+                    t.indices[t.cursor[tile]++] = i;
+            }
+        }
+    }
+}
+
+// The lights are packed for the upload in `arena`, which they only need
+// until glBufferData has copied them
+inline void light_tiles_upload(LightTiles& t, FrameArena& arena)
+{
+    FrameVector<float> lights(8 * t.count, 0.0f, FrameAllocator<float>(arena));
+    for (int i = 0; i < t.count; i++) {
+        float* l = &lights[8 * i];
+        l[0] = t.x[i]; l[1] = t.y[i]; l[2] = t.z[i]; l[3] = t.radius[i];
+        l[4] = t.color[i].x; l[5] = t.color[i].y; l[6] = t.color[i].z; l[7] = 0.0f;
+    }
+
+    // orphaned every frame, so the last frame's draws can keep theirs
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, t.buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, lights.size() * sizeof(float), lights.data(), GL_STREAM_DRAW);
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, t.buffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, t.tiles.size() * sizeof(GLint), t.tiles.data(), GL_STREAM_DRAW);
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, t.buffers[2]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max((size_t)1, t.indices.size()) * sizeof(GLint),
+                 t.indices.empty() ? NULL : t.indices.data(), GL_STREAM_DRAW);
+}
+
+// Bind Lights, LightTiles and LightIndices to units unit, unit + 1 and
+// unit + 2
+inline void light_tiles_bind(LightTiles& t, int unit)
+{
+    for (int i = 0; i < 3; i++) {
+        glstate_bind_texture(unit + i, GL_TEXTURE_BUFFER, t.textures[i]);
+    }
+}
+
+// Point a program's samplers at those units and give it the tiling. Leaves
+// the program in use.
+inline void light_tiles_bind_program(LightTiles& t, GLuint program, int unit)
+{
+    glstate_use_program(program);
+    glUniform1i(glGetUniformLocation(program, "Lights"), unit);
+    glUniform1i(glGetUniformLocation(program, "LightTiles"), unit + 1);
+    glUniform1i(glGetUniformLocation(program, "LightIndices"), unit + 2);
+    glUniform1i(glGetUniformLocation(program, "LightCount"), t.count);
+    glUniform1i(glGetUniformLocation(program, "LightTileSize"), t.tileSize);
+    glUniform1i(glGetUniformLocation(program, "LightTilesX"), t.tilesX);
+}
+
+// Lights per tile on average and at most, over the last cull
+inline void light_tiles_stats(const LightTiles& t, float& average, int& most)
+{
+    int tiles = t.tilesX * t.tilesY;
+    most = 0;
+    for (int i = 0; i < tiles; i++) {
+        most = std::max(most, (int)t.tiles[2 * i + 1]);
+    }
+    average = (float)t.pairs / tiles;
+}
+
+inline void light_tiles_destroy(LightTiles& t)
+{
+    glstate_delete_textures(3, t.textures);
+    glstate_delete_buffers(3, t.buffers);
+}
+
+#endif
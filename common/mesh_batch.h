@@ -0,0 +1,228 @@
+#ifndef MESH_BATCH_H
+#define MESH_BATCH_H
+
+// Many different meshes drawn with a single call.
+//
+// Every mesh is packed into one shared vertex buffer and one shared index
+// buffer, and remembered as a range of each. A frame is a list of draw
+// commands, one per mesh instance, in the layout glMultiDrawElementsIndirect
+// reads from a GL_DRAW_INDIRECT_BUFFER. Anything that differs per draw (where
+// it goes, its color, ...) is a row of floats in a per-draw buffer, read
+// through instanced vertex attributes: each command's baseInstance is its
+// own index, so with a divisor of 1 every draw sees its own row.
+//
+// Without multi-draw indirect the same commands are walked in a loop, one
+// draw each. If there's no base instance either, the per-draw attributes are
+// pointed at the right row before each draw instead.
+
+#include <vector>
+#include <cstring>
+
+#include "glstate.h"
+
+// A mesh's place in the shared buffers
+struct MeshRange {
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLint baseVertex;
+};
+
+// Laid out as GL expects in the indirect buffer
+struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct MeshBatchAttrib {
+    GLint location;
+    GLint size;
+    int offset;     // in floats
+};
+
+struct MeshBatch {
+    int vertexFloats;   // floats per vertex
+    int drawFloats;     // floats per draw
+
+    // filled by mesh_batch_add, uploaded by mesh_batch_upload
+    std::vector<float> vertices;
+    std::vector<GLuint> indices;
+    std::vector<MeshRange> meshes;
+
+    // this frame's draws, filled by mesh_batch_draw
+    std::vector<DrawCommand> commands;
+    std::vector<float> drawData;
+
+    // what's in the indirect buffer now
+    std::vector<DrawCommand> uploadedCommands;
+
+    std::vector<MeshBatchAttrib> drawAttribs;
+
+    bool multiDraw;
+    bool baseInstance;
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    GLuint drawBuffer;
+    GLuint indirectBuffer;
+};
+
+inline void mesh_batch_init(MeshBatch& b, int vertexFloats, int drawFloats)
+{
+    b.vertexFloats = vertexFloats;
+    b.drawFloats = drawFloats;
+    b.multiDraw = GLEW_ARB_multi_draw_indirect;
+    b.baseInstance = GLEW_ARB_base_instance;
+
+    glGenVertexArrays(1, &b.vao);
+    glGenBuffers(1, &b.vbo);
+    glGenBuffers(1, &b.ebo);
+    glGenBuffers(1, &b.drawBuffer);
+    glGenBuffers(1, &b.indirectBuffer);
+}
+
+// Add a mesh made of `vertexCount` vertices and `indexCount` indices (as
+// triangles), returning the number to draw it by
+inline int mesh_batch_add(MeshBatch& b, const float* vertices, int vertexCount,
+                          const GLuint* indices, int indexCount)
+{
+    MeshRange range;
+    range.firstIndex = b.indices.size();
+    range.indexCount = indexCount;
+    range.baseVertex = b.vertices.size() / b.vertexFloats;
+
+    b.vertices.insert(b.vertices.end(), vertices, vertices + vertexCount * b.vertexFloats);
+    b.indices.insert(b.indices.end(), indices, indices + indexCount);
+    b.meshes.push_back(range);
+    return b.meshes.size() - 1;
+}
+
+// Send the meshes to the GPU, once they've all been added
+inline void mesh_batch_upload(MeshBatch& b)
+{
+    glstate_bind_vertex_array(b.vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, b.vbo);
+    glBufferData(GL_ARRAY_BUFFER, b.vertices.size() * sizeof(float), b.vertices.data(), GL_STATIC_DRAW);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, b.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, b.indices.size() * sizeof(GLuint), b.indices.data(), GL_STATIC_DRAW);
+}
+
+// Per vertex attribute, read from the shared vertex buffer
+inline void mesh_batch_vertex_attrib(MeshBatch& b, GLint location, GLint size, int offset)
+{
+    if (location < 0)
+        return;
+    glstate_bind_vertex_array(b.vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, b.vbo);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, b.vertexFloats * sizeof(float),
+                          (void*)(offset * sizeof(float)));
+}
+
+// Per draw attribute, read from that draw's row of drawData
+inline void mesh_batch_draw_attrib(MeshBatch& b, GLint location, GLint size, int offset)
+{
+    if (location < 0)
+        return;
+    glstate_bind_vertex_array(b.vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, b.drawBuffer);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, b.drawFloats * sizeof(float),
+                          (void*)(offset * sizeof(float)));
+    glVertexAttribDivisor(location, 1);
+
+    MeshBatchAttrib attrib = { location, size, offset };
+    b.drawAttribs.push_back(attrib);
+}
+
+inline void mesh_batch_begin(MeshBatch& b)
+{
+    b.commands.clear();
+    b.drawData.clear();
+}
+
+// Queue one draw of `mesh`, returning where to write its drawFloats floats
+inline float* mesh_batch_draw(MeshBatch& b, int mesh)
+{
+    const MeshRange& range = b.meshes[mesh];
+    DrawCommand command;
+    command.count = range.indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = range.firstIndex;
+    command.baseVertex = range.baseVertex;
+    command.baseInstance = b.commands.size();
+    b.commands.push_back(command);
+
+    b.drawData.resize(b.drawData.size() + b.drawFloats);
+    return &b.drawData[b.drawData.size() - b.drawFloats];
+}
+
+// Point the per draw attributes at row `row` of the draw buffer, which has to
+// be bound
+inline void mesh_batch_point_draw_attribs(MeshBatch& b, int row)
+{
+    for (size_t a = 0; a < b.drawAttribs.size(); a++) {
+        const MeshBatchAttrib& attrib = b.drawAttribs[a];
+        glVertexAttribPointer(attrib.location, attrib.size, GL_FLOAT, GL_FALSE, b.drawFloats * sizeof(float),
+                              (void*)((row * b.drawFloats + attrib.offset) * sizeof(float)));
+    }
+}
+
+// Draw everything queued since mesh_batch_begin
+inline void mesh_batch_submit(MeshBatch& b)
+{
+    glstate_bind_vertex_array(b.vao);
+
+    // orphan the old contents rather than wait for the last frame's draws
+    glstate_bind_buffer(GL_ARRAY_BUFFER, b.drawBuffer);
+    glBufferData(GL_ARRAY_BUFFER, b.drawData.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, b.drawData.size() * sizeof(float), b.drawData.data());
+
+    if (b.multiDraw) {
+        glstate_bind_buffer(GL_DRAW_INDIRECT_BUFFER, b.indirectBuffer);
+
+        // the same meshes usually get drawn frame after frame, only their
+        // draw data changes, so the commands are only sent when they differ
+        if (b.commands.size() != b.uploadedCommands.size() ||
+            memcmp(b.commands.data(), b.uploadedCommands.data(), b.commands.size() * sizeof(DrawCommand)) != 0) {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, b.commands.size() * sizeof(DrawCommand),
+                         b.commands.data(), GL_DYNAMIC_DRAW);
+            b.uploadedCommands = b.commands;
+        }
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, b.commands.size(), 0);
+        return;
+    }
+
+    if (b.baseInstance) {
+        for (size_t i = 0; i < b.commands.size(); i++) {
+            const DrawCommand& c = b.commands[i];
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, c.count, GL_UNSIGNED_INT,
+                                                          (void*)(c.firstIndex * sizeof(GLuint)),
+                                                          1, c.baseVertex, c.baseInstance);
+        }
+        return;
+    }
+
+    // move the per draw attributes along to each row instead
+    for (size_t i = 0; i < b.commands.size(); i++) {
+        const DrawCommand& c = b.commands[i];
+        mesh_batch_point_draw_attribs(b, c.baseInstance);
+        glDrawElementsBaseVertex(GL_TRIANGLES, c.count, GL_UNSIGNED_INT,
+                                 (void*)(c.firstIndex * sizeof(GLuint)), c.baseVertex);
+    }
+
+    // and back, or anything drawing with a base instance later would read
+    // past the end
+    mesh_batch_point_draw_attribs(b, 0);
+}
+
+inline void mesh_batch_destroy(MeshBatch& b)
+{
+    glstate_delete_vertex_arrays(1, &b.vao);
+    GLuint buffers[] = { b.vbo, b.ebo, b.drawBuffer, b.indirectBuffer };
+    glstate_delete_buffers(4, buffers);
+}
+
+#endif
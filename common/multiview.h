@@ -0,0 +1,146 @@
+#ifndef MULTIVIEW_H
+#define MULTIVIEW_H
+
+// Several cameras in a single pass, for tiled output like a video wall.
+//
+// Each view has its own view-projection matrix and its own rectangle of the
+// framebuffer, laid out as a grid. Rather than drawing the whole scene once
+// per view, every draw is made with one instance per view: the vertex shader
+// takes its view from gl_InstanceID, transforms by that view's matrix, then
+// scales and offsets the clip space position into the view's rectangle and
+// clips it to the rectangle's edges through gl_ClipDistance. So the CPU
+// issues the same draws as for one view and each vertex is fetched once per
+// view, instead of everything being submitted N times.
+//
+// ARB_viewport_array would route each copy to its own viewport instead, but
+// gl_ViewportIndex can only be written from a geometry shader before 4.1,
+// and a geometry shader costs more than the offset; this only needs 3.2.
+//
+// Shaders declare
+//
+//     layout(std140) uniform Views {
+//         mat4 viewProjs[16];
+//         vec4 viewRects[16];
+//         int viewCount;
+//     };
+//
+// matching MultiViewUniforms below, and finish with
+//
+//     vec4 p = viewProjs[gl_InstanceID] * world;
+//     gl_ClipDistance[0] = p.w + p.x;
+//     gl_ClipDistance[1] = p.w - p.x;
+//     gl_ClipDistance[2] = p.w + p.y;
+//     gl_ClipDistance[3] = p.w - p.y;
+//     vec4 rect = viewRects[gl_InstanceID];
+//     gl_Position = vec4(p.xy * rect.xy + rect.zw * p.w, p.zw);
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+
+#define MULTIVIEW_MAX_VIEWS 16
+#define MULTIVIEW_BINDING 1
+
+// std140: mat4s and vec4s are 16 byte aligned, the lone int rounds the block
+// up to 16 bytes
+struct MultiViewUniforms {
+    glm::mat4 viewProjs[MULTIVIEW_MAX_VIEWS];
+    glm::vec4 viewRects[MULTIVIEW_MAX_VIEWS];   // xy scale, zw offset, in NDC
+    int viewCount;
+    int pad[3];
+};
+
+struct MultiView {
+    MultiViewUniforms data;
+    int count;
+    int columns;
+    int rows;
+    int width;          // of the whole framebuffer
+    int height;
+    GLuint ubo;
+};
+
+// Where view `i` lands in the framebuffer, in pixels. The first row is at
+// the top.
+inline void multiview_viewport(const MultiView& m, int i, int& x, int& y, int& width, int& height)
+{
+    int column = i % m.columns;
+    int row = i / m.columns;
+    width = m.width / m.columns;
+    height = m.height / m.rows;
+    x = column * width;
+    y = m.height - (row + 1) * height;
+}
+
+// Width over height of each view, for its projection
+inline float multiview_aspect(const MultiView& m)
+{
+    return (float)(m.width / m.columns) / (m.height / m.rows);
+}
+
+inline void multiview_init(MultiView& m, int count, int width, int height)
+{
+    m.data = MultiViewUniforms();
+    m.count = count;
+    m.columns = (int)ceilf(sqrtf((float)count));
+    m.rows = (count + m.columns - 1) / m.columns;
+    m.width = width;
+    m.height = height;
+    m.data.viewCount = count;
+
+    // the same rectangles the viewports would have, in NDC
+    for (int i = 0; i < count; i++) {
+        int x, y, w, h;
+        multiview_viewport(m, i, x, y, w, h);
+        m.data.viewRects[i] = glm::vec4((float)w / width, (float)h / height,
+                                        (2.0f * x + w) / width - 1.0f, (2.0f * y + h) / height - 1.0f);
+    }
+
+    glGenBuffers(1, &m.ubo);
+    glstate_bind_buffer(GL_UNIFORM_BUFFER, m.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(MultiViewUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, MULTIVIEW_BINDING, m.ubo);
+}
+
+// Point `program`'s Views block at the shared binding
+inline void multiview_bind_program(GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, "Views");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, index, MULTIVIEW_BINDING);
+    }
+}
+
+inline void multiview_set_camera(MultiView& m, int i, const glm::mat4& view, const glm::mat4& proj)
+{
+    m.data.viewProjs[i] = proj * view;
+}
+
+// Send the cameras, once per frame or whenever they change
+inline void multiview_update(MultiView& m)
+{
+    glstate_bind_buffer(GL_UNIFORM_BUFFER, m.ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MultiViewUniforms), &m.data);
+}
+
+// The clip planes that keep each view inside its rectangle, on for anything
+// drawn with one instance per view
+inline void multiview_begin()
+{
+    for (int i = 0; i < 4; i++)
+        glstate_enable(GL_CLIP_DISTANCE0 + i);
+}
+
+inline void multiview_end()
+{
+    for (int i = 0; i < 4; i++)
+        glstate_disable(GL_CLIP_DISTANCE0 + i);
+}
+
+inline void multiview_destroy(MultiView& m)
+{
+    glstate_delete_buffers(1, &m.ubo);
+}
+
+#endif
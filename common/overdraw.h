@@ -0,0 +1,177 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+// How many times each pixel gets shaded, shown as a heatmap.
+//
+// Between overdraw_begin() and overdraw_end() drawing goes into a
+// framebuffer of overdraw's own, with the stencil test on and set to count
+// up every fragment that passes the depth test. Afterwards the counts are
+// read back and the window shows them, black for none through blue, green,
+// yellow and red to white for OVERDRAW_LEVELS or more. The framebuffer has a
+// single sample, so with multisampling the counts are per pixel rather than
+// per sample.
+//
+// overdraw_end() waits for the frame to finish, so it also times the draws
+// in between on their own. Once a second overdraw_report() prints the
+// fragments per covered pixel, the most any pixel got, and that time.
+
+#include <cstdio>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "glstate.h"
+
+// counts at and past the last color are all shown as it
+#define OVERDRAW_LEVELS 6
+
+// the texture unit the heatmap is uploaded through, out of everyone's way
+#define OVERDRAW_UNIT 15
+
+static const unsigned char overdraw_colors[OVERDRAW_LEVELS + 1][3] = {
+    {   0,   0,   0 },
+    {  20,  40, 160 },
+    {  20, 160,  60 },
+    { 220, 220,  30 },
+    { 240, 130,  20 },
+    { 220,  30,  30 },
+    { 255, 255, 255 },
+};
+
+struct Overdraw {
+    int width;
+    int height;
+    GLuint fbo;
+    GLuint colorRbo;
+    GLuint depthRbo;
+    GLuint heatFbo;
+    GLuint heatTexture;
+    std::vector<unsigned char> counts;
+    std::vector<unsigned char> heat;
+    std::chrono::steady_clock::time_point drawStart;
+
+    // toward the next report
+    double fragments;
+    double covered;
+    int most;
+    int frames;
+    float drawMs;
+    std::chrono::steady_clock::time_point lastReport;
+};
+
+inline void overdraw_init(Overdraw& o, int width, int height)
+{
+    o.width = width;
+    o.height = height;
+    o.counts.resize(width * height);
+    o.heat.resize(4 * width * height);
+    o.fragments = o.covered = 0.0;
+    o.most = 0;
+    o.frames = 0;
+    o.drawMs = 0.0f;
+    o.lastReport = std::chrono::steady_clock::now();
+
+    glGenRenderbuffers(1, &o.colorRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, o.colorRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &o.depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, o.depthRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glGenFramebuffers(1, &o.fbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, o.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, o.colorRbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, o.depthRbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("overdraw framebuffer incomplete!\n");
+        exit(1);
+    }
+
+    // the heatmap, blitted into the window
+    glGenTextures(1, &o.heatTexture);
+    glstate_bind_texture(OVERDRAW_UNIT, GL_TEXTURE_2D, o.heatTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenFramebuffers(1, &o.heatFbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, o.heatFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, o.heatTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("overdraw heatmap framebuffer incomplete!\n");
+        exit(1);
+    }
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Start counting. Binds and clears overdraw's framebuffer.
+inline void overdraw_begin(Overdraw& o)
+{
+    glFinish();
+    o.drawStart = std::chrono::steady_clock::now();
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, o.fbo);
+    glstate_viewport(0, 0, o.width, o.height);
+    glstate_stencil_mask(0xff);
+    glClearStencil(0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glstate_enable(GL_STENCIL_TEST);
+    glstate_stencil_func(GL_ALWAYS, 0, 0xff);
+    glstate_stencil_op(GL_KEEP, GL_KEEP, GL_INCR);
+}
+
+// Stop counting, and show the counts in the window
+inline void overdraw_end(Overdraw& o)
+{
+    glFinish();
+    o.drawMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - o.drawStart).count();
+    glstate_disable(GL_STENCIL_TEST);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, o.width, o.height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, o.counts.data());
+    long fragments = 0, covered = 0;
+    for (size_t i = 0; i < o.counts.size(); i++) {
+        int count = o.counts[i];
+        fragments += count;
+        covered += count > 0;
+        o.most = std::max(o.most, count);
+        const unsigned char* color = overdraw_colors[std::min(count, OVERDRAW_LEVELS)];
+        unsigned char* h = &o.heat[4 * i];
+        h[0] = color[0]; h[1] = color[1]; h[2] = color[2]; h[3] = 255;
+    }
+    o.fragments += fragments;
+    o.covered += covered;
+    o.frames++;
+
+    glstate_bind_texture(OVERDRAW_UNIT, GL_TEXTURE_2D, o.heatTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, o.width, o.height, GL_RGBA, GL_UNSIGNED_BYTE, o.heat.data());
+    glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, o.heatFbo);
+    glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, o.width, o.height, 0, 0, o.width, o.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Once a second, `label` saying how the frames were drawn
+inline void overdraw_report(Overdraw& o, const char* label)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - o.lastReport).count() < 1.0 || o.frames == 0)
+        return;
+
+    printf("overdraw (%s): %.2f fragments per covered pixel, at most %d, %.1f%% of the window covered, "
+           "drawing %.2f ms\n", label, o.covered > 0 ? o.fragments / o.covered : 0.0, o.most,
+           100.0 * o.covered / ((double)o.frames * o.width * o.height), o.drawMs / o.frames);
+    o.fragments = o.covered = 0.0;
+    o.most = 0;
+    o.frames = 0;
+    o.drawMs = 0.0f;
+    o.lastReport = now;
+}
+
+inline void overdraw_destroy(Overdraw& o)
+{
+    glstate_delete_framebuffers(1, &o.fbo);
+    glstate_delete_framebuffers(1, &o.heatFbo);
+    GLuint rbos[] = { o.colorRbo, o.depthRbo };
+    glDeleteRenderbuffers(2, rbos);
+    glstate_delete_textures(1, &o.heatTexture);
+}
+
+#endif
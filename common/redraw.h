@@ -0,0 +1,292 @@
+#ifndef REDRAW_H
+#define REDRAW_H
+
+// Drawing only when something has changed.
+//
+// With --on-demand a loop draws a frame only when the last one has been
+// invalidated: by the animation asking for its next frame with
+// redraw_animate(), by input, or by the window being exposed, resized or
+// focused. Until then redraw_wait() blocks in glfwWaitEventsTimeout(), for
+// the next event or until the animation's next frame is due, so a scene that
+// isn't moving costs nothing once it's on screen.
+//
+// Invalidating can be partial. redraw_damage() marks a rectangle of the
+// window, and with --damage the frame is drawn with the scissor test cut
+// down to the union of what's been marked since the last one. The back
+// buffer's contents aren't kept from one swap to the next, so the frame is
+// drawn into a framebuffer of redraw's own, which keeps everything outside
+// the scissor, and copied into the window whole.
+//
+// Once a second, and at the end, redraw_report() prints the frames drawn,
+// the wakeups that didn't need one, and the CPU time the process used per
+// second of wall time.
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+
+#include "glstate.h"
+#include "trace.h"
+
+// longest redraw_wait() blocks for, so the reports keep coming
+#define REDRAW_IDLE_TIMEOUT 1.0
+
+struct Redraw {
+    GLFWwindow* window;
+    int width;
+    int height;
+    bool onDemand;
+    bool damageTracking;
+
+    // what needs drawing: everything, or the box [x0, x1) x [y0, y1)
+    bool full;
+    bool damaged;
+    int x0, y0, x1, y1;
+    double nextFrame;       // on glfwGetTime()'s clock, < 0 for none asked
+
+    // with damage tracking, where frames are drawn
+    GLuint fbo;
+    GLuint colorRbo;
+    GLuint depthRbo;
+
+    // toward the next report, and since the start
+    long frames;
+    long wakeups;
+    long totalFrames;
+    long totalWakeups;
+    double cpuSeconds;
+    std::chrono::steady_clock::time_point lastReport;
+    std::chrono::steady_clock::time_point start;
+    double startCpu;
+};
+
+#define REDRAW_USAGE "[--on-demand [--damage]]"
+
+// For the argument loops: takes --on-demand or --damage at argv[i], false
+// if it's neither
+inline bool redraw_arg(char** argv, int i, bool& onDemand, bool& damage)
+{
+    if (strcmp(argv[i], "--on-demand") == 0) {
+        onDemand = true;
+    } else if (strcmp(argv[i], "--damage") == 0) {
+        onDemand = true;
+        damage = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline double redraw_cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+inline void redraw_invalidate(Redraw& r)
+{
+    r.full = true;
+}
+
+// Mark a rectangle of the window, in pixels from the bottom left, as needing
+// to be drawn again
+inline void redraw_damage(Redraw& r, int x, int y, int width, int height)
+{
+    int x0 = std::max(x, 0), y0 = std::max(y, 0);
+    int x1 = std::min(x + width, r.width), y1 = std::min(y + height, r.height);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    if (!r.damaged) {
+        r.x0 = x0; r.y0 = y0; r.x1 = x1; r.y1 = y1;
+        r.damaged = true;
+    } else {
+        r.x0 = std::min(r.x0, x0); r.y0 = std::min(r.y0, y0);
+        r.x1 = std::max(r.x1, x1); r.y1 = std::max(r.y1, y1);
+    }
+}
+
+// The scene is moving, and wants drawing again `seconds` from now (0 for as
+// soon as possible). Asked for again every frame it keeps moving.
+inline void redraw_animate(Redraw& r, double seconds)
+{
+    double due = glfwGetTime() + seconds;
+    r.nextFrame = r.nextFrame < 0 ? due : std::min(r.nextFrame, due);
+}
+
+// Anything the window tells us about means the whole frame
+inline void redraw_window_event(GLFWwindow* window)
+{
+    redraw_invalidate(*(Redraw*)glfwGetWindowUserPointer(window));
+}
+
+inline void redraw_size_event(GLFWwindow* window, int, int)
+{
+    redraw_window_event(window);
+}
+
+inline void redraw_focus_event(GLFWwindow* window, int)
+{
+    redraw_window_event(window);
+}
+
+inline void redraw_key_event(GLFWwindow* window, int, int, int, int)
+{
+    redraw_window_event(window);
+}
+
+inline void redraw_button_event(GLFWwindow* window, int, int, int)
+{
+    redraw_window_event(window);
+}
+
+inline void redraw_cursor_event(GLFWwindow* window, double, double)
+{
+    redraw_window_event(window);
+}
+
+inline void redraw_init(Redraw& r, GLFWwindow* window, int width, int height, bool onDemand, bool damageTracking)
+{
+    r.window = window;
+    r.width = width;
+    r.height = height;
+    r.onDemand = onDemand;
+    r.damageTracking = damageTracking;
+    r.full = true;
+    r.damaged = false;
+    r.nextFrame = -1.0;
+    r.frames = r.wakeups = 0;
+    r.totalFrames = r.totalWakeups = 0;
+    r.start = r.lastReport = std::chrono::steady_clock::now();
+    r.startCpu = r.cpuSeconds = redraw_cpu_seconds();
+    r.fbo = r.colorRbo = r.depthRbo = 0;
+
+    if (!onDemand)
+        return;
+
+    glfwSetWindowUserPointer(window, &r);
+    glfwSetWindowRefreshCallback(window, redraw_window_event);
+    glfwSetFramebufferSizeCallback(window, redraw_size_event);
+    glfwSetWindowFocusCallback(window, redraw_focus_event);
+    glfwSetKeyCallback(window, redraw_key_event);
+    glfwSetMouseButtonCallback(window, redraw_button_event);
+    glfwSetCursorPosCallback(window, redraw_cursor_event);
+
+    if (damageTracking) {
+        glGenRenderbuffers(1, &r.colorRbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, r.colorRbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &r.depthRbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, r.depthRbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glGenFramebuffers(1, &r.fbo);
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, r.fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, r.colorRbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, r.depthRbo);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("redraw framebuffer incomplete!\n");
+            exit(1);
+        }
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    }
+}
+
+inline void redraw_report(Redraw& r, bool total)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - (total ? r.start : r.lastReport)).count();
+    if (!total && seconds < 1.0)
+        return;
+
+    double cpu = redraw_cpu_seconds();
+    double used = cpu - (total ? r.startCpu : r.cpuSeconds);
+    long frames = total ? r.totalFrames : r.frames;
+    long wakeups = total ? r.totalWakeups : r.wakeups;
+    printf("%s%5.1f frames drawn per second (%ld in %.1f s), %ld idle wakeups, CPU %5.1f%%\n",
+           total ? "overall: " : "", frames / seconds, frames, seconds, wakeups, 100.0 * used / seconds);
+    if (!total) {
+        r.lastReport = now;
+        r.cpuSeconds = cpu;
+        r.frames = r.wakeups = 0;
+    }
+}
+
+// Block until there's a frame to draw. False if the window is closing
+// instead. Always true when not drawing on demand.
+inline bool redraw_wait(Redraw& r)
+{
+    if (!r.onDemand)
+        return true;
+
+    while (!glfwWindowShouldClose(r.window)) {
+        double now = glfwGetTime();
+        if (r.nextFrame >= 0 && now >= r.nextFrame) {
+            r.nextFrame = -1.0;
+            // the animation marks what it moves itself, when tracking damage
+            if (!r.damageTracking)
+                r.full = true;
+            return true;
+        }
+        if (r.full || r.damaged)
+            return true;
+
+        redraw_report(r, false);
+        double timeout = REDRAW_IDLE_TIMEOUT;
+        if (r.nextFrame >= 0)
+            timeout = std::min(timeout, r.nextFrame - now);
+        TRACE_BEGIN("glfwWaitEventsTimeout");
+        glfwWaitEventsTimeout(timeout);
+        TRACE_END();
+        if (!r.full && !r.damaged && (r.nextFrame < 0 || glfwGetTime() < r.nextFrame)) {
+            r.wakeups++;
+            r.totalWakeups++;
+        }
+    }
+    return false;
+}
+
+// Start drawing the frame, into redraw's framebuffer and cut down to the
+// damage if tracking it
+inline void redraw_begin(Redraw& r)
+{
+    if (!r.damageTracking)
+        return;
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, r.fbo);
+    if (!r.full && r.damaged) {
+        glstate_enable(GL_SCISSOR_TEST);
+        glstate_scissor(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+    }
+}
+
+// Done drawing, before the swap
+inline void redraw_end(Redraw& r)
+{
+    if (r.damageTracking) {
+        glstate_disable(GL_SCISSOR_TEST);
+        glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, r.fbo);
+        glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, r.width, r.height, 0, 0, r.width, r.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    }
+    r.full = false;
+    r.damaged = false;
+    r.frames++;
+    r.totalFrames++;
+    if (r.onDemand)
+        redraw_report(r, false);
+}
+
+inline void redraw_destroy(Redraw& r)
+{
+    if (r.onDemand)
+        redraw_report(r, true);
+    if (r.fbo) {
+        glstate_delete_framebuffers(1, &r.fbo);
+        GLuint rbos[] = { r.colorRbo, r.depthRbo };
+        glDeleteRenderbuffers(2, rbos);
+    }
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+// Rendering a frame range offline as fast as possible, across several GL
+// contexts at once.
+//
+// Each of K workers is a thread with a hidden window's context of its own
+// and its own multisampled framebuffer. Frame i is drawn by worker i % K, at
+// time i / fps, so what a frame shows only depends on its index and never on
+// how long anything took. The finished pixels go into a shared queue that
+// the calling thread empties strictly in frame order, checksumming each
+// frame and, given a directory, writing it out the same way capture.h does.
+// Workers running too far ahead of the oldest frame not yet written wait
+// for it, which bounds the queue.
+//
+// A Scene is anything with
+//
+//     void init();                         // with the worker's context current
+//     void advance(int frame, float time); // every frame, in order
+//     void draw(int frame, float time);    // only the worker's own frames
+//     void destroy();
+//
+// Every worker gets a copy of the scene it was given and calls advance() for
+// every frame, drawn by it or not, so state carried from frame to frame (a
+// simulation, say) is the same in every worker. Anything random has to come
+// from the frame index or a seed of the scene's own, not from rand(), for
+// the output not to depend on K.
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "glstate.h"
+#include "capture.h"
+#include "trace.h"
+
+// frames each worker may have finished but not yet written
+#define RENDER_FARM_AHEAD 4
+
+struct RenderFarm {
+    int width;
+    int height;
+    int samples;
+    int frames;
+    float fps;
+
+    // where and how frames are written, only the file settings are used.
+    // Nothing is written without a directory.
+    Capture output;
+    bool write;
+
+    // FNV-1a of each frame's pixels
+    std::vector<uint64_t> checksums;
+    double seconds;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<CaptureFrame*> done;    // a window of frames from `next` on
+    std::vector<CaptureFrame*> spare;
+    int next;                           // next frame to write
+    int window;
+};
+
+// One worker's framebuffers: multisampled to draw into, plain to read from
+struct RenderFarmTarget {
+    GLuint fbo;
+    GLuint colorRbo;
+    GLuint depthRbo;
+    GLuint resolveFbo;
+    GLuint resolveRbo;
+};
+
+inline void render_farm_init(RenderFarm& f, int width, int height, int samples, int frames, float fps,
+                             const char* dir, bool png)
+{
+    f.width = width;
+    f.height = height;
+    f.samples = samples;
+    f.frames = frames;
+    f.fps = fps;
+    f.output.width = width;
+    f.output.height = height;
+    f.output.dir = dir ? dir : "";
+    f.output.png = png;
+    f.write = dir != NULL;
+    f.seconds = 0.0;
+}
+
+inline uint64_t render_farm_checksum(const std::vector<unsigned char>& pixels)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        h ^= pixels[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+inline void render_farm_target_init(RenderFarmTarget& t, int width, int height, int samples)
+{
+    glGenRenderbuffers(1, &t.colorRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, t.colorRbo);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &t.depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, t.depthRbo);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+    glGenFramebuffers(1, &t.fbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, t.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, t.colorRbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, t.depthRbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("render farm framebuffer incomplete!\n");
+        exit(1);
+    }
+
+    glGenRenderbuffers(1, &t.resolveRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, t.resolveRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &t.resolveFbo);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, t.resolveFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, t.resolveRbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("render farm resolve framebuffer incomplete!\n");
+        exit(1);
+    }
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+inline void render_farm_target_destroy(RenderFarmTarget& t)
+{
+    GLuint fbos[] = { t.fbo, t.resolveFbo };
+    glstate_delete_framebuffers(2, fbos);
+    GLuint rbos[] = { t.colorRbo, t.depthRbo, t.resolveRbo };
+    glDeleteRenderbuffers(3, rbos);
+}
+
+template <typename Scene>
+void render_farm_worker(RenderFarm* f, GLFWwindow* context, Scene scene, int worker, int workers)
+{
+    TRACE_THREAD("render farm worker");
+    glfwMakeContextCurrent(context);
+    glstate_invalidate();
+
+    RenderFarmTarget target;
+    render_farm_target_init(target, f->width, f->height, f->samples);
+    scene.init();
+
+    for (int frame = 0; frame < f->frames; frame++) {
+        float time = frame / f->fps;
+        scene.advance(frame, time);
+        if (frame % workers != worker)
+            continue;
+
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, target.fbo);
+        glstate_viewport(0, 0, f->width, f->height);
+        TRACE_BEGIN("draw");
+        scene.draw(frame, time);
+        TRACE_END();
+
+        glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+        glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, target.resolveFbo);
+        glBlitFramebuffer(0, 0, f->width, f->height, 0, 0, f->width, f->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, target.resolveFbo);
+
+        // wait for room in the queue, then read straight into a spare frame
+        CaptureFrame* out;
+        {
+            std::unique_lock<std::mutex> guard(f->lock);
+            f->wake.wait(guard, [f, frame] { return frame < f->next + f->window; });
+            out = f->spare.back();
+            f->spare.pop_back();
+        }
+        TRACE_BEGIN("glReadPixels");
+        out->index = frame;
+        glReadPixels(0, 0, f->width, f->height, GL_RGBA, GL_UNSIGNED_BYTE, out->pixels.data());
+        TRACE_END();
+        {
+            std::lock_guard<std::mutex> guard(f->lock);
+            f->done[frame % f->window] = out;
+        }
+        f->wake.notify_all();
+    }
+
+    scene.destroy();
+    render_farm_target_destroy(target);
+    glfwMakeContextCurrent(NULL);
+}
+
+// Render every frame with `workers` contexts, writing and checksumming them
+// in order on the calling thread, which has to be the main one since that's
+// where GLFW makes windows. GLFW_VISIBLE is left hinted off, the other hints
+// (the context version in particular) are whatever the caller set.
+template <typename Scene>
+void render_farm_run(RenderFarm& f, const Scene& scene, int workers)
+{
+    TRACE_SCOPE("render_farm_run");
+    GLFWwindow* previous = glfwGetCurrentContext();
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    std::vector<GLFWwindow*> contexts(workers);
+    for (int i = 0; i < workers; i++) {
+        contexts[i] = glfwCreateWindow(64, 64, "render farm", nullptr, nullptr);
+        if (!contexts[i]) {
+            printf("couldn't create a context for render farm worker %d\n", i);
+            exit(1);
+        }
+    }
+
+    f.window = RENDER_FARM_AHEAD * workers;
+    f.done.assign(f.window, NULL);
+    f.next = 0;
+    f.checksums.assign(f.frames, 0);
+    // a frame for every slot in the window and one being read by each worker
+    std::vector<CaptureFrame> frames(f.window + workers);
+    f.spare.clear();
+    for (size_t i = 0; i < frames.size(); i++) {
+        frames[i].pixels.resize(4 * f.width * f.height);
+        f.spare.push_back(&frames[i]);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+        threads.push_back(std::thread(render_farm_worker<Scene>, &f, contexts[i], scene, i, workers));
+
+    std::vector<unsigned char> rows, deflated;
+    for (int frame = 0; frame < f.frames; frame++) {
+        CaptureFrame* out;
+        {
+            std::unique_lock<std::mutex> guard(f.lock);
+            f.wake.wait(guard, [&f, frame] { return f.done[frame % f.window] != NULL; });
+            out = f.done[frame % f.window];
+        }
+
+        f.checksums[frame] = render_farm_checksum(out->pixels);
+        if (f.write)
+            capture_write(f.output, *out, rows, deflated);
+
+        {
+            std::lock_guard<std::mutex> guard(f.lock);
+            f.done[frame % f.window] = NULL;
+            f.spare.push_back(out);
+            f.next = frame + 1;
+        }
+        f.wake.notify_all();
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    f.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+    f.spare.clear();
+
+    for (int i = 0; i < workers; i++)
+        glfwDestroyWindow(contexts[i]);
+    glfwMakeContextCurrent(previous);
+}
+
+// Render the same frames on 1, 2, 4... workers up to maxWorkers without
+// writing them, checking every run's frames against one worker's
+template <typename Scene>
+void render_farm_bench(const Scene& scene, int width, int height, int samples, int frames, float fps, int maxWorkers)
+{
+    std::vector<uint64_t> reference;
+    double referenceSeconds = 0.0;
+    for (int workers = 1; workers <= maxWorkers; workers *= 2) {
+        RenderFarm farm;
+        render_farm_init(farm, width, height, samples, frames, fps, NULL, false);
+        render_farm_run(farm, scene, workers);
+        if (workers == 1) {
+            reference = farm.checksums;
+            referenceSeconds = farm.seconds;
+        }
+
+        int differing = -1;
+        for (int i = 0; i < frames && differing < 0; i++) {
+            if (farm.checksums[i] != reference[i])
+                differing = i;
+        }
+        printf("%d workers: %6.1f frames per second (%.2fx one worker), ", workers, frames / farm.seconds,
+               referenceSeconds / farm.seconds);
+        if (differing < 0)
+            printf("identical to one worker\n");
+        else
+            printf("frame %d differs from one worker!\n", differing);
+    }
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+// A flat scene store: a hierarchy of transforms kept in plain arrays.
+//
+// Nodes are indices. Each has a parent (-1 for a root), a local transform
+// and a world transform, every one of them in its own contiguous array, and
+// the nodes are stored depth first, so a node's subtree is the nodes right
+// after it up to `end`. Changing a local transform only marks the node
+// dirty. scene_update() then walks the dirty nodes in order and recomputes
+// each one's subtree as a single run through the arrays, parents always
+// ahead of their children, and skips the rest of the scene entirely. The
+// cost goes with how much moved rather than with the size of the scene.
+//
+// Draw code reads the world transforms straight out of scene_world().
+//
+// Keeping the order depth first means a node can only be added under a
+// parent whose subtree is the last one in the store, which is how a
+// hierarchy gets built anyway: a node, then its children, then the next one.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct SceneStore {
+    std::vector<int> parent;
+    std::vector<int> end;           // one past the last node in the subtree
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+
+    // nodes changed since the last update, once each
+    std::vector<int> dirty;
+    std::vector<unsigned char> isDirty;
+};
+
+inline void scene_init(SceneStore& s, int reserve)
+{
+    s.parent.clear();
+    s.end.clear();
+    s.local.clear();
+    s.world.clear();
+    s.dirty.clear();
+    s.isDirty.clear();
+    s.parent.reserve(reserve);
+    s.end.reserve(reserve);
+    s.local.reserve(reserve);
+    s.world.reserve(reserve);
+    s.dirty.reserve(reserve);
+    s.isDirty.reserve(reserve);
+}
+
+inline int scene_size(const SceneStore& s)
+{
+    return (int)s.parent.size();
+}
+
+inline void scene_mark(SceneStore& s, int node)
+{
+    if (!s.isDirty[node]) {
+        s.isDirty[node] = 1;
+        s.dirty.push_back(node);
+    }
+}
+
+// Add a node under `parent` (-1 for a new root) and return it
+inline int scene_add(SceneStore& s, int parent, const glm::mat4& local)
+{
+    int node = scene_size(s);
+    if (parent >= node || (parent >= 0 && s.end[parent] != node)) {
+        printf("scene nodes have to be added depth first, %d can't go under %d\n", node, parent);
+        exit(1);
+    }
+    for (int p = parent; p >= 0; p = s.parent[p]) {
+        s.end[p]++;
+    }
+    s.parent.push_back(parent);
+    s.end.push_back(node + 1);
+    s.local.push_back(local);
+    s.world.push_back(local);
+    s.isDirty.push_back(0);
+    scene_mark(s, node);
+    return node;
+}
+
+inline void scene_set_local(SceneStore& s, int node, const glm::mat4& local)
+{
+    s.local[node] = local;
+    scene_mark(s, node);
+}
+
+inline const glm::mat4& scene_world(const SceneStore& s, int node)
+{
+    return s.world[node];
+}
+
+// out = a * b, a column of the result at a time, four floats wide
+inline void scene_multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef __SSE2__
+    const float* pa = glm::value_ptr(a);
+    const float* pb = glm::value_ptr(b);
+    float* po = glm::value_ptr(out);
+    __m128 a0 = _mm_loadu_ps(pa);
+    __m128 a1 = _mm_loadu_ps(pa + 4);
+    __m128 a2 = _mm_loadu_ps(pa + 8);
+    __m128 a3 = _mm_loadu_ps(pa + 12);
+    for (int c = 0; c < 4; c++) {
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(pb[4*c]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(pb[4*c + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(pb[4*c + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(pb[4*c + 3])));
+        _mm_storeu_ps(po + 4*c, r);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+// Bring the world transforms of everything under a dirty node up to date.
+// Returns how many nodes were recomputed.
+inline int scene_update(SceneStore& s)
+{
+    if (s.dirty.empty())
+        return 0;
+
+    // in order, so a dirty node inside a subtree that was just recomputed is
+    // already done
+    std::sort(s.dirty.begin(), s.dirty.end());
+    const int* parent = s.parent.data();
+    const glm::mat4* local = s.local.data();
+    glm::mat4* world = s.world.data();
+    int done = 0;
+    int recomputed = 0;
+    for (size_t n = 0; n < s.dirty.size(); n++) {
+        int node = s.dirty[n];
+        s.isDirty[node] = 0;
+        if (node < done)
+            continue;
+
+        int end = s.end[node];
+        for (int i = node; i < end; i++) {
+            if (parent[i] < 0)
+                world[i] = local[i];
+            else
+                scene_multiply(world[parent[i]], local[i], world[i]);
+        }
+        recomputed += end - node;
+        done = end;
+    }
+    s.dirty.clear();
+    return recomputed;
+}
+
+#endif
@@ -0,0 +1,392 @@
+#ifndef SHADER_COMPILE_H
+#define SHADER_COMPILE_H
+
+// Programs compiled at startup without waiting for each one in turn.
+//
+// shader_compile_submit() hands over a program's sources and returns at
+// once; shader_compile_program() gives back the linked program, and is the
+// only place that waits for it or asks whether it compiled. Submitting every
+// program startup needs first and fetching each where it's first used lets
+// the compiles overlap each other and the rest of startup.
+//
+// How they run depends on the mode:
+//
+//   SHADER_COMPILE_DRIVER    the GL calls are all made at submit, on this
+//                            thread, and nothing asks for a status until
+//                            the program's fetched. With
+//                            KHR_parallel_shader_compile (or the ARB one)
+//                            the driver compiles on threads of its own in
+//                            the meantime. Without it, it's as fast as the
+//                            driver's own deferral makes it.
+//   SHADER_COMPILE_WORKERS   worker threads, each with a hidden window whose
+//                            context shares objects with the main one, make
+//                            the GL calls and glFinish() before handing the
+//                            program back
+//   SHADER_COMPILE_BLOCKING  compiled, linked and checked at submit, one
+//                            after another, as everything used to be
+//
+// Whichever it is, a program that doesn't compile or link prints its log and
+// exits when it's fetched.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "glstate.h"
+#include "trace.h"
+
+// most worker contexts made when the count is left to us
+#define SHADER_COMPILE_MAX_WORKERS 4
+
+enum ShaderCompileMode {
+    SHADER_COMPILE_DRIVER,
+    SHADER_COMPILE_WORKERS,
+    SHADER_COMPILE_BLOCKING
+};
+
+static const char* shader_compile_mode_names[] = { "driver", "workers", "blocking" };
+
+struct ShaderJob {
+    std::string name;
+    std::string vertexSource;
+    std::string fragmentSource;
+    std::vector<std::string> attributes;
+
+    GLuint vertexShader;
+    GLuint fragmentShader;
+    GLuint program;
+    bool built;         // the GL calls have all been made
+    bool checked;       // and their status asked for
+};
+
+struct ShaderCompiler {
+    ShaderCompileMode mode;
+    bool parallelExtension;
+    std::deque<ShaderJob> jobs;     // never moved once submitted
+
+    // with workers
+    std::vector<GLFWwindow*> contexts;
+    std::vector<std::thread> workers;
+    std::deque<ShaderJob*> queue;
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable built;
+    bool stopping;
+
+    std::chrono::steady_clock::time_point start;
+    double blocked;     // seconds fetches spent waiting
+};
+
+// For the argument loops: takes --serial-shaders or --shader-workers N at
+// argv[i], false if it's neither. workers is -1 to pick the mode by what's
+// there, 0 for blocking.
+inline bool shader_compile_arg(int argc, char** argv, int& i, int& workers)
+{
+    if (strcmp(argv[i], "--serial-shaders") == 0) {
+        workers = 0;
+    } else if (strcmp(argv[i], "--shader-workers") == 0 && i + 1 < argc) {
+        workers = std::max(atoi(argv[++i]), 1);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#define SHADER_COMPILE_USAGE "[--serial-shaders | --shader-workers N]"
+
+inline std::string shader_compile_read(const char* filename)
+{
+    std::ifstream fs(filename);
+    if (!fs) {
+        printf("couldn't read shader %s\n", filename);
+        exit(1);
+    }
+    std::stringstream ss;
+    ss << fs.rdbuf();
+    return ss.str();
+}
+
+// Create, compile and link, asking nothing
+inline void shader_compile_build(ShaderJob& job)
+{
+    const char* src = job.vertexSource.c_str();
+    job.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(job.vertexShader, 1, &src, NULL);
+    glCompileShader(job.vertexShader);
+
+    src = job.fragmentSource.c_str();
+    job.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(job.fragmentShader, 1, &src, NULL);
+    glCompileShader(job.fragmentShader);
+
+    job.program = glCreateProgram();
+    glAttachShader(job.program, job.vertexShader);
+    glAttachShader(job.program, job.fragmentShader);
+    for (size_t i = 0; i < job.attributes.size(); i++) {
+        glBindAttribLocation(job.program, i, job.attributes[i].c_str());
+    }
+    glBindFragDataLocation(job.program, 0, "outColor");
+    glLinkProgram(job.program);
+}
+
+// Whether it all worked, exiting with the log if not
+inline void shader_compile_check(ShaderJob& job)
+{
+    GLuint shaders[] = { job.vertexShader, job.fragmentShader };
+    const char* kinds[] = { "vertex", "fragment" };
+    for (int i = 0; i < 2; i++) {
+        GLint status;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &status);
+        if (status != GL_TRUE) {
+            char buffer[512];
+            glGetShaderInfoLog(shaders[i], 512, NULL, buffer);
+            printf("%s shader of %s compilation failed!\n\n%s\n", kinds[i], job.name.c_str(), buffer);
+            exit(1);
+        }
+    }
+
+    GLint status;
+    glGetProgramiv(job.program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char buffer[512];
+        glGetProgramInfoLog(job.program, 512, NULL, buffer);
+        printf("shader program %s link failed!\n\n%s\n", job.name.c_str(), buffer);
+        exit(1);
+    }
+
+    // the program keeps them for as long as it needs them
+    glDeleteShader(job.vertexShader);
+    glDeleteShader(job.fragmentShader);
+    job.checked = true;
+}
+
+inline void shader_compile_worker(ShaderCompiler* c, GLFWwindow* context)
+{
+    glfwMakeContextCurrent(context);
+    for (;;) {
+        ShaderJob* job;
+        {
+            std::unique_lock<std::mutex> lock(c->lock);
+            while (!c->stopping && c->queue.empty()) {
+                c->work.wait(lock);
+            }
+            if (c->queue.empty())
+                break;
+            job = c->queue.front();
+            c->queue.pop_front();
+        }
+
+        shader_compile_build(*job);
+        // everything done before another context uses the objects
+        glFinish();
+
+        {
+            std::lock_guard<std::mutex> lock(c->lock);
+            job->built = true;
+        }
+        c->built.notify_all();
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+// Call with the main context current. workers as from shader_compile_arg().
+// Picking by what's there means the driver's threads if it has the
+// extension, else worker contexts if there's more than one core to run
+// them on, else the driver anyway.
+inline void shader_compile_init(ShaderCompiler& c, GLFWwindow* window, int workers)
+{
+    c.jobs.clear();
+    c.queue.clear();
+    c.stopping = false;
+    c.blocked = 0.0;
+    c.start = std::chrono::steady_clock::now();
+
+    c.parallelExtension = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    if (workers == 0) {
+        c.mode = SHADER_COMPILE_BLOCKING;
+    } else if (workers < 0 && c.parallelExtension) {
+        c.mode = SHADER_COMPILE_DRIVER;
+    } else {
+        int cores = std::thread::hardware_concurrency();
+        if (workers < 0)
+            workers = std::min(cores - 1, SHADER_COMPILE_MAX_WORKERS);
+        c.mode = workers > 0 ? SHADER_COMPILE_WORKERS : SHADER_COMPILE_DRIVER;
+    }
+
+    if (c.mode == SHADER_COMPILE_DRIVER && c.parallelExtension) {
+        // as many threads as the driver likes
+        if (GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xffffffff);
+        else
+            glMaxShaderCompilerThreadsARB(0xffffffff);
+    }
+
+    if (c.mode == SHADER_COMPILE_WORKERS) {
+        // windows can only be made on this thread, and the context hints
+        // are still the main window's
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        for (int i = 0; i < workers; i++) {
+            GLFWwindow* context = glfwCreateWindow(1, 1, "shader compiler", nullptr, window);
+            if (!context) {
+                printf("couldn't create a shared context for shader compiling\n");
+                exit(1);
+            }
+            c.contexts.push_back(context);
+        }
+        glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+        for (size_t i = 0; i < c.contexts.size(); i++) {
+            c.workers.push_back(std::thread(shader_compile_worker, &c, c.contexts[i]));
+        }
+    }
+}
+
+// Start on a program, returning what to fetch it by. attributes are space
+// separated and bound to locations 0, 1, ... in order.
+inline int shader_compile_submit(ShaderCompiler& c, const std::string& name, const std::string& vertexSource,
+                                 const std::string& fragmentSource, const char* attributes)
+{
+    TRACE_SCOPE("shader_compile_submit");
+    c.jobs.push_back(ShaderJob());
+    ShaderJob& job = c.jobs.back();
+    job.name = name;
+    job.vertexSource = vertexSource;
+    job.fragmentSource = fragmentSource;
+    std::istringstream names(attributes);
+    std::string attribute;
+    while (names >> attribute) {
+        job.attributes.push_back(attribute);
+    }
+    job.vertexShader = job.fragmentShader = job.program = 0;
+    job.built = false;
+    job.checked = false;
+
+    if (c.mode == SHADER_COMPILE_WORKERS) {
+        {
+            std::lock_guard<std::mutex> lock(c.lock);
+            c.queue.push_back(&job);
+        }
+        c.work.notify_one();
+    } else if (c.mode == SHADER_COMPILE_DRIVER) {
+        shader_compile_build(job);
+        job.built = true;
+    } else {
+        // all of it waiting, as far as the caller's concerned
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        shader_compile_build(job);
+        job.built = true;
+        shader_compile_check(job);
+        c.blocked += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+    return c.jobs.size() - 1;
+}
+
+// The same, from a pair of files
+inline int shader_compile_files(ShaderCompiler& c, const char* vertexFile, const char* fragmentFile,
+                                const char* attributes)
+{
+    return shader_compile_submit(c, std::string(vertexFile) + " + " + fragmentFile, shader_compile_read(vertexFile),
+                                 shader_compile_read(fragmentFile), attributes);
+}
+
+// Whether fetching the program would go without waiting
+inline bool shader_compile_ready(ShaderCompiler& c, int id)
+{
+    ShaderJob& job = c.jobs[id];
+    if (job.checked)
+        return true;
+    if (c.mode == SHADER_COMPILE_WORKERS) {
+        std::lock_guard<std::mutex> lock(c.lock);
+        return job.built;
+    }
+    if (!c.parallelExtension)
+        return false;
+    GLint done;
+    glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// The linked program, waiting for it if it isn't yet
+inline GLuint shader_compile_program(ShaderCompiler& c, int id)
+{
+    ShaderJob& job = c.jobs[id];
+    if (job.checked)
+        return job.program;
+
+    TRACE_SCOPE("shader_compile_program");
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if (c.mode == SHADER_COMPILE_WORKERS) {
+        std::unique_lock<std::mutex> lock(c.lock);
+        while (!job.built) {
+            c.built.wait(lock);
+        }
+    }
+    shader_compile_check(job);
+    c.blocked += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return job.program;
+}
+
+// How it went, from init to now
+inline void shader_compile_report(ShaderCompiler& c)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - c.start).count();
+    printf("shaders: %d programs in %.1f ms, %.1f ms of it waiting on them, %s", (int)c.jobs.size(),
+           seconds * 1e3, c.blocked * 1e3, shader_compile_mode_names[c.mode]);
+    if (c.mode == SHADER_COMPILE_WORKERS)
+        printf(" (%d)", (int)c.contexts.size());
+    if (c.mode == SHADER_COMPILE_DRIVER)
+        printf(c.parallelExtension ? " (parallel)" : " (no parallel compile extension)");
+    printf("\n");
+}
+
+// Stops the workers, once they've built what's queued. The programs that
+// were fetched stay; whoever fetched them deletes them. Calling it again
+// afterwards does nothing.
+inline void shader_compile_destroy(ShaderCompiler& c)
+{
+    {
+        std::lock_guard<std::mutex> lock(c.lock);
+        c.stopping = true;
+    }
+    c.work.notify_all();
+    for (size_t i = 0; i < c.workers.size(); i++) {
+        c.workers[i].join();
+    }
+    c.workers.clear();
+    for (size_t i = 0; i < c.contexts.size(); i++) {
+        glfwDestroyWindow(c.contexts[i]);
+    }
+    c.contexts.clear();
+
+    // never fetched, so nobody else has them
+    for (size_t i = 0; i < c.jobs.size(); i++) {
+        if (!c.jobs[i].checked && c.jobs[i].program) {
+            glDeleteShader(c.jobs[i].vertexShader);
+            glDeleteShader(c.jobs[i].fragmentShader);
+            glstate_delete_program(c.jobs[i].program);
+        }
+    }
+    c.jobs.clear();
+}
+
+// Destroys a compiler when it goes out of scope, so every return after
+// shader_compile_init() stops the workers before the compiler they use goes
+// away. Returns that still need the context afterwards, like ones after
+// glfwTerminate(), call shader_compile_destroy() first themselves.
+struct ShaderCompileGuard {
+    ShaderCompiler& compiler;
+
+    explicit ShaderCompileGuard(ShaderCompiler& c) : compiler(c) {}
+    ~ShaderCompileGuard() { shader_compile_destroy(compiler); }
+};
+
+#endif
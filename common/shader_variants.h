@@ -0,0 +1,205 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+// Shader permutations: one pair of source files compiled into as many
+// programs as there are combinations of features it's asked for.
+//
+// A feature is a #define the sources test with #ifdef, so each variant only
+// has the work its pass needs compiled in, rather than every pass paying for
+// the most general one through uniforms and branches. shader_variant() takes
+// the features as a space separated list, puts a #define for each right
+// after the #version line of both shaders, and keeps the linked program
+// under that set of features. Asking again, in any order, gives back the
+// same program without compiling anything.
+//
+// The attributes named at init are bound to locations 0, 1, ... in every
+// variant, so all of them can draw from the same vertex arrays. Uniform
+// locations still differ from one program to another.
+//
+// Given a ShaderCompiler (common/shader_compile.h), variants can be asked for
+// ahead of time with shader_variant_submit(), and compile while other things
+// happen. shader_variant() then only waits for whatever's left of the one it
+// wants.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "glstate.h"
+#include "trace.h"
+#include "shader_compile.h"
+
+struct ShaderVariants {
+    std::string vertexFile;
+    std::string fragmentFile;
+    std::string vertexSource;
+    std::string fragmentSource;
+    std::vector<std::string> attributes;
+    std::map<std::string, GLuint> programs;     // by sorted feature list
+    ShaderCompiler* compiler;                   // NULL to compile on the spot
+    std::map<std::string, int> submitted;       // with the compiler, not yet fetched
+};
+
+// attributes: space separated, bound to locations in order
+inline void shader_variants_init(ShaderVariants& v, const char* vertexFile, const char* fragmentFile,
+                                 const char* attributes, ShaderCompiler* compiler = NULL)
+{
+    v.vertexFile = vertexFile;
+    v.fragmentFile = fragmentFile;
+    v.vertexSource = shader_compile_read(vertexFile);
+    v.fragmentSource = shader_compile_read(fragmentFile);
+    v.attributes.clear();
+    std::istringstream names(attributes);
+    std::string name;
+    while (names >> name) {
+        v.attributes.push_back(name);
+    }
+    v.programs.clear();
+    v.compiler = compiler;
+    v.submitted.clear();
+}
+
+// The source with a #define for each feature after its #version line. The
+// #line keeps the compiler's line numbers matching the file's.
+inline std::string shader_variants_specialize(const std::string& source, const std::vector<std::string>& features)
+{
+    size_t start = 0;
+    int line = 1;
+    if (source.compare(0, 8, "#version") == 0) {
+        start = source.find('\n') + 1;
+        line = 2;
+    }
+    std::string out = source.substr(0, start);
+    for (size_t i = 0; i < features.size(); i++) {
+        out += "#define " + features[i] + " 1\n";
+    }
+    out += "#line " + std::to_string(line) + "\n";
+    out += source.substr(start);
+    return out;
+}
+
+inline GLuint shader_variants_compile(GLenum type, const std::string& source, const std::string& filename,
+                                      const std::string& key)
+{
+    GLuint shader = glCreateShader(type);
+    const char* src = source.c_str();
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char buffer[512];
+        glGetShaderInfoLog(shader, 512, NULL, buffer);
+        printf("shader %s [%s] compilation failed!\n\n%s\n", filename.c_str(), key.c_str(), buffer);
+        exit(1);
+    }
+    return shader;
+}
+
+// The features, sorted and without repeats
+inline std::vector<std::string> shader_variants_features(const char* features)
+{
+    std::vector<std::string> list;
+    std::istringstream names(features);
+    std::string name;
+    while (names >> name) {
+        list.push_back(name);
+    }
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+    return list;
+}
+
+inline std::string shader_variants_key(const std::vector<std::string>& list)
+{
+    std::string key;
+    for (size_t i = 0; i < list.size(); i++) {
+        key += (i ? " " : "") + list[i];
+    }
+    return key;
+}
+
+// Start compiling this set of features with the compiler, if it isn't
+// already
+inline void shader_variant_submit(ShaderVariants& v, const char* features)
+{
+    std::vector<std::string> list = shader_variants_features(features);
+    std::string key = shader_variants_key(list);
+    if (!v.compiler || v.programs.count(key) || v.submitted.count(key))
+        return;
+
+    std::string attributes;
+    for (size_t i = 0; i < v.attributes.size(); i++) {
+        attributes += v.attributes[i] + " ";
+    }
+    v.submitted[key] = shader_compile_submit(*v.compiler, v.vertexFile + " + " + v.fragmentFile + " [" + key + "]",
+                                             shader_variants_specialize(v.vertexSource, list),
+                                             shader_variants_specialize(v.fragmentSource, list), attributes.c_str());
+}
+
+// The program for this set of features, compiled the first time it's asked
+// for
+inline GLuint shader_variant(ShaderVariants& v, const char* features)
+{
+    std::vector<std::string> list = shader_variants_features(features);
+    std::string key = shader_variants_key(list);
+    std::map<std::string, GLuint>::iterator found = v.programs.find(key);
+    if (found != v.programs.end())
+        return found->second;
+
+    if (v.compiler) {
+        shader_variant_submit(v, features);
+        GLuint program = shader_compile_program(*v.compiler, v.submitted[key]);
+        v.submitted.erase(key);
+        printf("compiled %s + %s [%s]\n", v.vertexFile.c_str(), v.fragmentFile.c_str(), key.c_str());
+        v.programs[key] = program;
+        return program;
+    }
+
+    TRACE_SCOPE("shader_variant");
+    GLuint vertexShader = shader_variants_compile(GL_VERTEX_SHADER, shader_variants_specialize(v.vertexSource, list),
+                                                  v.vertexFile, key);
+    GLuint fragmentShader = shader_variants_compile(GL_FRAGMENT_SHADER,
+                                                    shader_variants_specialize(v.fragmentSource, list),
+                                                    v.fragmentFile, key);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    for (size_t i = 0; i < v.attributes.size(); i++) {
+        glBindAttribLocation(program, i, v.attributes[i].c_str());
+    }
+    glBindFragDataLocation(program, 0, "outColor");
+    glLinkProgram(program);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char buffer[512];
+        glGetProgramInfoLog(program, 512, NULL, buffer);
+        printf("shader program %s + %s [%s] link failed!\n\n%s\n", v.vertexFile.c_str(), v.fragmentFile.c_str(),
+               key.c_str(), buffer);
+        exit(1);
+    }
+    // the program keeps them for as long as it needs them
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    printf("compiled %s + %s [%s]\n", v.vertexFile.c_str(), v.fragmentFile.c_str(), key.c_str());
+    v.programs[key] = program;
+    return program;
+}
+
+inline void shader_variants_destroy(ShaderVariants& v)
+{
+    for (std::map<std::string, GLuint>::iterator i = v.programs.begin(); i != v.programs.end(); i++) {
+        glstate_delete_program(i->second);
+    }
+    v.programs.clear();
+}
+
+#endif
@@ -0,0 +1,485 @@
+#ifndef SIM_STREAM_H
+#define SIM_STREAM_H
+
+// Recording and replaying simulation state.
+//
+// A stream is a header, one record per simulation step, then the file
+// offsets of all keyframes and a trailer pointing at them:
+//
+//   StreamHeader
+//   StreamRecord + payload        keyframe, the full state
+//   StreamRecord + payload        delta against the previous step
+//   ...
+//   uint64_t keyframeOffsets[]
+//   StreamTrailer
+//
+// The state of a step is its heights followed by its velocities. A delta
+// predicts each height as the previous height plus the previous velocity,
+// which is exactly the position update of the simulation, and each velocity
+// as the previous velocity, and stores the xor of the actual bits against the
+// prediction. Heights then come out all zero and velocities keep their sign,
+// exponent and top mantissa bits mostly zero. The payload groups the bytes
+// of the heights by significance into four planes, then those of the
+// velocities into four more. In a compressed stream every plane that looks
+// like it has enough zeros in it is deflated at zlib's fastest level; the
+// low mantissa planes of the velocities are noise and stored as they are.
+//
+// Writing happens on a thread of its own, the simulation only copies its
+// state into a recycled buffer and queues it. Reading maps the whole file,
+// and any step is reached through the keyframe index plus at most
+// keyframeInterval - 1 deltas.
+
+#include "spsc_queue.h"
+
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#define STREAM_VERSION 1
+
+// header flags
+#define STREAM_COMPRESSED 1
+
+// record types
+#define STREAM_KEYFRAME 0
+#define STREAM_DELTA 1
+
+// set in a plane's size when the plane is deflated
+#define STREAM_PLANE_DEFLATED 0x80000000u
+
+// widest and tallest field a reader takes
+#define STREAM_MAX_SIZE 8192
+
+struct StreamHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    double dt;
+    uint32_t keyframeInterval;
+    uint32_t flags;
+};
+
+// followed by `size` bytes of payload: the sizes of the eight planes, then
+// the planes themselves
+struct StreamRecord {
+    uint32_t type;
+    uint32_t size;
+    uint64_t step;
+};
+
+struct StreamTrailer {
+    uint64_t indexOffset;
+    uint64_t keyframes;
+    uint64_t records;
+    char magic[4];
+    uint32_t reserved;
+};
+
+// Group the bytes of `count` words by significance: all low bytes first,
+// then all second bytes, and so on
+inline void stream_shuffle(const uint32_t* in, unsigned char* out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t v = in[i];
+        out[i] = v;
+        out[count + i] = v >> 8;
+        out[2*count + i] = v >> 16;
+        out[3*count + i] = v >> 24;
+    }
+}
+
+inline void stream_unshuffle(const unsigned char* in, uint32_t* out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = in[i] | (in[count + i] << 8) | (in[2*count + i] << 16) | ((uint32_t)in[3*count + i] << 24);
+    }
+}
+
+// Whether a plane has enough zeros to be worth deflating, judged from a
+// sample of it
+inline bool stream_worth_deflating(const unsigned char* plane, size_t count)
+{
+    size_t zeros = 0, samples = 0;
+    for (size_t i = 0; i < count; i += 16, samples++)
+        zeros += plane[i] == 0;
+    return zeros * 8 > samples;
+}
+
+////////////////////////////////////////////
+///////////////// WRITER ///////////////////
+////////////////////////////////////////////
+
+struct StreamFrame {
+    uint64_t step;
+    std::vector<float> state;
+};
+
+struct StreamWriter {
+    FILE* file;
+    StreamHeader header;
+    size_t floats;
+
+    // writer thread only
+    std::vector<float> previous;
+    std::vector<uint32_t> bits;
+    std::vector<unsigned char> shuffled;
+    std::vector<unsigned char> payload;
+    std::vector<uint64_t> keyframeOffsets;
+    uint64_t offset;
+    uint64_t records;
+    double busySeconds;
+
+    // frames travel to the writer through `pending` and come back to be
+    // reused through `recycled`
+    SpscQueue<StreamFrame*, 256> pending;
+    SpscQueue<StreamFrame*, 256> recycled;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    // simulation thread only: how often it had to wait for a full queue
+    long stalls;
+};
+
+inline void stream_write_record(StreamWriter& w, const StreamFrame& frame)
+{
+    size_t count = w.floats;
+    size_t n = count / 2;
+    bool key = w.records % w.header.keyframeInterval == 0;
+
+    const uint32_t* cur = (const uint32_t*)frame.state.data();
+    const uint32_t* src = cur;
+    if (!key) {
+        const float* prev = w.previous.data();
+        const uint32_t* prevBits = (const uint32_t*)prev;
+        for (size_t i = 0; i < n; i++) {
+            float predicted = prev[i] + prev[n + i];
+            uint32_t predictedBits;
+            memcpy(&predictedBits, &predicted, sizeof(predictedBits));
+            w.bits[i] = cur[i] ^ predictedBits;
+        }
+        for (size_t i = n; i < count; i++)
+            w.bits[i] = cur[i] ^ prevBits[i];
+        src = w.bits.data();
+    }
+    stream_shuffle(src, w.shuffled.data(), n);
+    stream_shuffle(src + n, w.shuffled.data() + 4 * n, n);
+    memcpy(w.previous.data(), frame.state.data(), count * sizeof(float));
+
+    uint32_t sizes[8];
+    size_t used = sizeof(sizes);
+    for (int p = 0; p < 8; p++) {
+        const unsigned char* plane = w.shuffled.data() + p * n;
+        unsigned char* out = w.payload.data() + used;
+
+        uLongf len = w.payload.size() - used;
+        if ((w.header.flags & STREAM_COMPRESSED) && stream_worth_deflating(plane, n) &&
+            compress2(out, &len, plane, n, Z_BEST_SPEED) == Z_OK && len < n) {
+            sizes[p] = len | STREAM_PLANE_DEFLATED;
+        } else {
+            len = n;
+            memcpy(out, plane, n);
+            sizes[p] = len;
+        }
+        used += len;
+    }
+    memcpy(w.payload.data(), sizes, sizeof(sizes));
+
+    StreamRecord rec;
+    rec.type = key ? STREAM_KEYFRAME : STREAM_DELTA;
+    rec.size = used;
+    rec.step = frame.step;
+
+    if (key)
+        w.keyframeOffsets.push_back(w.offset);
+    fwrite(&rec, sizeof(rec), 1, w.file);
+    fwrite(w.payload.data(), 1, used, w.file);
+    w.offset += sizeof(rec) + used;
+    w.records++;
+}
+
+inline void stream_writer_run(StreamWriter* w)
+{
+    StreamFrame* frame;
+    while (true) {
+        // check before popping: once we've seen the producer stop, an empty
+        // queue really is empty
+        bool stopping = !w->running;
+        if (!w->pending.pop(frame)) {
+            if (stopping)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+        stream_write_record(*w, *frame);
+        auto t_end = std::chrono::high_resolution_clock::now();
+        w->busySeconds += std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start).count();
+
+        if (!w->recycled.push(frame))
+            delete frame;
+    }
+}
+
+inline bool stream_writer_open(StreamWriter& w, const char* path, int width, int height, double dt,
+                               int keyframeInterval, bool compress)
+{
+    w.file = fopen(path, "wb");
+    if (!w.file) {
+        printf("couldn't open %s for writing\n", path);
+        return false;
+    }
+
+    memcpy(w.header.magic, "RIPL", 4);
+    w.header.version = STREAM_VERSION;
+    w.header.width = width;
+    w.header.height = height;
+    w.header.dt = dt;
+    w.header.keyframeInterval = keyframeInterval;
+    w.header.flags = compress ? STREAM_COMPRESSED : 0;
+    fwrite(&w.header, sizeof(w.header), 1, w.file);
+
+    w.floats = 2 * width * height;
+    w.previous.assign(w.floats, 0.0f);
+    w.bits.resize(w.floats);
+    w.shuffled.resize(w.floats * sizeof(float));
+    w.payload.resize(8 * sizeof(uint32_t) + 8 * compressBound(w.floats / 2));
+    w.keyframeOffsets.clear();
+    w.offset = sizeof(w.header);
+    w.records = 0;
+    w.busySeconds = 0.0;
+    w.stalls = 0;
+
+    w.running = true;
+    w.thread = std::thread(stream_writer_run, &w);
+    return true;
+}
+
+// Queue the state of one step. Called from the simulation thread, this only
+// copies; it waits only if the writer has fallen a whole queue behind.
+inline void stream_writer_push(StreamWriter& w, uint64_t step, const float* heights, const float* velocities)
+{
+    StreamFrame* frame;
+    if (!w.recycled.pop(frame))
+        frame = new StreamFrame();
+
+    size_t n = w.floats / 2;
+    frame->step = step;
+    frame->state.resize(w.floats);
+    memcpy(frame->state.data(), heights, n * sizeof(float));
+    memcpy(frame->state.data() + n, velocities, n * sizeof(float));
+
+    while (!w.pending.push(frame)) {
+        w.stalls++;
+        std::this_thread::yield();
+    }
+}
+
+// Finish writing everything queued, then the index and trailer
+inline void stream_writer_close(StreamWriter& w)
+{
+    w.running = false;
+    w.thread.join();
+
+    StreamTrailer trailer;
+    trailer.indexOffset = w.offset;
+    trailer.keyframes = w.keyframeOffsets.size();
+    trailer.records = w.records;
+    memcpy(trailer.magic, "RIPL", 4);
+    trailer.reserved = 0;
+
+    fwrite(w.keyframeOffsets.data(), sizeof(uint64_t), w.keyframeOffsets.size(), w.file);
+    fwrite(&trailer, sizeof(trailer), 1, w.file);
+    fclose(w.file);
+    w.file = NULL;
+
+    StreamFrame* frame;
+    while (w.recycled.pop(frame))
+        delete frame;
+}
+
+////////////////////////////////////////////
+///////////////// READER ///////////////////
+////////////////////////////////////////////
+
+struct StreamReader {
+    int fd;
+    const unsigned char* data;
+    size_t size;
+
+    StreamHeader header;
+    StreamTrailer trailer;
+    const unsigned char* index;
+    size_t floats;
+
+    // the decoded state of record `current`, and where the next one starts
+    std::vector<float> state;
+    long current;
+    uint64_t next;
+
+    std::vector<unsigned char> shuffled;
+    std::vector<uint32_t> bits;
+};
+
+inline bool stream_reader_open(StreamReader& r, const char* path)
+{
+    r.fd = open(path, O_RDONLY);
+    if (r.fd < 0) {
+        printf("couldn't open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    fstat(r.fd, &st);
+    r.size = st.st_size;
+    if (r.size < sizeof(StreamHeader) + sizeof(StreamTrailer)) {
+        printf("%s is too short to be a stream\n", path);
+        close(r.fd);
+        return false;
+    }
+
+    r.data = (const unsigned char*)mmap(NULL, r.size, PROT_READ, MAP_SHARED, r.fd, 0);
+    if (r.data == MAP_FAILED) {
+        printf("couldn't map %s\n", path);
+        close(r.fd);
+        return false;
+    }
+
+    memcpy(&r.header, r.data, sizeof(r.header));
+    memcpy(&r.trailer, r.data + r.size - sizeof(r.trailer), sizeof(r.trailer));
+
+    // the records then the index, before the trailer, and an index entry
+    // for every keyframe the records need
+    uint64_t end = r.size - sizeof(r.trailer);
+    uint64_t interval = r.header.keyframeInterval;
+    if (memcmp(r.header.magic, "RIPL", 4) != 0 || memcmp(r.trailer.magic, "RIPL", 4) != 0 ||
+        r.header.version != STREAM_VERSION || r.trailer.records == 0 || interval == 0 ||
+        r.header.width == 0 || r.header.width > STREAM_MAX_SIZE ||
+        r.header.height == 0 || r.header.height > STREAM_MAX_SIZE ||
+        r.trailer.indexOffset < sizeof(r.header) || r.trailer.indexOffset > end ||
+        r.trailer.keyframes > (end - r.trailer.indexOffset) / sizeof(uint64_t) ||
+        r.trailer.keyframes < (r.trailer.records - 1) / interval + 1) {
+        printf("%s is not a complete stream\n", path);
+        munmap((void*)r.data, r.size);
+        close(r.fd);
+        return false;
+    }
+
+    r.index = r.data + r.trailer.indexOffset;
+    r.floats = 2 * r.header.width * r.header.height;
+    r.state.assign(r.floats, 0.0f);
+    r.current = -1;
+    r.next = sizeof(r.header);
+    r.shuffled.resize(r.floats * sizeof(float));
+    r.bits.resize(r.floats);
+    return true;
+}
+
+// Decode the record at `offset` into the state, returns the offset of the
+// record after it, or 0 if the record doesn't fit before the index or
+// doesn't decode to a whole state
+inline uint64_t stream_decode_record(StreamReader& r, uint64_t offset)
+{
+    size_t count = r.floats;
+    size_t n = count / 2;
+    uint64_t end = r.trailer.indexOffset;
+
+    StreamRecord rec;
+    uint32_t sizes[8];
+    if (offset < sizeof(r.header) || offset > end || end - offset < sizeof(rec) + sizeof(sizes))
+        return 0;
+    memcpy(&rec, r.data + offset, sizeof(rec));
+    if ((rec.type != STREAM_KEYFRAME && rec.type != STREAM_DELTA) || rec.size < sizeof(sizes) ||
+        rec.size > end - offset - sizeof(rec))
+        return 0;
+    const unsigned char* payload = r.data + offset + sizeof(rec);
+
+    memcpy(sizes, payload, sizeof(sizes));
+    const unsigned char* plane = payload + sizeof(sizes);
+    uint64_t left = rec.size - sizeof(sizes);
+    for (int p = 0; p < 8; p++) {
+        unsigned char* out = r.shuffled.data() + p * n;
+        uint32_t size = sizes[p] & ~STREAM_PLANE_DEFLATED;
+        if (size > left)
+            return 0;
+        if (sizes[p] & STREAM_PLANE_DEFLATED) {
+            uLongf len = n;
+            if (uncompress(out, &len, plane, size) != Z_OK || len != n)
+                return 0;
+        } else {
+            if (size != n)
+                return 0;
+            memcpy(out, plane, size);
+        }
+        plane += size;
+        left -= size;
+    }
+
+    float* state = r.state.data();
+    uint32_t* stateBits = (uint32_t*)state;
+    if (rec.type == STREAM_KEYFRAME) {
+        stream_unshuffle(r.shuffled.data(), stateBits, n);
+        stream_unshuffle(r.shuffled.data() + 4 * n, stateBits + n, n);
+    } else {
+        // same predictions as the writer: heights first, while the
+        // velocities are still the previous ones
+        stream_unshuffle(r.shuffled.data(), r.bits.data(), n);
+        stream_unshuffle(r.shuffled.data() + 4 * n, r.bits.data() + n, n);
+        for (size_t i = 0; i < n; i++) {
+            float predicted = state[i] + state[n + i];
+            uint32_t predictedBits;
+            memcpy(&predictedBits, &predicted, sizeof(predictedBits));
+            stateBits[i] = r.bits[i] ^ predictedBits;
+        }
+        for (size_t i = n; i < count; i++)
+            stateBits[i] ^= r.bits[i];
+    }
+
+    return offset + sizeof(rec) + rec.size;
+}
+
+// Make record `n` the current one. Returns its heights; the velocities
+// follow right after them. NULL (with a message) if the stream is corrupt
+// on the way there.
+inline const float* stream_reader_seek(StreamReader& r, long n)
+{
+    long interval = r.header.keyframeInterval;
+    n = n % (long)r.trailer.records;
+
+    // unless we can just keep decoding forwards, restart from the keyframe
+    if (r.current < 0 || n < r.current || n / interval != r.current / interval) {
+        uint64_t offset;
+        memcpy(&offset, r.index + (n / interval) * sizeof(uint64_t), sizeof(offset));
+        r.next = stream_decode_record(r, offset);
+        r.current = n - n % interval;
+    }
+    while (r.next != 0 && r.current < n) {
+        r.next = stream_decode_record(r, r.next);
+        r.current++;
+    }
+    if (r.next == 0) {
+        printf("stream is corrupt at record %ld\n", r.current);
+        r.current = -1;
+        return NULL;
+    }
+
+    return r.state.data();
+}
+
+inline void stream_reader_close(StreamReader& r)
+{
+    munmap((void*)r.data, r.size);
+    close(r.fd);
+}
+
+#endif
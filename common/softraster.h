@@ -0,0 +1,754 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+// A software rasterizer for the small part of GL the examples use.
+//
+// Shaders are C++ objects standing in for a vert.glsl / frag.glsl pair:
+//
+//     struct MyShader {
+//         static const int VARYINGS = 2;   // floats passed vertex -> fragment
+//         glm::mat4 mvp;                   // uniforms are plain members
+//         void vertex(int index, SoftVertex& out) const;
+//         glm::vec4 fragment(const float* varyings) const;
+//     };
+//
+// A draw runs the vertex shader on the calling thread right away, clips the
+// triangles to the near and far planes and bins them into SOFT_TILE sized
+// screen tiles, keeping a copy of the shader and of the depth and stencil
+// state for later. Nothing is rasterized until soft_flush() (or
+// soft_present(), or the batch filling up): then the tiles are shared out
+// over a pool of threads, each taking one whole tile at a time and drawing
+// its triangles in submission order, so no two threads ever touch the same
+// pixel and the result is the same as drawing them one by one.
+//
+// Coverage is worked out four pixels at a time by evaluating the three edge
+// functions with SSE (plain C++ elsewhere); the pixels that pass go through
+// the stencil test, depth test and fragment shader one by one, with
+// perspective correct varyings. Shared edges follow a top-left rule so no
+// pixel is drawn twice or skipped.
+//
+// The depth and stencil state follows GL's, down to using the same enums.
+// There's no blending and no culling, since the examples don't use them.
+// Shaders are copied by value and never destroyed, so they should only hold
+// values and pointers to things that outlive the frame (like textures).
+//
+// The rasterizer itself doesn't need GL at all; soft_present() is the one
+// place it does, to put the image in the window. Without one,
+// soft_read_pixels() hands the finished image over instead.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "trace.h"
+
+// pixels on a side of a tile
+#define SOFT_TILE 64
+
+#define SOFT_MAX_VARYINGS 8
+
+// triangles and bytes of shader copies a batch can hold before it gets
+// flushed on its own
+#define SOFT_BATCH_TRIANGLES (1 << 16)
+#define SOFT_SHADER_BYTES (1 << 16)
+
+struct SoftVertex {
+    glm::vec4 position;     // clip space, as gl_Position
+    float varyings[SOFT_MAX_VARYINGS];
+};
+
+// A float texture sampled like a GL_LINEAR one without mipmaps. Sampling
+// returns 1 to 4 channels filled out the same way GL does, (r, 0, 0, 1) for
+// one channel and so on.
+struct SoftTexture {
+    int width;
+    int height;
+    int channels;
+    bool repeat;            // GL_REPEAT, otherwise GL_CLAMP_TO_EDGE
+    const float* texels;
+    std::vector<float> storage;
+};
+
+// Convert 8 bit RGB pixels, as SOIL loads them, into a texture of its own
+inline void soft_texture_rgb8(SoftTexture& t, const unsigned char* pixels, int width, int height, bool repeat)
+{
+    t.width = width;
+    t.height = height;
+    t.channels = 3;
+    t.repeat = repeat;
+    t.storage.resize(width * height * 3);
+    for (size_t i = 0; i < t.storage.size(); i++)
+        t.storage[i] = pixels[i] / 255.0f;
+    t.texels = t.storage.data();
+}
+
+// Sample straight out of memory owned by someone else, e.g. the heights
+inline void soft_texture_wrap(SoftTexture& t, const float* texels, int width, int height, int channels, bool repeat)
+{
+    t.width = width;
+    t.height = height;
+    t.channels = channels;
+    t.repeat = repeat;
+    t.texels = texels;
+}
+
+inline int soft_texture_wrap_coord(int i, int size, bool repeat)
+{
+    if (repeat) {
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+    return std::min(std::max(i, 0), size - 1);
+}
+
+inline glm::vec4 soft_texture_sample(const SoftTexture& t, glm::vec2 uv)
+{
+    float u = uv.x * t.width - 0.5f;
+    float v = uv.y * t.height - 0.5f;
+    float fu = floorf(u), fv = floorf(v);
+    float au = u - fu, av = v - fv;
+    int x0 = soft_texture_wrap_coord((int)fu, t.width, t.repeat);
+    int x1 = soft_texture_wrap_coord((int)fu + 1, t.width, t.repeat);
+    int y0 = soft_texture_wrap_coord((int)fv, t.height, t.repeat);
+    int y1 = soft_texture_wrap_coord((int)fv + 1, t.height, t.repeat);
+
+    int n = t.channels;
+    const float* p00 = t.texels + (y0 * t.width + x0) * n;
+    const float* p10 = t.texels + (y0 * t.width + x1) * n;
+    const float* p01 = t.texels + (y1 * t.width + x0) * n;
+    const float* p11 = t.texels + (y1 * t.width + x1) * n;
+
+    float out[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    for (int c = 0; c < n; c++) {
+        float bottom = p00[c] + au * (p10[c] - p00[c]);
+        float top = p01[c] + au * (p11[c] - p01[c]);
+        out[c] = bottom + av * (top - bottom);
+    }
+    return glm::vec4(out[0], out[1], out[2], out[3]);
+}
+
+// The subset of GL's per fragment state the examples use, GL's defaults
+// to start with
+struct SoftState {
+    bool depthTest;
+    GLenum depthFunc;       // GL_LESS, GL_LEQUAL or GL_ALWAYS
+    bool depthWrite;
+
+    bool stencilTest;
+    GLenum stencilFunc;     // GL_ALWAYS, GL_EQUAL or GL_NOTEQUAL
+    GLuint stencilRef;
+    GLuint stencilFuncMask;
+    GLenum stencilFail;     // GL_KEEP, GL_ZERO or GL_REPLACE
+    GLenum stencilDepthFail;
+    GLenum stencilPass;
+    GLuint stencilWriteMask;
+};
+
+inline SoftState soft_default_state()
+{
+    SoftState s;
+    s.depthTest = false;
+    s.depthFunc = GL_LESS;
+    s.depthWrite = true;
+    s.stencilTest = false;
+    s.stencilFunc = GL_ALWAYS;
+    s.stencilRef = 0;
+    s.stencilFuncMask = 0xff;
+    s.stencilFail = s.stencilDepthFail = s.stencilPass = GL_KEEP;
+    s.stencilWriteMask = 0xff;
+    return s;
+}
+
+struct SoftTriangle {
+    int draw;
+    int minX, minY, maxX, maxY;     // bounding box in pixels, inclusive
+
+    // edge i is the one facing vertex i, a*x + b*y + c is positive inside.
+    // Divided by the area it's the barycentric weight of vertex i.
+    float a[3], b[3], c[3];
+    bool owns[3];           // whether pixels right on the edge are ours
+    float invArea;
+
+    float z[3];             // window depth, 0 to 1
+    float invW[3];
+    float varyings[3][SOFT_MAX_VARYINGS];   // premultiplied by invW
+};
+
+struct SoftRenderer;
+struct SoftDraw;
+
+typedef void (*SoftRasterFunc)(SoftRenderer& r, const SoftDraw& d, const SoftTriangle& t,
+                               int x0, int y0, int x1, int y1);
+
+struct SoftDraw {
+    size_t shader;          // offset of the shader copy
+    SoftState state;
+    SoftRasterFunc raster;
+};
+
+struct SoftRenderer {
+    int width;
+    int height;
+    int stride;             // rounded up to 4 pixels for the SIMD loops
+
+    // bottom row first, like a GL framebuffer
+    std::vector<uint32_t> color;    // RGBA8
+    std::vector<float> depth;
+    std::vector<uint8_t> stencil;
+
+    SoftState state;
+
+    // the batch waiting to be rasterized
+    std::vector<SoftTriangle> triangles;
+    std::vector<SoftDraw> draws;
+    char* shaders;
+    size_t shaderBytes;
+    std::vector<SoftVertex> vertices;       // scratch for the vertex shader
+    int tilesX;
+    int tilesY;
+    std::vector<std::vector<int> > bins;    // triangles touching each tile
+
+    // a clear waiting to happen before the batch
+    GLbitfield clearMask;
+    uint32_t clearColor;
+    float clearDepth;
+    uint8_t clearStencil;
+    uint8_t clearStencilMask;
+
+    // the pool, workers wait on wake for a new generation
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    long generation;
+    int busy;
+    bool quit;
+    std::atomic<int> nextTile;
+
+    long trianglesDrawn;    // since the last soft_stats_reset
+    long flushes;
+
+    // for soft_present
+    GLuint texture;
+    GLuint fbo;
+};
+
+////////////////////////////////////////////
+//////////////// RASTER ////////////////////
+////////////////////////////////////////////
+
+// Which of the 4 pixels starting at (x, y) are inside, with the edge
+// function values for them
+inline int soft_coverage(const SoftTriangle& t, int x, float py, float e[3][4])
+{
+#ifdef __SSE2__
+    __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    __m128 zero = _mm_setzero_ps();
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int i = 0; i < 3; i++) {
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[i]), px), _mm_set1_ps(t.b[i] * py + t.c[i]));
+        __m128 in = t.owns[i] ? _mm_cmpge_ps(v, zero) : _mm_cmpgt_ps(v, zero);
+        inside = _mm_and_ps(inside, in);
+        _mm_storeu_ps(e[i], v);
+    }
+    return _mm_movemask_ps(inside);
+#else
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        bool in = true;
+        for (int i = 0; i < 3; i++) {
+            float v = t.a[i] * (x + lane + 0.5f) + (t.b[i] * py + t.c[i]);
+            in = in && (t.owns[i] ? v >= 0.0f : v > 0.0f);
+            e[i][lane] = v;
+        }
+        if (in)
+            mask |= 1 << lane;
+    }
+    return mask;
+#endif
+}
+
+inline bool soft_stencil_passes(const SoftState& s, uint8_t value)
+{
+    GLuint ref = s.stencilRef & s.stencilFuncMask;
+    GLuint val = value & s.stencilFuncMask;
+    switch (s.stencilFunc) {
+    case GL_EQUAL: return val == ref;
+    case GL_NOTEQUAL: return val != ref;
+    case GL_NEVER: return false;
+    default: return true;
+    }
+}
+
+inline void soft_stencil_apply(const SoftState& s, GLenum op, uint8_t& value)
+{
+    uint8_t result = value;
+    if (op == GL_ZERO)
+        result = 0;
+    else if (op == GL_REPLACE)
+        result = s.stencilRef;
+    value = (value & ~s.stencilWriteMask) | (result & s.stencilWriteMask);
+}
+
+inline bool soft_depth_passes(GLenum func, float z, float stored)
+{
+    switch (func) {
+    case GL_LESS: return z < stored;
+    case GL_LEQUAL: return z <= stored;
+    case GL_NEVER: return false;
+    default: return true;
+    }
+}
+
+inline uint32_t soft_pack_channel(float v)
+{
+    return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline uint32_t soft_pack_color(glm::vec4 c)
+{
+    return soft_pack_channel(c.x) | soft_pack_channel(c.y) << 8 |
+           soft_pack_channel(c.z) << 16 | soft_pack_channel(c.w) << 24;
+}
+
+// Draw the part of t inside the tile [x0, x1) x [y0, y1)
+template <class Shader>
+void soft_raster(SoftRenderer& r, const SoftDraw& d, const SoftTriangle& t, int x0, int y0, int x1, int y1)
+{
+    const Shader& shader = *(const Shader*)(r.shaders + d.shader);
+    const SoftState& s = d.state;
+
+    int minX = std::max(t.minX, x0) & ~3;
+    int maxX = std::min(t.maxX, x1 - 1);
+    int minY = std::max(t.minY, y0);
+    int maxY = std::min(t.maxY, y1 - 1);
+
+    for (int y = minY; y <= maxY; y++) {
+        float py = y + 0.5f;
+        size_t row = (size_t)y * r.stride;
+        for (int x = minX; x <= maxX; x += 4) {
+            float e[3][4];
+            int mask = soft_coverage(t, x, py, e);
+            if (x + 4 > r.width)
+                mask &= (1 << (r.width - x)) - 1;
+
+            for (int lane = 0; mask; lane++, mask >>= 1) {
+                if (!(mask & 1))
+                    continue;
+                size_t i = row + x + lane;
+                float l0 = e[0][lane] * t.invArea;
+                float l1 = e[1][lane] * t.invArea;
+                float l2 = e[2][lane] * t.invArea;
+                float z = l0 * t.z[0] + l1 * t.z[1] + l2 * t.z[2];
+
+                // stencil, then depth, as GL does them
+                if (s.stencilTest && !soft_stencil_passes(s, r.stencil[i])) {
+                    soft_stencil_apply(s, s.stencilFail, r.stencil[i]);
+                    continue;
+                }
+                if (s.depthTest && !soft_depth_passes(s.depthFunc, z, r.depth[i])) {
+                    if (s.stencilTest)
+                        soft_stencil_apply(s, s.stencilDepthFail, r.stencil[i]);
+                    continue;
+                }
+                if (s.stencilTest)
+                    soft_stencil_apply(s, s.stencilPass, r.stencil[i]);
+                if (s.depthTest && s.depthWrite)
+                    r.depth[i] = z;
+
+                float varyings[SOFT_MAX_VARYINGS];
+                if (Shader::VARYINGS > 0) {
+                    float w = 1.0f / (l0 * t.invW[0] + l1 * t.invW[1] + l2 * t.invW[2]);
+                    for (int k = 0; k < Shader::VARYINGS; k++)
+                        varyings[k] = (l0 * t.varyings[0][k] + l1 * t.varyings[1][k] + l2 * t.varyings[2][k]) * w;
+                }
+
+                r.color[i] = soft_pack_color(shader.fragment(varyings));
+            }
+        }
+    }
+}
+
+// Rasterize tiles until there are none left, on any thread
+inline void soft_raster_tiles(SoftRenderer& r)
+{
+    int tiles = r.tilesX * r.tilesY;
+    for (int tile = r.nextTile++; tile < tiles; tile = r.nextTile++) {
+        int x0 = (tile % r.tilesX) * SOFT_TILE;
+        int y0 = (tile / r.tilesX) * SOFT_TILE;
+        int x1 = std::min(x0 + SOFT_TILE, r.width);
+        int y1 = std::min(y0 + SOFT_TILE, r.height);
+
+        if (r.clearMask) {
+            for (int y = y0; y < y1; y++) {
+                size_t row = (size_t)y * r.stride;
+                if (r.clearMask & GL_COLOR_BUFFER_BIT)
+                    std::fill(&r.color[row + x0], &r.color[row + x1], r.clearColor);
+                if (r.clearMask & GL_DEPTH_BUFFER_BIT)
+                    std::fill(&r.depth[row + x0], &r.depth[row + x1], r.clearDepth);
+                if (r.clearMask & GL_STENCIL_BUFFER_BIT) {
+                    for (int x = x0; x < x1; x++) {
+                        uint8_t& v = r.stencil[row + x];
+                        v = (v & ~r.clearStencilMask) | (r.clearStencil & r.clearStencilMask);
+                    }
+                }
+            }
+        }
+
+        const std::vector<int>& bin = r.bins[tile];
+        for (size_t i = 0; i < bin.size(); i++) {
+            const SoftTriangle& t = r.triangles[bin[i]];
+            const SoftDraw& d = r.draws[t.draw];
+            d.raster(r, d, t, x0, y0, x1, y1);
+        }
+    }
+}
+
+inline void soft_worker(SoftRenderer* r)
+{
+    TRACE_THREAD("rasterizer");
+    long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(r->lock);
+            r->wake.wait(guard, [&] { return r->quit || r->generation != seen; });
+            if (r->quit)
+                return;
+            seen = r->generation;
+        }
+        {
+            TRACE_SCOPE("raster tiles");
+            soft_raster_tiles(*r);
+        }
+        std::lock_guard<std::mutex> guard(r->lock);
+        if (--r->busy == 0)
+            r->done.notify_one();
+    }
+}
+
+////////////////////////////////////////////
+//////////////// SETUP /////////////////////
+////////////////////////////////////////////
+
+// `threads` counts the calling thread, which rasterizes too
+inline void soft_init(SoftRenderer& r, int width, int height, int threads)
+{
+    r.width = width;
+    r.height = height;
+    r.stride = (width + 3) & ~3;
+    r.color.assign((size_t)r.stride * height, 0);
+    r.depth.assign((size_t)r.stride * height, 1.0f);
+    r.stencil.assign((size_t)r.stride * height, 0);
+
+    r.state = soft_default_state();
+    r.shaders = (char*)malloc(SOFT_SHADER_BYTES);
+    r.shaderBytes = 0;
+    r.triangles.reserve(1024);
+    r.tilesX = (width + SOFT_TILE - 1) / SOFT_TILE;
+    r.tilesY = (height + SOFT_TILE - 1) / SOFT_TILE;
+    // room for some triangles per tile up front, so the bins don't keep
+    // growing as things move into tiles that were empty
+    r.bins.resize(r.tilesX * r.tilesY);
+    for (size_t i = 0; i < r.bins.size(); i++)
+        r.bins[i].reserve(SOFT_TILE);
+    r.clearMask = 0;
+
+    r.generation = 0;
+    r.busy = 0;
+    r.quit = false;
+    r.trianglesDrawn = 0;
+    r.flushes = 0;
+    for (int i = 1; i < threads; i++)
+        r.workers.push_back(std::thread(soft_worker, &r));
+
+    r.texture = 0;
+    r.fbo = 0;
+}
+
+// Rasterize everything drawn so far
+inline void soft_flush(SoftRenderer& r)
+{
+    if (r.triangles.empty() && !r.clearMask) {
+        // draws that ended up entirely off screen
+        r.draws.clear();
+        r.shaderBytes = 0;
+        return;
+    }
+    TRACE_SCOPE("soft_flush");
+
+    r.nextTile = 0;
+    {
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.generation++;
+        r.busy = r.workers.size();
+    }
+    r.wake.notify_all();
+    soft_raster_tiles(r);
+    {
+        std::unique_lock<std::mutex> guard(r.lock);
+        r.done.wait(guard, [&] { return r.busy == 0; });
+    }
+
+    for (size_t i = 0; i < r.bins.size(); i++)
+        r.bins[i].clear();
+    r.trianglesDrawn += r.triangles.size();
+    r.flushes++;
+    r.triangles.clear();
+    r.draws.clear();
+    r.shaderBytes = 0;
+    r.clearMask = 0;
+}
+
+// glClear: the color always, depth and stencil through their write masks
+inline void soft_clear(SoftRenderer& r, GLbitfield mask, glm::vec4 color, float depth = 1.0f, int stencil = 0)
+{
+    // a clear goes before the batch's triangles, so anything already drawn
+    // has to be rasterized first
+    if (!r.triangles.empty())
+        soft_flush(r);
+
+    if (!r.state.depthWrite)
+        mask &= ~GL_DEPTH_BUFFER_BIT;
+    if (mask & GL_COLOR_BUFFER_BIT)
+        r.clearColor = soft_pack_color(color);
+    if (mask & GL_DEPTH_BUFFER_BIT)
+        r.clearDepth = depth;
+    if (mask & GL_STENCIL_BUFFER_BIT) {
+        r.clearStencil = stencil;
+        r.clearStencilMask = r.state.stencilWriteMask;
+    }
+    r.clearMask |= mask;
+}
+
+// Clip a polygon to one plane, dot(plane, position) >= 0
+inline int soft_clip(const SoftVertex* in, int count, SoftVertex* out, glm::vec4 plane, int varyings)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const SoftVertex& a = in[i];
+        const SoftVertex& b = in[(i + 1) % count];
+        float da = glm::dot(plane, a.position);
+        float db = glm::dot(plane, b.position);
+        if (da >= 0.0f)
+            out[n++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            float s = da / (da - db);
+            SoftVertex& v = out[n++];
+            v.position = a.position + s * (b.position - a.position);
+            for (int k = 0; k < varyings; k++)
+                v.varyings[k] = a.varyings[k] + s * (b.varyings[k] - a.varyings[k]);
+        }
+    }
+    return n;
+}
+
+// Set up one triangle that's in front of the near plane and bin it
+inline void soft_setup(SoftRenderer& r, const SoftVertex* v0, const SoftVertex* v1, const SoftVertex* v2,
+                       int varyings)
+{
+    const SoftVertex* v[3] = { v0, v1, v2 };
+    float x[3], y[3];
+    SoftTriangle t;
+    for (int i = 0; i < 3; i++) {
+        float invW = 1.0f / v[i]->position.w;
+        x[i] = (v[i]->position.x * invW * 0.5f + 0.5f) * r.width;
+        y[i] = (v[i]->position.y * invW * 0.5f + 0.5f) * r.height;
+        t.z[i] = v[i]->position.z * invW * 0.5f + 0.5f;
+        t.invW[i] = invW;
+        for (int k = 0; k < varyings; k++)
+            t.varyings[i][k] = v[i]->varyings[k] * invW;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0f || !std::isfinite(area))
+        return;
+
+    float minX = std::min(x[0], std::min(x[1], x[2]));
+    float maxX = std::max(x[0], std::max(x[1], x[2]));
+    float minY = std::min(y[0], std::min(y[1], y[2]));
+    float maxY = std::max(y[0], std::max(y[1], y[2]));
+    if (maxX < 0.0f || maxY < 0.0f || minX > r.width || minY > r.height)
+        return;
+    // clamped while still floats; with w close to 0 the corners can be far
+    // outside what an int holds
+    float right = r.width - 1, top = r.height - 1;
+    t.minX = (int)floorf(std::min(std::max(minX, 0.0f), right));
+    t.maxX = (int)ceilf(std::min(std::max(maxX, 0.0f), right));
+    t.minY = (int)floorf(std::min(std::max(minY, 0.0f), top));
+    t.maxY = (int)ceilf(std::min(std::max(maxY, 0.0f), top));
+
+    // nothing's culled, clockwise triangles are turned around
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    t.invArea = 1.0f / (area * sign);
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        t.a[i] = sign * (y[j] - y[k]);
+        t.b[i] = sign * (x[k] - x[j]);
+        t.c[i] = sign * (float)((double)x[j] * y[k] - (double)x[k] * y[j]);
+        t.owns[i] = t.a[i] > 0.0f || (t.a[i] == 0.0f && t.b[i] < 0.0f);
+    }
+
+    t.draw = r.draws.size() - 1;
+    int index = r.triangles.size();
+    r.triangles.push_back(t);
+    for (int ty = t.minY / SOFT_TILE; ty <= t.maxY / SOFT_TILE; ty++)
+        for (int tx = t.minX / SOFT_TILE; tx <= t.maxX / SOFT_TILE; tx++)
+            r.bins[ty * r.tilesX + tx].push_back(index);
+}
+
+// Clip the triangle to the near and far planes and set up what's left
+inline void soft_triangle(SoftRenderer& r, const SoftVertex& a, const SoftVertex& b, const SoftVertex& c,
+                          int varyings)
+{
+    const glm::vec4 near(0.0f, 0.0f, 1.0f, 1.0f);
+    const glm::vec4 far(0.0f, 0.0f, -1.0f, 1.0f);
+    bool inside = true;
+    const SoftVertex* v[3] = { &a, &b, &c };
+    for (int i = 0; i < 3; i++)
+        inside = inside && glm::dot(near, v[i]->position) >= 0.0f && glm::dot(far, v[i]->position) >= 0.0f;
+    if (inside) {
+        soft_setup(r, &a, &b, &c, varyings);
+        return;
+    }
+
+    SoftVertex polygon[3] = { a, b, c };
+    SoftVertex nearClipped[4], clipped[5];
+    int n = soft_clip(polygon, 3, nearClipped, near, varyings);
+    n = soft_clip(nearClipped, n, clipped, far, varyings);
+    for (int i = 1; i + 1 < n; i++)
+        soft_setup(r, &clipped[0], &clipped[i], &clipped[i + 1], varyings);
+}
+
+// Shade vertices [first, first + count) and draw triangles out of them,
+// taking every three of `indices` if there are any and every three in order
+// if not
+template <class Shader>
+void soft_draw(SoftRenderer& r, const Shader& shader, int first, int count, const GLuint* indices)
+{
+    if (count <= 0)
+        return;
+
+    if (r.triangles.size() + 2 * count > SOFT_BATCH_TRIANGLES ||
+        r.shaderBytes + sizeof(Shader) + alignof(Shader) > SOFT_SHADER_BYTES)
+        soft_flush(r);
+
+    size_t offset = (r.shaderBytes + alignof(Shader) - 1) & ~(alignof(Shader) - 1);
+    new (r.shaders + offset) Shader(shader);
+    r.shaderBytes = offset + sizeof(Shader);
+
+    SoftDraw d;
+    d.shader = offset;
+    d.state = r.state;
+    d.raster = soft_raster<Shader>;
+    r.draws.push_back(d);
+
+    int vertexCount = count;
+    if (indices) {
+        GLuint lo = indices[0], hi = indices[0];
+        for (int i = 1; i < count; i++) {
+            lo = std::min(lo, indices[i]);
+            hi = std::max(hi, indices[i]);
+        }
+        first = lo;
+        vertexCount = hi - lo + 1;
+    }
+    if ((int)r.vertices.size() < vertexCount)
+        r.vertices.resize(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+        shader.vertex(first + i, r.vertices[i]);
+
+    for (int i = 0; i + 2 < count; i += 3) {
+        if (indices) {
+            soft_triangle(r, r.vertices[indices[i] - first], r.vertices[indices[i + 1] - first],
+                          r.vertices[indices[i + 2] - first], Shader::VARYINGS);
+        } else {
+            soft_triangle(r, r.vertices[i], r.vertices[i + 1], r.vertices[i + 2], Shader::VARYINGS);
+        }
+    }
+}
+
+// glDrawArrays(GL_TRIANGLES, first, count)
+template <class Shader>
+void soft_draw_arrays(SoftRenderer& r, const Shader& shader, int first, int count)
+{
+    soft_draw(r, shader, first, count, (const GLuint*)NULL);
+}
+
+// glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, indices)
+template <class Shader>
+void soft_draw_elements(SoftRenderer& r, const Shader& shader, const GLuint* indices, int count)
+{
+    soft_draw(r, shader, 0, count, indices);
+}
+
+// Finish the frame and copy it into the window's framebuffer
+inline void soft_present(SoftRenderer& r)
+{
+    soft_flush(r);
+    TRACE_SCOPE("soft_present");
+
+    if (!r.texture) {
+        glGenTextures(1, &r.texture);
+        glstate_bind_texture(0, GL_TEXTURE_2D, r.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, r.width, r.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &r.fbo);
+        glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, r.fbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r.texture, 0);
+    }
+
+    glstate_bind_texture(0, GL_TEXTURE_2D, r.texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, r.stride);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE, r.color.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    glstate_bind_framebuffer(GL_READ_FRAMEBUFFER, r.fbo);
+    glstate_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, r.width, r.height, 0, 0, r.width, r.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+}
+
+// Finish the frame and copy it into `pixels`, RGBA with the bottom row first
+// the way glReadPixels gives it
+inline void soft_read_pixels(SoftRenderer& r, unsigned char* pixels)
+{
+    soft_flush(r);
+    for (int y = 0; y < r.height; y++)
+        memcpy(pixels + (size_t)y * 4 * r.width, &r.color[(size_t)y * r.stride], 4 * r.width);
+}
+
+inline void soft_destroy(SoftRenderer& r)
+{
+    {
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.quit = true;
+    }
+    r.wake.notify_all();
+    for (size_t i = 0; i < r.workers.size(); i++)
+        r.workers[i].join();
+    r.workers.clear();
+    free(r.shaders);
+
+    if (r.texture) {
+        glstate_delete_framebuffers(1, &r.fbo);
+        glstate_delete_textures(1, &r.texture);
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. push() and pop() never wait, they just fail when the queue is full
+// or empty.
+
+#include <atomic>
+#include <cstddef>
+
+template <typename T, size_t N>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % N;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h];
+        head.store((h + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[N];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Begin/end tracing, written out as Chrome trace_event JSON.
+//
+// Built with -DTRACE (make CXXFLAGS=-DTRACE) the macros below record
+// timestamped begin and end events, and at exit everything is written to
+// trace.json (or $TRACE_FILE), ready for chrome://tracing or Perfetto.
+// Without TRACE they're all empty and cost nothing.
+//
+//     TRACE_SCOPE("draw");             // from here to the end of the block
+//     TRACE_BEGIN("glewInit");         // or between two points in the
+//     glewInit();                      // same block
+//     TRACE_END();
+//     TRACE_THREAD("simulation");      // name the calling thread
+//
+// Every thread records into a buffer of its own, so recording takes no
+// locks; only a thread's first event registers its buffer. Buffers hold
+// TRACE_EVENTS events and anything past that is dropped and counted.
+// Names have to be string literals, or at least live until exit.
+
+#ifdef TRACE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// events kept per thread
+#define TRACE_EVENTS (1 << 18)
+
+struct TraceEvent {
+    const char* name;
+    int64_t ns;         // since the trace started
+    char phase;         // 'B' or 'E'
+};
+
+struct TraceBuffer {
+    int tid;
+    const char* threadName;
+    TraceEvent* events;
+    std::atomic<int> count;
+    long dropped;
+};
+
+struct TraceLog {
+    std::chrono::steady_clock::time_point start;
+    std::mutex lock;
+    std::vector<TraceBuffer*> buffers;
+};
+
+inline void trace_write();
+
+inline TraceLog& trace_log()
+{
+    static TraceLog log;
+    return log;
+}
+
+// The calling thread's buffer, registered the first time it's asked for
+inline TraceBuffer* trace_buffer()
+{
+    static thread_local TraceBuffer* buffer = NULL;
+    if (!buffer) {
+        TraceLog& log = trace_log();
+        buffer = new TraceBuffer();
+        buffer->events = new TraceEvent[TRACE_EVENTS];
+        buffer->count = 0;
+        buffer->dropped = 0;
+        buffer->threadName = NULL;
+
+        std::lock_guard<std::mutex> guard(log.lock);
+        if (log.buffers.empty()) {
+            log.start = std::chrono::steady_clock::now();
+            atexit(trace_write);
+        }
+        buffer->tid = log.buffers.size() + 1;
+        log.buffers.push_back(buffer);
+    }
+    return buffer;
+}
+
+inline void trace_event(const char* name, char phase)
+{
+    TraceBuffer* b = trace_buffer();
+    int i = b->count.load(std::memory_order_relaxed);
+    if (i == TRACE_EVENTS) {
+        b->dropped++;
+        return;
+    }
+    TraceEvent& e = b->events[i];
+    e.name = name;
+    e.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_log().start).count();
+    e.phase = phase;
+
+    // publish the event for trace_write
+    b->count.store(i + 1, std::memory_order_release);
+}
+
+inline void trace_thread(const char* name)
+{
+    trace_buffer()->threadName = name;
+}
+
+// Write out everything recorded so far. Runs by itself at exit.
+inline void trace_write()
+{
+    TraceLog& log = trace_log();
+    std::lock_guard<std::mutex> guard(log.lock);
+
+    const char* path = getenv("TRACE_FILE");
+    if (!path)
+        path = "trace.json";
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        printf("couldn't write trace to %s\n", path);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    long written = 0, dropped = 0;
+    for (size_t t = 0; t < log.buffers.size(); t++) {
+        TraceBuffer* b = log.buffers[t];
+        if (b->threadName) {
+            fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                       "\"args\": {\"name\": \"%s\"}}", written++ ? ",\n" : "", b->tid, b->threadName);
+        }
+        int count = b->count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++) {
+            const TraceEvent& e = b->events[i];
+            fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}",
+                    written++ ? ",\n" : "", e.name ? e.name : "", e.phase, e.ns / 1000.0, b->tid);
+        }
+        dropped += b->dropped;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    printf("wrote %ld trace events to %s", written, path);
+    if (dropped > 0)
+        printf(", dropped %ld past %d per thread", dropped, TRACE_EVENTS);
+    printf("\n");
+}
+
+struct TraceScope {
+    explicit TraceScope(const char* name) { trace_event(name, 'B'); }
+    ~TraceScope() { trace_event(NULL, 'E'); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_BEGIN(name) trace_event(name, 'B')
+#define TRACE_END() trace_event(NULL, 'E')
+#define TRACE_THREAD(name) trace_thread(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_BEGIN(name)
+#define TRACE_END()
+#define TRACE_THREAD(name)
+
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+// Lock-free single producer / single consumer triple buffer.
+//
+// The producer always owns one slot to write into and the consumer one slot
+// to read from. The third slot is handed between them with an atomic
+// exchange, so neither side ever waits for the other. The consumer always
+// gets the most recently published value; values published in between two
+// reads are dropped.
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    // Producer side: the slot to fill before calling publish()
+    T& write_buffer() { return slots[back]; }
+
+    void publish()
+    {
+        back = middle.exchange(back | DIRTY) & INDEX;
+    }
+
+    // Consumer side: picks up the latest published slot if there is one.
+    // Returns whether read_buffer() changed.
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & DIRTY))
+            return false;
+        front = middle.exchange(front) & INDEX;
+        return true;
+    }
+
+    const T& read_buffer() const { return slots[front]; }
+
+private:
+    static const unsigned INDEX = 3;
+    static const unsigned DIRTY = 4;
+
+    T slots[3];
+    std::atomic<unsigned> middle;
+    unsigned back;
+    unsigned front;
+};
+
+#endif
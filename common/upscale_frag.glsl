@@ -0,0 +1,16 @@
+#version 150
+
+in vec2 Texcoord;
+
+out vec4 outColor;
+
+// the scene only fills the bottom left Scale of the source texture, and
+// Limit keeps the bilinear filter from reading past its edge
+uniform sampler2D source;
+uniform vec2 Scale;
+uniform vec2 Limit;
+
+void main()
+{
+    outColor = texture(source, min(Texcoord * Scale, Limit));
+}
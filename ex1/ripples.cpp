@@ -5,9 +5,26 @@
 #include <fstream>
 #include <sstream>
 
-int main()
+#include "../common/alloc_stats.h"
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
+
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+    for (int i = 1; i < argc; i++) {
+        if (!frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency)) {
+            printf("usage: %s " FRAME_PACING_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
@@ -16,13 +33,20 @@ int main()
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
+    TRACE_BEGIN("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(800, 600, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
@@ -44,6 +68,7 @@ int main()
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
     // Loading and compiling the vertex shader
+    TRACE_BEGIN("compile_vertex_shader");
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 
     std::ifstream vf("vert.glsl");
@@ -62,8 +87,10 @@ int main()
     } else {
        printf("vertex shader compilation failed!\n");
     }
+    TRACE_END();
 
     // Loading and compiling the fragment shader
+    TRACE_BEGIN("compile_fragment_shader");
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
     std::ifstream fs("frag.glsl");
@@ -81,6 +108,7 @@ int main()
     } else {
        printf("fragment shader compilation failed!\n");
     }
+    TRACE_END();
 
     // Initializing the shader program
     GLuint shaderProgram = glCreateProgram();
@@ -88,7 +116,9 @@ int main()
     glAttachShader(shaderProgram, fragmentShader);
 
     glBindFragDataLocation(shaderProgram, 0, "outColor");
+    TRACE_BEGIN("glLinkProgram");
     glLinkProgram(shaderProgram);
+    TRACE_END();
     glUseProgram(shaderProgram);
 
     GLint posAttrib = glGetAttribLocation(shaderProgram, "position");
@@ -109,12 +139,22 @@ int main()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);    
 
+    TRACE_END();
+
     while(!glfwWindowShouldClose(window))
     {
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+
+        TRACE_BEGIN("draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        TRACE_END();
+
+        frame_pacing_swap(pacing, window);
+        alloc_stats_frame();
     }
 
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
@@ -6,6 +6,11 @@
 #include <fstream>
 #include <sstream>
 
+#include "../common/alloc_stats.h"
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
+#include "../common/redraw.h"
+
 class GLUint;
 
 void print_compilation_error(unsigned int shader) {
@@ -25,6 +30,8 @@ std::string read_file_to_cstr(const char* filename)
 
 unsigned int compile_fragment_shader()
 {
+    TRACE_SCOPE("compile_fragment_shader");
+
     GLint status;
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -48,6 +55,8 @@ unsigned int compile_fragment_shader()
 
 unsigned int compile_vertex_shader()
 {
+    TRACE_SCOPE("compile_vertex_shader");
+
     GLint status;
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 
@@ -69,9 +78,25 @@ unsigned int compile_vertex_shader()
     return vertexShader;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+    bool onDemand = false;
+    bool damage = false;
+    for (int i = 1; i < argc; i++) {
+        if (!frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency) &&
+            !redraw_arg(argv, i, onDemand, damage)) {
+            printf("usage: %s " FRAME_PACING_USAGE " " REDRAW_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
@@ -80,13 +105,25 @@ int main()
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
+    TRACE_BEGIN("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(800, 800, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
+
+    // redraw binds its framebuffer through the state cache
+    glstate_invalidate();
+    Redraw redraw;
+    redraw_init(redraw, window, 800, 800, onDemand, damage);
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
@@ -124,11 +161,15 @@ int main()
 
     // Load the texture bytes into a buffer
     int width, height;
+    TRACE_BEGIN("SOIL_load_image");
     unsigned char* image = SOIL_load_image("fox.jpg", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
     SOIL_free_image_data(image);
 
     // Compile the shaders
@@ -142,7 +183,9 @@ int main()
 
     // select an output from the fragment shader (unnecessary here since there's only one)
     glBindFragDataLocation(shaderProgram, 0, "outColor");
+    TRACE_BEGIN("glLinkProgram");
     glLinkProgram(shaderProgram);
+    TRACE_END();
     glUseProgram(shaderProgram);
 
     // identify the position attribute in our vertex buffer
@@ -170,12 +213,31 @@ int main()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);    
 
+    TRACE_END();
+
     while(!glfwWindowShouldClose(window))
     {
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // nothing here moves, so on demand this only draws when the window
+        // needs it
+        if (!redraw_wait(redraw))
+            continue;
+
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+
+        redraw_begin(redraw);
+        glClear(GL_COLOR_BUFFER_BIT);
+        TRACE_BEGIN("draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        TRACE_END();
+        redraw_end(redraw);
+
+        frame_pacing_swap(pacing, window);
+        alloc_stats_frame();
     }
 
+    redraw_destroy(redraw);
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
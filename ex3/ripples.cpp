@@ -6,6 +6,10 @@
 #include <fstream>
 #include <sstream>
 
+#include "../common/alloc_stats.h"
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
+
 class GLUint;
 
 void print_compilation_error(unsigned int shader) {
@@ -25,6 +29,8 @@ std::string read_file_to_cstr(const char* filename)
 
 unsigned int compile_fragment_shader()
 {
+    TRACE_SCOPE("compile_fragment_shader");
+
     GLint status;
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -48,6 +54,8 @@ unsigned int compile_fragment_shader()
 
 unsigned int compile_vertex_shader()
 {
+    TRACE_SCOPE("compile_vertex_shader");
+
     GLint status;
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 
@@ -69,9 +77,22 @@ unsigned int compile_vertex_shader()
     return vertexShader;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+    for (int i = 1; i < argc; i++) {
+        if (!frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency)) {
+            printf("usage: %s " FRAME_PACING_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
@@ -80,13 +101,20 @@ int main()
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
+    TRACE_BEGIN("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(800, 800, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
@@ -120,7 +148,9 @@ int main()
 
     // select an output from the fragment shader (unnecessary here since there's only one)
     glBindFragDataLocation(shaderProgram, 0, "outColor");
+    TRACE_BEGIN("glLinkProgram");
     glLinkProgram(shaderProgram);
+    TRACE_END();
     glUseProgram(shaderProgram);
 
     // Set up our textures
@@ -137,7 +167,9 @@ int main()
     // Load the fox texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textures[0]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("fox.jpg", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -149,7 +181,9 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
     SOIL_free_image_data(image);
     glUniform1i(glGetUniformLocation(shaderProgram, "texFox"), 0);
 
@@ -160,7 +194,9 @@ int main()
     // Load the fox texture
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, textures[1]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("husky.png", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -172,7 +208,9 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
     SOIL_free_image_data(image);
     glUniform1i(glGetUniformLocation(shaderProgram, "texCat"), 1);
     
@@ -203,12 +241,22 @@ int main()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);    
 
+    TRACE_END();
+
     while(!glfwWindowShouldClose(window))
     {
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+
+        TRACE_BEGIN("draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        TRACE_END();
+
+        frame_pacing_swap(pacing, window);
+        alloc_stats_frame();
     }
 
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
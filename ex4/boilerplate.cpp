@@ -27,8 +27,9 @@ int main()
 
     while(!glfwWindowShouldClose(window))
     {
-        glfwSwapBuffers(window);
         glfwPollEvents();
+        // update and draw here
+        glfwSwapBuffers(window);
     }
 
     glfwTerminate();
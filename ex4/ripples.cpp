@@ -11,6 +11,12 @@
 #include <fstream>
 #include <sstream>
 
+#include "../common/frame_uniforms.h"
+#include "../common/alloc_stats.h"
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
+#include "../common/redraw.h"
+
 class GLUint;
 
 void print_compilation_error(unsigned int shader) {
@@ -30,6 +36,8 @@ std::string read_file_to_cstr(const char* filename)
 
 unsigned int compile_fragment_shader()
 {
+    TRACE_SCOPE("compile_fragment_shader");
+
     GLint status;
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -53,6 +61,8 @@ unsigned int compile_fragment_shader()
 
 unsigned int compile_vertex_shader()
 {
+    TRACE_SCOPE("compile_vertex_shader");
+
     GLint status;
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 
@@ -74,9 +84,44 @@ unsigned int compile_vertex_shader()
     return vertexShader;
 }
 
-int main()
+// The window pixels [box[0], box[2]) x [box[1], box[3]) the quad's corners
+// fall in under mvp, padded a pixel for rounding
+void quad_window_box(const glm::mat4& mvp, int width, int height, int box[4])
+{
+    float corners[4][2] = { { -0.5f, 0.5f }, { 0.5f, 0.5f }, { 0.5f, -0.5f }, { -0.5f, -0.5f } };
+    float x0 = 1e9f, y0 = 1e9f, x1 = -1e9f, y1 = -1e9f;
+    for (int i = 0; i < 4; i++) {
+        glm::vec4 clip = mvp * glm::vec4(corners[i][0], corners[i][1], 0.0f, 1.0f);
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * height;
+        x0 = std::min(x0, x); y0 = std::min(y0, y);
+        x1 = std::max(x1, x); y1 = std::max(y1, y);
+    }
+    box[0] = (int)floor(x0) - 1;
+    box[1] = (int)floor(y0) - 1;
+    box[2] = (int)ceil(x1) + 1;
+    box[3] = (int)ceil(y1) + 1;
+}
+
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+    bool onDemand = false;
+    bool damage = false;
+    for (int i = 1; i < argc; i++) {
+        if (!frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency) &&
+            !redraw_arg(argv, i, onDemand, damage)) {
+            printf("usage: %s " FRAME_PACING_USAGE " " REDRAW_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
@@ -85,13 +130,26 @@ int main()
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
+    TRACE_BEGIN("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(800, 800, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
+
+    // the frame uniforms bind through the state cache, which starts out
+    // knowing nothing about the context
+    glstate_invalidate();
+    Redraw redraw;
+    redraw_init(redraw, window, 800, 800, onDemand, damage);
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
@@ -125,9 +183,16 @@ int main()
 
     // select an output from the fragment shader (unnecessary here since there's only one)
     glBindFragDataLocation(shaderProgram, 0, "outColor");
+    TRACE_BEGIN("glLinkProgram");
     glLinkProgram(shaderProgram);
+    TRACE_END();
     glUseProgram(shaderProgram);
 
+    // the camera comes from the per frame uniform buffer
+    FrameUniformBuffer frameUniforms;
+    frame_uniforms_init(frameUniforms);
+    frame_uniforms_bind_program(shaderProgram);
+
     // Set up our textures
     GLuint textures[2];
     glGenTextures(2, textures);
@@ -142,7 +207,9 @@ int main()
     // Load the fox texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textures[0]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("fox.jpg", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -154,7 +221,9 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
     SOIL_free_image_data(image);
     glUniform1i(glGetUniformLocation(shaderProgram, "texFox"), 0);
 
@@ -165,7 +234,9 @@ int main()
     // Load the fox texture
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, textures[1]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("husky.png", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -177,7 +248,9 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
     SOIL_free_image_data(image);
     glUniform1i(glGetUniformLocation(shaderProgram, "texCat"), 1);
     
@@ -203,12 +276,8 @@ int main()
         glm::vec3(0.0f, 0.0f, 0.0f),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    GLint uniView = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
-    
     glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 10.0f);
-    GLint uniProj = glGetUniformLocation(shaderProgram, "proj");
-    glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+    frame_uniforms_set_camera(frameUniforms, view, proj);
 
     // Set up the element buffer
     GLuint elements[] = {
@@ -226,8 +295,20 @@ int main()
 
     auto t_start = std::chrono::high_resolution_clock::now();
 
+    TRACE_END();
+
+    // where the quad was last frame, to be cleared from the next
+    int lastBox[4] = { 0, 0, 0, 0 };
+
     while(!glfwWindowShouldClose(window))
     {
+        if (!redraw_wait(redraw))
+            continue;
+
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+
         auto t_now = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
         
@@ -239,13 +320,32 @@ int main()
         glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
 
         glUniform1f(uniFade, (sin(0.5f * time) + 1.0f) / 2.0f);
-        
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        frame_uniforms_update(frameUniforms, time, 800, 800);
+
+        // the quad only ever covers its corners' bounding box on screen, so
+        // that and where it was last frame are all that change
+        int box[4];
+        quad_window_box(frameUniforms.data.viewProj * model, 800, 800, box);
+        redraw_damage(redraw, lastBox[0], lastBox[1], lastBox[2] - lastBox[0], lastBox[3] - lastBox[1]);
+        redraw_damage(redraw, box[0], box[1], box[2] - box[0], box[3] - box[1]);
+        memcpy(lastBox, box, sizeof(box));
+
+        redraw_begin(redraw);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
+        TRACE_BEGIN("draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        TRACE_END();
+        redraw_end(redraw);
+
+        // always moving
+        redraw_animate(redraw, 0.0);
+
+        frame_pacing_swap(pacing, window);
+        alloc_stats_frame();
     }
 
+    redraw_destroy(redraw);
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
@@ -1,20 +1,40 @@
 #version 150
 
+// Compiled per pass with some of these defined, see common/shader_variants.h
+//   REFLECTION      the mirrored cube, darkened by reflectionMultiple
+//   SINGLE_TEXTURE  the fade is all the way to one image, sampled from
+//                   texSingle alone
+
 in vec3 Color;
 in vec2 Texcoord;
 
 out vec4 outColor;
 
+#ifdef SINGLE_TEXTURE
+uniform sampler2D texSingle;
+#else
 uniform sampler2D texFox;
 uniform sampler2D texCat;
 uniform float Fade;
+#endif
+
+#ifdef REFLECTION
 uniform vec3 reflectionMultiple;
+#endif
 
 void main()
 {
+#ifdef SINGLE_TEXTURE
+    vec4 image = texture(texSingle, Texcoord);
+#else
     vec4 colFox = texture(texFox, Texcoord);
     vec4 colCat = texture(texCat, Texcoord);
-    outColor = vec4(reflectionMultiple, 1.0) * vec4(Color, 1.0) * mix(colCat, colFox, Fade);
-}
-
+    vec4 image = mix(colCat, colFox, Fade);
+#endif
 
+#ifdef REFLECTION
+    outColor = vec4(reflectionMultiple, 1.0) * vec4(Color, 1.0) * image;
+#else
+    outColor = vec4(Color, 1.0) * image;
+#endif
+}
@@ -1,5 +1,14 @@
 #define GLM_FORCE_RADIANS
 
+// Most MSAA samples the dynamic resolution mode will use
+#define DYNRES_MAX_SAMPLES 4
+
+// Offline rendering with --farm: frames per second of animation, MSAA
+// samples, and the most workers --bench-farm tries
+#define FARM_FPS 60.0f
+#define FARM_SAMPLES 4
+#define BENCH_FARM_MAX_WORKERS 8
+
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <SOIL/SOIL.h>
@@ -10,73 +19,360 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
 
 class GLUint;
 
-void print_compilation_error(unsigned int shader) {
-    char buffer[512];
-    glGetShaderInfoLog(shader, 512, NULL, buffer);
-    printf("Compilation Error:\n\n%s\n", buffer);
+#include "../common/glstate.h"
+#include "../common/dynres.h"
+#include "../common/frame_uniforms.h"
+#include "../common/alloc_stats.h"
+#include "../common/softraster.h"
+#include "../common/render_farm.h"
+#include "../common/scene.h"
+#include "../common/shader_compile.h"
+#include "../common/shader_variants.h"
+
+// frag.glsl's features, as the bits of a variant's key
+#define CUBE_REFLECTION 1
+#define CUBE_SINGLE_TEXTURE 2
+#define CUBE_VARIANTS 4
+
+// A fade this close to either end shows only the one image, to 8 bits
+#define CUBE_SINGLE_FADE (0.5f / 255.0f)
+
+// Layers of the floor drawn over the whole window per --bench-variants frame
+#define BENCH_VARIANT_LAYERS 40
+#define BENCH_VARIANT_FRAMES 20
+
+// The cube, with its reflection in the floor as a child of it so the mirror
+// follows the cube wherever it turns
+struct CubeScene {
+    SceneStore store;
+    int cube;
+    int reflection;
+};
+
+void cube_scene_init(CubeScene& s)
+{
+    scene_init(s.store, 2);
+    s.cube = scene_add(s.store, -1, glm::mat4());
+    s.reflection = scene_add(s.store, s.cube,
+                             glm::scale(glm::translate(glm::mat4(), glm::vec3(0, 0, -1.05)), glm::vec3(1, 1, -1)));
 }
 
-std::string read_file_to_cstr(const char* filename)
+void cube_scene_update(CubeScene& s, float time)
 {
-    std::ifstream fs(filename);
-    std::stringstream ss;
-    ss << fs.rdbuf();
-    std::string frag = ss.str();
-    return frag;
+    scene_set_local(s.store, s.cube, glm::rotate(glm::mat4(), time*glm::radians(30.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    scene_update(s.store);
 }
 
-unsigned int compile_fragment_shader()
+// The cube's program in each of its variants, each set up the first time a
+// pass needs it
+struct CubePrograms {
+    ShaderVariants variants;
+    GLuint programs[CUBE_VARIANTS];
+    GLint uniModel[CUBE_VARIANTS];
+    GLint uniFade[CUBE_VARIANTS];
+    GLint uniSingle[CUBE_VARIANTS];
+};
+
+const char* cube_features[CUBE_VARIANTS] = { "", "REFLECTION", "SINGLE_TEXTURE", "REFLECTION SINGLE_TEXTURE" };
+
+// With a compiler every variant starts compiling now, so the first pass to
+// need one doesn't wait for all of it
+void cube_programs_init(CubePrograms& c, ShaderCompiler* compiler = NULL)
 {
-    GLint status;
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    shader_variants_init(c.variants, "vert.glsl", "frag.glsl", "position color texcoord", compiler);
+    for (int i = 0; i < CUBE_VARIANTS; i++) {
+        c.programs[i] = 0;
+        shader_variant_submit(c.variants, cube_features[i]);
+    }
+}
 
-    std::string frag = read_file_to_cstr("frag.glsl");
-    const char* frag_src = frag.c_str();
+GLuint cube_program(CubePrograms& c, int key)
+{
+    if (!c.programs[key]) {
+        GLuint program = shader_variant(c.variants, cube_features[key]);
+        glstate_use_program(program);
+        frame_uniforms_bind_program(program);
+        glUniform1i(glGetUniformLocation(program, "texFox"), 0);
+        glUniform1i(glGetUniformLocation(program, "texCat"), 1);
+        glUniform3f(glGetUniformLocation(program, "reflectionMultiple"), 0.3f, 0.3f, 0.3f);
+        c.uniModel[key] = glGetUniformLocation(program, "model");
+        c.uniFade[key] = glGetUniformLocation(program, "Fade");
+        c.uniSingle[key] = glGetUniformLocation(program, "texSingle");
+        c.programs[key] = program;
+    }
+    return c.programs[key];
+}
 
-    glShaderSource(fragmentShader, 1, &frag_src, NULL);
-    glCompileShader(fragmentShader);
+// Which variant draws a pass for the least: only the reflection is darkened,
+// and once the fade has gone all the way to one image there's no need to
+// sample the other
+int cube_variant(bool reflection, float fade)
+{
+    int key = reflection ? CUBE_REFLECTION : 0;
+    if (fade < CUBE_SINGLE_FADE || fade > 1.0f - CUBE_SINGLE_FADE)
+        key |= CUBE_SINGLE_TEXTURE;
+    return key;
+}
 
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &status);
-    if (status == GL_TRUE) {
-        printf("compiled fragment shader\n"); 
+// Switch to the cheapest variant for a pass and give it the pass's uniforms
+void cube_use(CubePrograms& c, bool reflection, float fade, const glm::mat4& model)
+{
+    int key = cube_variant(reflection, fade);
+    glstate_use_program(cube_program(c, key));
+    glUniformMatrix4fv(c.uniModel[key], 1, GL_FALSE, glm::value_ptr(model));
+    if (key & CUBE_SINGLE_TEXTURE) {
+        // mix(cat, fox, fade): the fox is on unit 0
+        glUniform1i(c.uniSingle[key], fade > 0.5f ? 0 : 1);
     } else {
-        printf("fragment shader compilation failed!\n");
-        print_compilation_error(fragmentShader);
-        exit(1);
+        glUniform1f(c.uniFade[key], fade);
     }
+}
 
-    return fragmentShader;
+void cube_programs_destroy(CubePrograms& c)
+{
+    shader_variants_destroy(c.variants);
 }
 
-unsigned int compile_vertex_shader()
+// Time every variant drawing the floor over the whole window, layer upon
+// layer, so the frame is all fragment work
+void bench_variants(CubePrograms& c, FrameUniformBuffer& frameUniforms)
 {
-    GLint status;
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    // the floor is 2 x 2 at z = -0.5, which fills clip space as it is
+    frame_uniforms_set_camera(frameUniforms, glm::mat4(), glm::mat4());
+    frame_uniforms_update(frameUniforms, 0.0f, 800, 800);
+    glstate_disable(GL_DEPTH_TEST);
+    glstate_viewport(0, 0, 800, 800);
+
+    float reference = 0.0f;
+    for (int key = 0; key < CUBE_VARIANTS; key++) {
+        glstate_use_program(cube_program(c, key));
+        glUniformMatrix4fv(c.uniModel[key], 1, GL_FALSE, glm::value_ptr(glm::mat4()));
+        glUniform1f(c.uniFade[key], 0.5f);
+        glUniform1i(c.uniSingle[key], 0);
+
+        float total = 0.0f;
+        for (int frame = -2; frame < BENCH_VARIANT_FRAMES; frame++) {
+            glClear(GL_COLOR_BUFFER_BIT);
+            glFinish();
+            auto t_start = std::chrono::high_resolution_clock::now();
+            for (int layer = 0; layer < BENCH_VARIANT_LAYERS; layer++) {
+                glDrawArrays(GL_TRIANGLES, 36, 6);
+            }
+            glFinish();
+            auto t_done = std::chrono::high_resolution_clock::now();
+            if (frame >= 0)
+                total += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+        }
+        float ms = total / BENCH_VARIANT_FRAMES;
+        if (key == 0)
+            reference = ms;
+        float ns = 1e6f * ms / (BENCH_VARIANT_LAYERS * 800.0f * 800.0f);
+        printf("%-28s %7.2f ms per frame, %6.3f ns per fragment (%.2fx the general one)\n",
+               key ? cube_features[key] : "(general)", ms, ns, reference / ms);
+    }
+    glstate_enable(GL_DEPTH_TEST);
+}
 
-    std::string vert = read_file_to_cstr("vert.glsl");
-    const char* vert_src = vert.c_str();
+// vert.glsl and frag.glsl for the software rasterizer
+struct SoftCubeShader {
+    static const int VARYINGS = 5;  // Color, Texcoord
 
-    glShaderSource(vertexShader, 1, &vert_src, NULL);
-    glCompileShader(vertexShader);
+    glm::mat4 mvp;                  // viewProj * model
+    const float* vertices;          // position, color, texcoord
+    const SoftTexture* texFox;
+    const SoftTexture* texCat;
+    float fade;
+    glm::vec3 reflectionMultiple;
 
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &status);
-    if (status == GL_TRUE) {
-        printf("compiled vertex shader\n"); 
-    } else {
-        printf("vertex shader compilation failed!\n");
-        print_compilation_error(vertexShader);
-        exit(1);
+    void vertex(int index, SoftVertex& out) const
+    {
+        const float* v = vertices + 8 * index;
+        out.position = mvp * glm::vec4(v[0], v[1], v[2], 1.0f);
+        for (int i = 0; i < VARYINGS; i++)
+            out.varyings[i] = v[3 + i];
     }
 
-    return vertexShader;
-}
+    glm::vec4 fragment(const float* varyings) const
+    {
+        glm::vec3 color(varyings[0], varyings[1], varyings[2]);
+        glm::vec2 texcoord(varyings[3], varyings[4]);
+        glm::vec4 colFox = soft_texture_sample(*texFox, texcoord);
+        glm::vec4 colCat = soft_texture_sample(*texCat, texcoord);
+        return glm::vec4(reflectionMultiple * color, 1.0f) * (colCat + (colFox - colCat) * fade);
+    }
+};
+
+// The cube and its reflection for --farm, drawn as in the main loop
+struct CubeFarmScene {
+    const float* vertices;          // position, color, texcoord, 42 of them
+    const unsigned char* images[2]; // fox, cat, RGB
+    int widths[2];
+    int heights[2];
+
+    CubePrograms programs;
+    GLuint vao;
+    GLuint vbo;
+    GLuint textures[2];
+    FrameUniformBuffer frameUniforms;
+    CubeScene cubeScene;
+
+    void init()
+    {
+        cube_scene_init(cubeScene);
+
+        frame_uniforms_init(frameUniforms);
+        cube_programs_init(programs);
+        GLuint program = cube_program(programs, 0);
+        glm::mat4 view = glm::lookAt(
+            glm::vec3(3.0f, 3.0f, 1.4f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f)
+        );
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 10.0f);
+        frame_uniforms_set_camera(frameUniforms, view, proj);
+
+        glGenVertexArrays(1, &vao);
+        glstate_bind_vertex_array(vao);
+        glGenBuffers(1, &vbo);
+        glstate_bind_buffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, 42 * 8 * sizeof(float), vertices, GL_STATIC_DRAW);
+        GLint posAttrib = glGetAttribLocation(program, "position");
+        glEnableVertexAttribArray(posAttrib);
+        glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), 0);
+        GLint colAttrib = glGetAttribLocation(program, "color");
+        glEnableVertexAttribArray(colAttrib);
+        glVertexAttribPointer(colAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
+        GLint texAttrib = glGetAttribLocation(program, "texcoord");
+        glEnableVertexAttribArray(texAttrib);
+        glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
+
+        glGenTextures(2, textures);
+        for (int i = 0; i < 2; i++) {
+            glstate_bind_texture(i, GL_TEXTURE_2D, textures[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, widths[i], heights[i], 0, GL_RGB, GL_UNSIGNED_BYTE, images[i]);
+        }
+        glstate_enable(GL_DEPTH_TEST);
+    }
+
+    void advance(int, float)
+    {
+    }
+
+    void draw(int, float time)
+    {
+        glstate_bind_vertex_array(vao);
+
+        cube_scene_update(cubeScene, time);
+        float fade = (sin(0.5f * time) + 1.0f) / 2.0f;
+        cube_use(programs, false, fade, scene_world(cubeScene.store, cubeScene.cube));
+        frame_uniforms_update(frameUniforms, time, 800, 800);
+
+        glstate_clear_color(0.9f, 0.9f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
 
-int main()
+        glstate_enable(GL_STENCIL_TEST);
+        glstate_stencil_func(GL_ALWAYS, 1, 0xFF);
+        glstate_stencil_op(GL_KEEP, GL_KEEP, GL_REPLACE);
+        glstate_stencil_mask(0xFF);
+        glClear(GL_STENCIL_BUFFER_BIT);
+
+        glstate_depth_mask(GL_FALSE);
+        glDrawArrays(GL_TRIANGLES, 36, 6);
+        glstate_depth_mask(GL_TRUE);
+
+        glstate_stencil_func(GL_EQUAL, 1, 0xFF);
+        glstate_stencil_mask(0x00);
+        cube_use(programs, true, fade, scene_world(cubeScene.store, cubeScene.reflection));
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glstate_disable(GL_STENCIL_TEST);
+    }
+
+    void destroy()
+    {
+        frame_uniforms_destroy(frameUniforms);
+        glstate_delete_textures(2, textures);
+        glstate_delete_buffers(1, &vbo);
+        glstate_delete_vertex_arrays(1, &vao);
+        cube_programs_destroy(programs);
+    }
+};
+
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    float budget = 0.0f;
+    int maxSamples = DYNRES_MAX_SAMPLES;
+    bool stats = false;
+    bool soft = false;
+    int softThreads = std::max(1u, std::thread::hardware_concurrency());
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+    int farmFrames = 0;
+    int farmWorkers = std::max(1u, std::thread::hardware_concurrency());
+    int benchFarmFrames = 0;
+    const char* captureDir = NULL;
+    bool capturePng = false;
+    bool benchVariants = false;
+    int shaderWorkers = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-samples") == 0 && i + 1 < argc) {
+            maxSamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--soft") == 0) {
+            soft = true;
+        } else if (strcmp(argv[i], "--soft-threads") == 0 && i + 1 < argc) {
+            softThreads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--farm") == 0 && i + 1 < argc) {
+            farmFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--farm-workers") == 0 && i + 1 < argc) {
+            farmWorkers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bench-farm") == 0 && i + 1 < argc) {
+            benchFarmFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            captureDir = argv[++i];
+        } else if (strcmp(argv[i], "--png") == 0) {
+            capturePng = true;
+        } else if (strcmp(argv[i], "--bench-variants") == 0) {
+            benchVariants = true;
+        } else if (!shader_compile_arg(argc, argv, i, shaderWorkers) &&
+                   !frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency)) {
+            printf("usage: %s [--budget MS [--max-samples N]] [--stats] [--soft [--soft-threads N]]\n"
+                   "       [--farm FRAMES [--farm-workers K] [--capture DIR [--png]]] [--bench-farm FRAMES]\n"
+                   "       [--bench-variants] " SHADER_COMPILE_USAGE "\n"
+                   "       " FRAME_PACING_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+    if (captureDir && farmFrames == 0) {
+        printf("--capture only goes with --farm\n");
+        return 1;
+    }
+    if (soft && budget > 0.0f) {
+        printf("--soft can't be combined with --budget\n");
+        return 1;
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
@@ -84,20 +380,46 @@ int main()
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    if (farmFrames > 0 || benchFarmFrames > 0) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    }
 
+    TRACE_BEGIN("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(800, 800, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
+
+    // State changes go through a cache that drops the redundant ones. It
+    // starts out knowing nothing about the context.
+    glstate_invalidate();
+
+    // Every program is submitted before anything else is set up, and
+    // waited for where it's first used (see common/shader_compile.h)
+    ShaderCompiler compiler;
+    shader_compile_init(compiler, window, shaderWorkers);
+    ShaderCompileGuard compilerGuard(compiler);
+    int upscaleJob = -1;
+    if (budget > 0.0f) {
+        upscaleJob = shader_compile_files(compiler, "../common/upscale_vert.glsl", "../common/upscale_frag.glsl", "");
+    }
+    CubePrograms programs;
+    cube_programs_init(programs, &compiler);
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
     GLuint vao;
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glstate_bind_vertex_array(vao);
  
     float vertices[] = {
         //Position          //Color           //Texcoords
@@ -169,26 +491,22 @@ int main()
     // Set up the main vertex buffer
     GLuint vertexBuffer;
     glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, vertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    // Compile the shaders
-    GLuint fragmentShader = compile_fragment_shader();
-    GLuint vertexShader = compile_vertex_shader();
- 
-    // Initializing the shader program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
+    // the camera comes from the per frame uniform buffer
+    FrameUniformBuffer frameUniforms;
+    frame_uniforms_init(frameUniforms);
 
-    // select an output from the fragment shader (unnecessary here since there's only one)
-    glBindFragDataLocation(shaderProgram, 0, "outColor");
-    glLinkProgram(shaderProgram);
-    glUseProgram(shaderProgram);
+    // The program for the plain passes now, the other variants when a pass
+    // first needs one
+    GLuint shaderProgram = cube_program(programs, 0);
+    glstate_use_program(shaderProgram);
 
     // Set up our textures
     GLuint textures[2];
     glGenTextures(2, textures);
+    SoftTexture softTextures[2];
 
     int width, height;
     unsigned char* image;
@@ -198,9 +516,10 @@ int main()
     ////////////////////////////////////////////
     
     // Load the fox texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glstate_bind_texture(0, GL_TEXTURE_2D, textures[0]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("fox.jpg", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -212,18 +531,23 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
+    if (soft) {
+        soft_texture_rgb8(softTextures[0], image, width, height, true);
+    }
     SOIL_free_image_data(image);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texFox"), 0);
 
     ////////////////////////////////////////////
     ///////////////// CAT //////////////////////
     ////////////////////////////////////////////    
 
     // Load the fox texture
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    glstate_bind_texture(1, GL_TEXTURE_2D, textures[1]);
+    TRACE_BEGIN("SOIL_load_image");
     image = SOIL_load_image("husky.png", &width, &height, 0, SOIL_LOAD_RGB);
+    TRACE_END();
     printf("Loaded texture: %ipx, %ipx\n", width, height);
 
     // Just repeat the image if the coords are > 1.0 or < 0.0
@@ -235,9 +559,13 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Fill the texture buffer with the image bytes
+    TRACE_BEGIN("glTexImage2D");
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    TRACE_END();
+    if (soft) {
+        soft_texture_rgb8(softTextures[1], image, width, height, true);
+    }
     SOIL_free_image_data(image);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texCat"), 1);
     
     //////////////////////////////////////////////////////////
 
@@ -261,68 +589,210 @@ int main()
         glm::vec3(0.0f, 0.0f, 0.0f),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    GLint uniView = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
-    
     glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 10.0f);
-    GLint uniProj = glGetUniformLocation(shaderProgram, "proj");
-    glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+    frame_uniforms_set_camera(frameUniforms, view, proj);
 
-    GLint uniModel = glGetUniformLocation(shaderProgram, "model");
-    GLint uniFade = glGetUniformLocation(shaderProgram, "Fade");
-    GLint uniReflection = glGetUniformLocation(shaderProgram, "reflectionMultiple");
+    if (benchVariants) {
+        bench_variants(programs, frameUniforms);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+
+    CubeScene cubeScene;
+    cube_scene_init(cubeScene);
+
+    // --farm renders offline, into captureDir if there is one, instead of
+    // opening the window
+    if (farmFrames > 0 || benchFarmFrames > 0) {
+        CubeFarmScene scene;
+        scene.vertices = vertices;
+        scene.images[0] = SOIL_load_image("fox.jpg", &scene.widths[0], &scene.heights[0], 0, SOIL_LOAD_RGB);
+        scene.images[1] = SOIL_load_image("husky.png", &scene.widths[1], &scene.heights[1], 0, SOIL_LOAD_RGB);
+        if (farmFrames > 0) {
+            RenderFarm farm;
+            render_farm_init(farm, 800, 800, FARM_SAMPLES, farmFrames, FARM_FPS, captureDir, capturePng);
+            render_farm_run(farm, scene, farmWorkers);
+            printf("rendered %d frames on %d workers in %.2f s, %.1f frames per second\n",
+                   farmFrames, farmWorkers, farm.seconds, farmFrames / farm.seconds);
+        } else {
+            render_farm_bench(scene, 800, 800, FARM_SAMPLES, benchFarmFrames, FARM_FPS,
+                              std::min(BENCH_FARM_MAX_WORKERS, std::max(4, (int)std::thread::hardware_concurrency())));
+        }
+        SOIL_free_image_data((unsigned char*)scene.images[0]);
+        SOIL_free_image_data((unsigned char*)scene.images[1]);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
 
 
-    glEnable(GL_DEPTH_TEST);
+    glstate_enable(GL_DEPTH_TEST);
+
+    // With --budget the scene is rendered offscreen at whatever resolution
+    // keeps the GPU time per frame under budget milliseconds
+    DynRes dynres;
+    float lastDynresReport = 0.0f;
+    if (budget > 0.0f) {
+        GLuint upscaleProgram = shader_compile_program(compiler, upscaleJob);
+        dynres_init(dynres, 800, 800, budget, maxSamples, upscaleProgram);
+        glstate_use_program(shaderProgram);
+    }
+
+    // With --soft the scene is drawn on the CPU, and the finished frame is
+    // just copied into the window
+    SoftRenderer softRenderer;
+    SoftCubeShader cubeShader;
+    if (soft) {
+        soft_init(softRenderer, 800, 800, softThreads);
+        softRenderer.state.depthTest = true;
+        cubeShader.vertices = vertices;
+        cubeShader.texFox = &softTextures[0];
+        cubeShader.texCat = &softTextures[1];
+        printf("drawing in software on %d threads\n", softThreads);
+    }
 
     auto t_start = std::chrono::high_resolution_clock::now();
 
+    // state call counts for --stats
+    float lastStats = 0.0f;
+    long stateIssued = 0;
+    long stateFiltered = 0;
+    int statFrames = 0;
+
+    // the variants no pass has needed yet are still compiling
+    shader_compile_report(compiler);
+
+    TRACE_END();
 
     while(!glfwWindowShouldClose(window))
     {
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+
         auto t_now = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
 
-        glm::mat4 model;
-        model = glm::rotate(model, time*glm::radians(30.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        cube_scene_update(cubeScene, time);
+        const glm::mat4& model = scene_world(cubeScene.store, cubeScene.cube);
+        const glm::mat4& reflected = scene_world(cubeScene.store, cubeScene.reflection);
+        float fade = (sin(0.5f * time) + 1.0f) / 2.0f;
         
-        glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-
-        glUniform1f(uniFade, (sin(0.5f * time) + 1.0f) / 2.0f);
+        if (budget > 0.0f) {
+            dynres_begin(dynres);
+            if (time - lastDynresReport >= 1.0f) {
+                char status[256];
+                dynres_status(dynres, status, sizeof(status));
+                printf("%s\n", status);
+                glfwSetWindowTitle(window, status);
+                lastDynresReport = time;
+            }
+            frame_uniforms_update(frameUniforms, time, dynres.renderWidth, dynres.renderHeight);
+        } else {
+            frame_uniforms_update(frameUniforms, time, 800, 800);
+        }
         
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        TRACE_BEGIN("draw");
+        if (soft) {
+            // the same steps as below
+            SoftState& state = softRenderer.state;
+            cubeShader.mvp = frameUniforms.data.viewProj * model;
+            cubeShader.fade = fade;
+            cubeShader.reflectionMultiple = glm::vec3(1.0f, 1.0f, 1.0f);
+            soft_clear(softRenderer, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(0.9f, 0.9f, 1.0f, 1.0f));
+            soft_draw_arrays(softRenderer, cubeShader, 0, 36);
+
+            state.stencilTest = true;
+            state.stencilFunc = GL_ALWAYS;
+            state.stencilRef = 1;
+            state.stencilFuncMask = 0xff;
+            state.stencilFail = state.stencilDepthFail = GL_KEEP;
+            state.stencilPass = GL_REPLACE;
+            state.stencilWriteMask = 0xff;
+            soft_clear(softRenderer, GL_STENCIL_BUFFER_BIT, glm::vec4(0.0f));
+
+            state.depthWrite = false;
+            soft_draw_arrays(softRenderer, cubeShader, 36, 6);
+            state.depthWrite = true;
+
+            state.stencilFunc = GL_EQUAL;
+            state.stencilWriteMask = 0x00;
+            cubeShader.reflectionMultiple = glm::vec3(0.3f, 0.3f, 0.3f);
+            cubeShader.mvp = frameUniforms.data.viewProj * reflected;
+            soft_draw_arrays(softRenderer, cubeShader, 0, 36);
+            state.stencilTest = false;
+
+            soft_present(softRenderer);
+            TRACE_END();
+        } else {
+            glstate_clear_color(0.9f, 0.9f, 1.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
-        glClearColor(0.9f, 0.9f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            // draw the cube
+            cube_use(programs, false, fade, model);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
         
-        // draw the cube
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        
-        // draw the floor, writing to the stencil buffer in the process
-        glEnable(GL_STENCIL_TEST);
-        glStencilFunc(GL_ALWAYS, 1, 0xFF);
-        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-        glStencilMask(0xFF);
-        glClear(GL_STENCIL_BUFFER_BIT);
+            // draw the floor, writing to the stencil buffer in the process
+            glstate_enable(GL_STENCIL_TEST);
+            glstate_stencil_func(GL_ALWAYS, 1, 0xFF);
+            glstate_stencil_op(GL_KEEP, GL_KEEP, GL_REPLACE);
+            glstate_stencil_mask(0xFF);
+            glClear(GL_STENCIL_BUFFER_BIT);
  
-        // don't write to the depth buffer so that the reflection still draws
-        glDepthMask(GL_FALSE);
-        glDrawArrays(GL_TRIANGLES, 36, 6);
-        glDepthMask(GL_TRUE);
+            // don't write to the depth buffer so that the reflection still draws
+            glstate_depth_mask(GL_FALSE);
+            glDrawArrays(GL_TRIANGLES, 36, 6);
+            glstate_depth_mask(GL_TRUE);
                 
-        // draw the reflected cube
-        glStencilFunc(GL_EQUAL, 1, 0xFF);
-        glStencilMask(0x00);
-        // attenuate the color
-        glUniform3f(uniReflection, 0.3f, 0.3f, 0.3f);        
-        model = glm::scale( glm::translate(model, glm::vec3(0, 0, -1.05)), glm::vec3(1, 1, -1));
-        glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glUniform3f(uniReflection, 1.0f, 1.0f, 1.0f);
-        glDisable(GL_STENCIL_TEST);
-        
+            // draw the reflected cube
+            glstate_stencil_func(GL_EQUAL, 1, 0xFF);
+            glstate_stencil_mask(0x00);
+            // with the variant that attenuates the color
+            cube_use(programs, true, fade, reflected);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glstate_disable(GL_STENCIL_TEST);
+            TRACE_END();
+
+            if (budget > 0.0f) {
+                // the upscale leaves its own program, vertex array and texture
+                // bound, put ours back
+                TRACE_BEGIN("dynres_end");
+                dynres_end(dynres);
+                TRACE_END();
+                glstate_use_program(shaderProgram);
+                glstate_bind_vertex_array(vao);
+                glstate_bind_texture(0, GL_TEXTURE_2D, textures[0]);
+            }
+        }
+
+        frame_pacing_swap(pacing, window);
+        glstate_frame();
+        alloc_stats_frame();
+
+        if (stats) {
+            stateIssued += glstate().frameIssued;
+            stateFiltered += glstate().frameFiltered;
+            statFrames++;
+            if (time - lastStats >= 1.0f) {
+                printf("%.1f fps, state calls per frame %.1f issued, %.1f filtered\n",
+                       statFrames / (time - lastStats),
+                       (float)stateIssued / statFrames, (float)stateFiltered / statFrames);
+                lastStats = time;
+                stateIssued = stateFiltered = 0;
+                statFrames = 0;
+            }
+        }
+    }
+
+    if (budget > 0.0f) {
+        dynres_destroy(dynres);
+    }
+    if (soft) {
+        soft_destroy(softRenderer);
     }
 
+    shader_compile_destroy(compiler);
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
@@ -8,14 +8,21 @@ out vec3 Color;
 out vec2 Texcoord;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+
+// shared by every program, see common/frame_uniforms.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 viewport;
+    float time;
+};
 
 void main()
 {
     Texcoord = texcoord;
     Color = color;
-    gl_Position = proj * view * model * vec4(position, 1.0);
+    gl_Position = viewProj * model * vec4(position, 1.0);
 }
 
 
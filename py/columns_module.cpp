@@ -0,0 +1,350 @@
+// The C++ column simulation (common/columns.h) as a Python extension.
+//
+//     import columns, numpy as np
+//     sim = columns.Columns(4096, 4096, k=0.0005, dashpot=0.002, neighbor_k=0.2)
+//     heights = np.asarray(sim.heights)   # (height, width) float32, no copy
+//     sim.drop(2048, 2048, 50, 1.5)
+//     sim.step(10)                        # runs without holding the GIL
+//
+// heights and velocities are memoryviews straight onto the simulation's own
+// arrays, so NumPy (or anything else that speaks the buffer protocol) reads
+// and writes the live state without copying it. Each view keeps the
+// simulation alive, and while any view exists the simulation can't be
+// re-initialized out from under it.
+//
+// Since step() lets go of the GIL, other Python threads keep running while
+// it works; reading the arrays from one of them during a step sees the
+// state partway through. Anything that would change the simulation itself,
+// another step(), a drop() or re-initializing it, raises RuntimeError until
+// the step is done.
+//
+// Builds for Python 2.7 and 3, see the Makefile.
+
+#include <Python.h>
+#include <new>
+
+#include "../common/columns.h"
+
+#if PY_MAJOR_VERSION < 3
+#define COLUMNS_TPFLAGS (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER)
+#else
+#define COLUMNS_TPFLAGS Py_TPFLAGS_DEFAULT
+#endif
+
+struct ColumnsObject {
+    PyObject_HEAD
+    Columns c;
+    bool initialized;
+    bool stepping;      // in step() with the GIL released
+    int exports;        // buffers handed out and not yet released
+};
+
+// One of a simulation's arrays, as a buffer
+struct ColumnsArrayObject {
+    PyObject_HEAD
+    ColumnsObject* owner;
+    bool velocities;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+};
+
+static PyTypeObject ColumnsType = { PyVarObject_HEAD_INIT(NULL, 0) "columns.Columns" };
+static PyTypeObject ColumnsArrayType = { PyVarObject_HEAD_INIT(NULL, 0) "columns.ColumnsArray" };
+
+////////////////////////////////////////////
+//////////////// ARRAYS ////////////////////
+////////////////////////////////////////////
+
+static int columns_array_getbuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    ColumnsArrayObject* a = (ColumnsArrayObject*)self;
+    Columns& c = a->owner->c;
+    float* data = a->velocities ? c.velocities.data() : c.heights.data();
+
+    view->buf = data;
+    view->obj = self;
+    Py_INCREF(self);
+    view->len = c.width * c.height * sizeof(float);
+    view->readonly = 0;
+    view->itemsize = sizeof(float);
+    view->format = (flags & PyBUF_FORMAT) ? (char*)"f" : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? a->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? a->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    a->owner->exports++;
+    return 0;
+}
+
+static void columns_array_releasebuffer(PyObject* self, Py_buffer*)
+{
+    ((ColumnsArrayObject*)self)->owner->exports--;
+}
+
+static void columns_array_dealloc(PyObject* self)
+{
+    Py_DECREF(((ColumnsArrayObject*)self)->owner);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs columns_array_buffer;
+
+// A memoryview of one of `owner`'s arrays
+static PyObject* columns_array_view(ColumnsObject* owner, bool velocities)
+{
+    if (!owner->initialized) {
+        PyErr_SetString(PyExc_ValueError, "Columns isn't initialized");
+        return NULL;
+    }
+
+    ColumnsArrayObject* a = PyObject_New(ColumnsArrayObject, &ColumnsArrayType);
+    if (!a)
+        return NULL;
+    Py_INCREF(owner);
+    a->owner = owner;
+    a->velocities = velocities;
+    a->shape[0] = owner->c.height;
+    a->shape[1] = owner->c.width;
+    a->strides[0] = owner->c.width * sizeof(float);
+    a->strides[1] = sizeof(float);
+
+    // the memoryview holds on to the array, and the array to its owner
+    PyObject* view = PyMemoryView_FromObject((PyObject*)a);
+    Py_DECREF(a);
+    return view;
+}
+
+////////////////////////////////////////////
+//////////////// COLUMNS ///////////////////
+////////////////////////////////////////////
+
+// False (with RuntimeError set) if another thread is stepping `s`. Only
+// ever called holding the GIL, which is what makes the flag safe to test.
+static bool columns_check_idle(ColumnsObject* s)
+{
+    if (s->stepping) {
+        PyErr_SetString(PyExc_RuntimeError, "Columns is being stepped by another thread");
+        return false;
+    }
+    return true;
+}
+
+static PyObject* columns_new(PyTypeObject* type, PyObject*, PyObject*)
+{
+    ColumnsObject* self = (ColumnsObject*)type->tp_alloc(type, 0);
+    if (!self)
+        return NULL;
+    new (&self->c) Columns();
+    self->initialized = false;
+    self->stepping = false;
+    self->exports = 0;
+    return (PyObject*)self;
+}
+
+static void columns_dealloc(PyObject* self)
+{
+    ((ColumnsObject*)self)->c.~Columns();
+    Py_TYPE(self)->tp_free(self);
+}
+
+static int columns_init_object(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    ColumnsObject* s = (ColumnsObject*)self;
+    int width, height = 1;
+    float k = 0.0f, dashpot = 0.0f, neighborK = 0.0f;
+    static const char* keywords[] = { "width", "height", "k", "dashpot", "neighbor_k", NULL };
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|ifff", (char**)keywords,
+                                     &width, &height, &k, &dashpot, &neighborK))
+        return -1;
+
+    if (width < 1 || height < 1) {
+        PyErr_SetString(PyExc_ValueError, "width and height have to be at least 1");
+        return -1;
+    }
+    if (!columns_check_idle(s))
+        return -1;
+    if (s->exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "can't re-initialize Columns while its arrays are in use");
+        return -1;
+    }
+
+    try {
+        columns_init(s->c, width, height, k, dashpot, neighborK);
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    s->initialized = true;
+    return 0;
+}
+
+static PyObject* columns_step_method(PyObject* self, PyObject* args)
+{
+    ColumnsObject* s = (ColumnsObject*)self;
+    int steps = 1;
+    if (!PyArg_ParseTuple(args, "|i", &steps))
+        return NULL;
+    if (!s->initialized) {
+        PyErr_SetString(PyExc_ValueError, "Columns isn't initialized");
+        return NULL;
+    }
+
+    if (!columns_check_idle(s))
+        return NULL;
+
+    // nothing in here touches a Python object
+    s->stepping = true;
+    Py_BEGIN_ALLOW_THREADS
+    for (int i = 0; i < steps; i++)
+        columns_step(s->c);
+    Py_END_ALLOW_THREADS
+    s->stepping = false;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* columns_drop_method(PyObject* self, PyObject* args)
+{
+    ColumnsObject* s = (ColumnsObject*)self;
+    float x, y, radius, amount;
+    if (!PyArg_ParseTuple(args, "ffff", &x, &y, &radius, &amount))
+        return NULL;
+    if (!s->initialized) {
+        PyErr_SetString(PyExc_ValueError, "Columns isn't initialized");
+        return NULL;
+    }
+    if (!columns_check_idle(s))
+        return NULL;
+    columns_drop(s->c, x, y, radius, amount);
+    Py_RETURN_NONE;
+}
+
+static PyObject* columns_get_heights(PyObject* self, void*)
+{
+    return columns_array_view((ColumnsObject*)self, false);
+}
+
+static PyObject* columns_get_velocities(PyObject* self, void*)
+{
+    return columns_array_view((ColumnsObject*)self, true);
+}
+
+static PyObject* columns_get_width(PyObject* self, void*)
+{
+    return PyLong_FromLong(((ColumnsObject*)self)->c.width);
+}
+
+static PyObject* columns_get_height(PyObject* self, void*)
+{
+    return PyLong_FromLong(((ColumnsObject*)self)->c.height);
+}
+
+// k, dashpot and neighbor_k can be changed as it runs, `closure` says which
+static float* columns_constant(PyObject* self, void* closure)
+{
+    Columns& c = ((ColumnsObject*)self)->c;
+    switch ((size_t)closure) {
+    case 0: return &c.k;
+    case 1: return &c.dashpot;
+    default: return &c.neighborK;
+    }
+}
+
+static PyObject* columns_get_constant(PyObject* self, void* closure)
+{
+    return PyFloat_FromDouble(*columns_constant(self, closure));
+}
+
+static int columns_set_constant(PyObject* self, PyObject* value, void* closure)
+{
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError, "can't delete a spring constant");
+        return -1;
+    }
+    double v = PyFloat_AsDouble(value);
+    if (v == -1.0 && PyErr_Occurred())
+        return -1;
+    *columns_constant(self, closure) = v;
+    return 0;
+}
+
+static PyMethodDef columns_methods[] = {
+    { "step", columns_step_method, METH_VARARGS,
+      "step(n=1): advance n steps, without holding the GIL" },
+    { "drop", columns_drop_method, METH_VARARGS,
+      "drop(x, y, radius, amount): add a smooth bump centered on column (x, y)" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef columns_getset[] = {
+    { (char*)"heights", columns_get_heights, NULL, (char*)"heights, a (height, width) float32 view", NULL },
+    { (char*)"velocities", columns_get_velocities, NULL, (char*)"velocities, a (height, width) float32 view", NULL },
+    { (char*)"width", columns_get_width, NULL, (char*)"columns per row", NULL },
+    { (char*)"height", columns_get_height, NULL, (char*)"rows", NULL },
+    { (char*)"k", columns_get_constant, columns_set_constant, (char*)"spring constant", (void*)0 },
+    { (char*)"dashpot", columns_get_constant, columns_set_constant, (char*)"damping", (void*)1 },
+    { (char*)"neighbor_k", columns_get_constant, columns_set_constant, (char*)"neighbor spring constant", (void*)2 },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+////////////////////////////////////////////
+//////////////// MODULE ////////////////////
+////////////////////////////////////////////
+
+static bool columns_ready_types()
+{
+    ColumnsType.tp_basicsize = sizeof(ColumnsObject);
+    ColumnsType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ColumnsType.tp_doc = "Columns(width, height=1, k=0, dashpot=0, neighbor_k=0)\n\n"
+                         "A width x height grid of columns on springs, as in py/ripples.py.";
+    ColumnsType.tp_new = columns_new;
+    ColumnsType.tp_init = columns_init_object;
+    ColumnsType.tp_dealloc = columns_dealloc;
+    ColumnsType.tp_methods = columns_methods;
+    ColumnsType.tp_getset = columns_getset;
+
+    columns_array_buffer.bf_getbuffer = columns_array_getbuffer;
+    columns_array_buffer.bf_releasebuffer = columns_array_releasebuffer;
+    ColumnsArrayType.tp_basicsize = sizeof(ColumnsArrayObject);
+    ColumnsArrayType.tp_flags = COLUMNS_TPFLAGS;
+    ColumnsArrayType.tp_doc = "One of a Columns' arrays, exported through the buffer protocol";
+    ColumnsArrayType.tp_dealloc = columns_array_dealloc;
+    ColumnsArrayType.tp_as_buffer = &columns_array_buffer;
+
+    return PyType_Ready(&ColumnsType) == 0 && PyType_Ready(&ColumnsArrayType) == 0;
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+static PyModuleDef columns_module = {
+    PyModuleDef_HEAD_INIT, "columns", "The C++ column simulation.", -1, NULL
+};
+
+PyMODINIT_FUNC PyInit_columns()
+{
+    if (!columns_ready_types())
+        return NULL;
+    PyObject* module = PyModule_Create(&columns_module);
+    if (!module)
+        return NULL;
+    Py_INCREF(&ColumnsType);
+    PyModule_AddObject(module, "Columns", (PyObject*)&ColumnsType);
+    return module;
+}
+
+#else
+
+PyMODINIT_FUNC initcolumns()
+{
+    if (!columns_ready_types())
+        return;
+    PyObject* module = Py_InitModule3("columns", NULL, "The C++ column simulation.");
+    if (!module)
+        return;
+    Py_INCREF(&ColumnsType);
+    PyModule_AddObject(module, "Columns", (PyObject*)&ColumnsType);
+}
+
+#endif
@@ -4,6 +4,12 @@ import colorsys
 import random
 import time
 
+# the C++ simulation, if it's been built (make in this directory)
+try:
+    import columns
+except ImportError:
+    columns = None
+
 COLUMN_WIDTH = 50
 
 LOOPRATE = 100 #lps
@@ -49,6 +55,18 @@ class Driver(object):
             self.height = MAX_COLUMN_HEIGHT*math.sin(DRIVER_OMEGA * self.counter)
             self.counter += 1
         
+def draw_column(index, height, step):
+    # set color based on height and time
+    H = abs(height)/(MAX_COLUMN_HEIGHT*5.)
+    color_evo = step*COLOR_EVOLUTION % 1
+    color = colorsys.hsv_to_rgb(color_evo + H, 0.8, 0.8)
+    color = [rgb*255. for rgb in color]
+
+    pygame.draw.line(screen, color,
+                    (index*COLUMN_WIDTH, WINDOW_HEIGHT/2.),
+                    (index*COLUMN_WIDTH, WINDOW_HEIGHT/2. + height),
+                    COLUMN_WIDTH)
+
 def main_loop():
     cs = []
     for i in xrange(COLUMNS):
@@ -66,21 +84,39 @@ def main_loop():
         time.sleep(1./LOOPRATE)
         screen.fill((0, 0, 0))
         for c in cs:
-            # set color based on height and time
-            H = abs(c.height)/(MAX_COLUMN_HEIGHT*5.)
-            color_evo = step*COLOR_EVOLUTION % 1
-            color = colorsys.hsv_to_rgb(color_evo + H, 0.8, 0.8)
-            color = [rgb*255. for rgb in color]
-
-            pygame.draw.line(screen, color,
-                            (c.index*COLUMN_WIDTH, WINDOW_HEIGHT/2.),
-                            (c.index*COLUMN_WIDTH, WINDOW_HEIGHT/2. + c.height),
-                            COLUMN_WIDTH)
+            draw_column(c.index, c.height, step)
             c.step()
             driver.step()
         pygame.display.update()
+
+def native_main_loop():
+    # one extra column on the right stands in for the driver, it's put
+    # where the driver is and held still before every step
+    sim = columns.Columns(COLUMNS + 1, 1, K, DASHPOT, NEIGHBOR_K)
+    heights = np.asarray(sim.heights)[0]    # the simulation's own memory
+    velocities = np.asarray(sim.velocities)[0]
+
+    driver = Driver()
+
+    step = 0
+    while True:
+        step += 1
+        time.sleep(1./LOOPRATE)
+        screen.fill((0, 0, 0))
+        for i in xrange(COLUMNS):
+            draw_column(i, heights[i], step)
+        # the driver steps once per column per frame, as above
+        for i in xrange(COLUMNS):
+            driver.step()
+        heights[COLUMNS] = driver.height
+        velocities[COLUMNS] = 0.
+        sim.step()
+        pygame.display.update()
  
 if __name__ == "__main__":
     pygame.init()
     screen = pygame.display.set_mode((WINDOW_WIDTH, WINDOW_HEIGHT))
-    main_loop()
+    if columns:
+        native_main_loop()
+    else:
+        main_loop()
@@ -0,0 +1,46 @@
+# Tests for the columns module, run with make test in this directory.
+
+import threading
+import unittest
+
+import columns
+
+# big enough that a step() takes a good while
+SIZE = 1024
+STEPS = 200
+
+
+class SteppingTest(unittest.TestCase):
+    def test_changes_raise_while_another_thread_steps(self):
+        sim = columns.Columns(SIZE, SIZE, k=0.0005, dashpot=0.002, neighbor_k=0.2)
+        stepper = threading.Thread(target=sim.step, args=(STEPS,))
+        stepper.start()
+
+        # until the stepper has let go of the GIL nothing raises, after that
+        # everything does until it's done
+        raised = []
+        while stepper.is_alive() and not raised:
+            try:
+                sim.drop(SIZE / 2, SIZE / 2, 10, 1.0)
+            except RuntimeError:
+                raised.append("drop")
+        for name, change in (("step", lambda: sim.step(1)),
+                             ("__init__", lambda: sim.__init__(SIZE, SIZE))):
+            try:
+                change()
+            except RuntimeError:
+                raised.append(name)
+        stepping = stepper.is_alive()
+        stepper.join()
+
+        self.assertTrue(stepping, "the step finished before it could be interrupted")
+        self.assertEqual(raised, ["drop", "step", "__init__"])
+
+        # and once it's done everything works again
+        sim.drop(SIZE / 2, SIZE / 2, 10, 1.0)
+        sim.step(1)
+        sim.__init__(SIZE, SIZE)
+
+
+if __name__ == "__main__":
+    unittest.main()
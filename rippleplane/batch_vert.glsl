@@ -0,0 +1,38 @@
+#version 150
+
+in vec2 position;
+
+// per draw, from the batch's draw buffer
+in vec2 cell;
+in vec3 color;
+
+out vec3 Color;
+
+uniform mat4 model;
+
+// shared by every program, see common/frame_uniforms.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 viewport;
+    float time;
+};
+
+uniform vec2 Stride;
+uniform float GridSize;
+
+// simulation state, r = height
+uniform sampler2D heights;
+uniform float HeightScale;
+
+void main()
+{
+    Color = color;
+
+    // each cell samples the simulation at its center and moves as a whole
+    vec2 uv = (cell + GridSize + 0.5) / (2.0 * GridSize);
+    float height = HeightScale * texture(heights, uv).r;
+
+    gl_Position = viewProj * model * vec4(cell * Stride + position, height, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 150
+
+// Adds a smooth bump to the height, blended on top of the current state
+
+out vec4 outState;
+
+uniform vec2 Center;
+uniform float Radius;
+uniform float Amount;
+
+void main()
+{
+    float d = length(gl_FragCoord.xy - Center) / Radius;
+    float bump = 0.5 + 0.5 * cos(3.14159265 * min(d, 1.0));
+    outState = vec4(Amount * bump, 0.0, 0.0, 0.0);
+}
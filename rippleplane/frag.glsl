@@ -1,20 +1,80 @@
 #version 150
 
+// Compiled per pass with some of these defined, see common/shader_variants.h
+//   PRECOMPUTED_RGB  Color is already RGB, worked out once per draw on the
+//                    CPU rather than per fragment
+//   LIGHTING         lit by the point lights in Lights, every one of them
+//                    for every fragment
+//   TILED_LIGHTS     with LIGHTING, only by the lights on the fragment's
+//                    tile's list (see common/light_tiles.h)
+
 in vec2 Texcoord;
 
 out vec4 outColor;
 uniform vec3 Color;
 
+#ifndef PRECOMPUTED_RGB
+
 vec3 hsv2rgb(vec3 c)
 {
     vec4 K = vec4(1.0, 2.0 / 3.0, 1.0 / 3.0, 3.0);
     vec3 p = abs(fract(c.xxx + K.xyz) * 6.0 - K.www);
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
+#endif
 
-void main()
+#ifdef LIGHTING
+in vec3 Position;
+
+// two texels a light: position and radius, then color
+uniform samplerBuffer Lights;
+
+#ifdef TILED_LIGHTS
+uniform isamplerBuffer LightTiles;
+uniform isamplerBuffer LightIndices;
+uniform int LightTileSize;
+uniform int LightTilesX;
+#else
+uniform int LightCount;
+#endif
+
+// how much of a light's color reaches here, the cells facing straight up
+vec3 light(int i)
 {
-    outColor = vec4(hsv2rgb(Color), 1.0);
+    vec4 p = texelFetch(Lights, 2 * i);
+    vec3 l = p.xyz - Position;
+    float d = length(l);
+    float falloff = max(1.0 - d / p.w, 0.0);
+    return texelFetch(Lights, 2 * i + 1).rgb * falloff * falloff * max(l.z / d, 0.0);
 }
 
+vec3 lighting()
+{
+    vec3 sum = vec3(0.08);
+#ifdef TILED_LIGHTS
+    ivec2 tile = ivec2(gl_FragCoord.xy) / LightTileSize;
+    ivec2 list = texelFetch(LightTiles, tile.y * LightTilesX + tile.x).xy;
+    for (int i = 0; i < list.y; i++) {
+        sum += light(texelFetch(LightIndices, list.x + i).r);
+    }
+#else
+    for (int i = 0; i < LightCount; i++) {
+        sum += light(i);
+    }
+#endif
+    return sum;
+}
+#endif
 
+void main()
+{
+#ifdef PRECOMPUTED_RGB
+    vec3 color = Color;
+#else
+    vec3 color = hsv2rgb(Color);
+#endif
+#ifdef LIGHTING
+    color *= lighting();
+#endif
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,143 @@
+// GPU heightfield simulation.
+//
+// The state lives in two RG32F textures (height in r, velocity in g) which are
+// ping-ponged: each step reads one and renders into the other through a
+// fullscreen pass running sim_frag.glsl. Drops are added straight into the
+// current state with additive blending, scissored to the area they touch, so
+// nothing ever has to be read back to the CPU.
+
+#include "../common/glstate.h"
+
+struct HeightField {
+    int size;
+    int cur;
+    GLuint tex[2];
+    GLuint fbo[2];
+
+    GLuint simProgram;
+    GLint uniSimState;
+    GLint uniSimK;
+    GLint uniSimDashpot;
+    GLint uniSimNeighborK;
+
+    GLuint dropProgram;
+    GLint uniDropCenter;
+    GLint uniDropRadius;
+    GLint uniDropAmount;
+
+    // the fullscreen passes don't need any attributes, but core profile
+    // still wants a vertex array bound when drawing
+    GLuint vao;
+};
+
+void heightfield_init(HeightField& hf, int size, GLuint simProgram, GLuint dropProgram)
+{
+    hf.size = size;
+    hf.cur = 0;
+
+    glGenTextures(2, hf.tex);
+    glGenFramebuffers(2, hf.fbo);
+    for (int i = 0; i < 2; i++) {
+        glstate_bind_texture(0, GL_TEXTURE_2D, hf.tex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, NULL);
+
+        // the edges are handled in the shader, so just clamp
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // the simulation uses texelFetch, the linear filter is for whoever
+        // samples the heights in between cells
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, hf.fbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hf.tex[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("heightfield framebuffer incomplete!\n");
+            exit(1);
+        }
+
+        // start flat and at rest
+        glstate_clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+    hf.simProgram = simProgram;
+    hf.uniSimState = glGetUniformLocation(simProgram, "state");
+    hf.uniSimK = glGetUniformLocation(simProgram, "K");
+    hf.uniSimDashpot = glGetUniformLocation(simProgram, "Dashpot");
+    hf.uniSimNeighborK = glGetUniformLocation(simProgram, "NeighborK");
+
+    hf.dropProgram = dropProgram;
+    hf.uniDropCenter = glGetUniformLocation(dropProgram, "Center");
+    hf.uniDropRadius = glGetUniformLocation(dropProgram, "Radius");
+    hf.uniDropAmount = glGetUniformLocation(dropProgram, "Amount");
+
+    glGenVertexArrays(1, &hf.vao);
+}
+
+// Set the spring constants, same meaning as in py/ripples.py
+void heightfield_constants(HeightField& hf, float k, float dashpot, float neighborK)
+{
+    glstate_use_program(hf.simProgram);
+    glUniform1i(hf.uniSimState, 0);
+    glUniform1f(hf.uniSimK, k);
+    glUniform1f(hf.uniSimDashpot, dashpot);
+    glUniform1f(hf.uniSimNeighborK, neighborK);
+}
+
+// The texture holding the most recent state
+GLuint heightfield_texture(const HeightField& hf)
+{
+    return hf.tex[hf.cur];
+}
+
+// Advance the simulation by `steps` steps. Leaves the state framebuffer bound
+// and the viewport set to the simulation size.
+void heightfield_step(HeightField& hf, int steps)
+{
+    glstate_use_program(hf.simProgram);
+    glstate_bind_vertex_array(hf.vao);
+    glstate_viewport(0, 0, hf.size, hf.size);
+
+    for (int i = 0; i < steps; i++) {
+        int next = 1 - hf.cur;
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, hf.fbo[next]);
+        glstate_bind_texture(0, GL_TEXTURE_2D, hf.tex[hf.cur]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        hf.cur = next;
+    }
+}
+
+// Add a drop of height `amount` centered on texel (x, y). Only the square
+// around the drop is touched.
+void heightfield_drop(HeightField& hf, float x, float y, float radius, float amount)
+{
+    glstate_use_program(hf.dropProgram);
+    glstate_bind_vertex_array(hf.vao);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, hf.fbo[hf.cur]);
+    glstate_viewport(0, 0, hf.size, hf.size);
+
+    glUniform2f(hf.uniDropCenter, x, y);
+    glUniform1f(hf.uniDropRadius, radius);
+    glUniform1f(hf.uniDropAmount, amount);
+
+    int r = (int)ceil(radius);
+    glstate_enable(GL_SCISSOR_TEST);
+    glstate_scissor((int)x - r, (int)y - r, 2*r + 1, 2*r + 1);
+    glstate_enable(GL_BLEND);
+    glstate_blend_func(GL_ONE, GL_ONE);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glstate_disable(GL_BLEND);
+    glstate_disable(GL_SCISSOR_TEST);
+}
+
+void heightfield_destroy(HeightField& hf)
+{
+    glstate_delete_framebuffers(2, hf.fbo);
+    glstate_delete_textures(2, hf.tex);
+    glstate_delete_vertex_arrays(1, &hf.vao);
+}
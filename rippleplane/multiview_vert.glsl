@@ -0,0 +1,45 @@
+#version 150
+
+// vert.glsl for --views: each cell is drawn with one instance per view, and
+// each instance lands in its own view's rectangle, see common/multiview.h
+
+in vec2 position;
+in vec2 texcoord;
+
+out vec2 Texcoord;
+
+uniform mat4 model;
+
+layout(std140) uniform Views {
+    mat4 viewProjs[16];
+    vec4 viewRects[16];     // xy scale, zw offset, in NDC
+    int viewCount;
+};
+
+uniform vec2 Cell;
+uniform vec2 Stride;
+uniform float GridSize;
+
+// simulation state, r = height
+uniform sampler2D heights;
+uniform float HeightScale;
+
+void main()
+{
+    Texcoord = texcoord;
+
+    // each cell samples the simulation at its center and moves as a whole
+    vec2 uv = (Cell + GridSize + 0.5) / (2.0 * GridSize);
+    float height = HeightScale * texture(heights, uv).r;
+
+    vec4 p = viewProjs[gl_InstanceID] * model * vec4(Cell * Stride + position, height, 1.0);
+
+    // clipped to what this view's own viewport would show, then moved into
+    // its rectangle
+    gl_ClipDistance[0] = p.w + p.x;
+    gl_ClipDistance[1] = p.w - p.x;
+    gl_ClipDistance[2] = p.w + p.y;
+    gl_ClipDistance[3] = p.w - p.y;
+    vec4 rect = viewRects[gl_InstanceID];
+    gl_Position = vec4(p.xy * rect.xy + rect.zw * p.w, p.zw);
+}
@@ -0,0 +1,9 @@
+#version 150
+
+// Fullscreen triangle, generated from the vertex id so no buffer is needed
+
+void main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
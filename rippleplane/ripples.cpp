@@ -3,6 +3,103 @@
 #define X_STRIDE 0.3f
 #define Y_STRIDE 0.3f
 #define GRID_SIZE 20
+// --grid's upper end, four million cells
+#define GRID_MAX_SIZE 1024
+
+#define WINDOW_WIDTH 1920
+#define WINDOW_HEIGHT 1080
+
+// Heightfield simulation, constants as in py/ripples.py
+#define SIM_SIZE 256
+// --sim's range; drops need a few cells to land in, and a stream can't
+// record anything bigger than STREAM_MAX_SIZE
+#define SIM_MIN_SIZE 8
+#define SIM_MAX_SIZE 8192
+#define SIM_STEPS_PER_FRAME 4
+#define SIM_K 0.0005f
+#define SIM_DASHPOT 0.002f
+#define SIM_NEIGHBOR_K 0.2f
+#define DROP_INTERVAL 0.5f
+
+// Steps per second when the simulation runs on its own thread
+#define CPU_SIM_RATE 240.0
+
+// Columns whose height, velocity and pull from the neighbors are all under
+// this are at rest, and the CPU simulation stops stepping them
+#define SIM_SLEEP_EPSILON 1e-5f
+
+// --bench-active: columns in the domain, the radius of the disturbance, and
+// steps timed with and without sleeping
+#define BENCH_ACTIVE_COLUMNS 10000000
+#define BENCH_ACTIVE_RADIUS 8.0f
+#define BENCH_ACTIVE_DENSE_STEPS 20
+#define BENCH_ACTIVE_STEPS 2000
+
+// --bench-scene: deepest the random hierarchies go, and updates timed per
+// fraction of nodes changing
+#define BENCH_SCENE_DEPTH 12
+#define BENCH_SCENE_FRAMES 20
+
+// --bench-variants: cells drawn over the whole window per frame, and frames
+// timed per variant
+#define BENCH_VARIANT_LAYERS 40
+#define BENCH_VARIANT_FRAMES 20
+
+// Recordings: a full keyframe every this many steps, deltas in between
+#define KEYFRAME_INTERVAL 16
+#define BENCH_STREAM_SECONDS 10
+#define BENCH_STREAM_SEEKS 1000
+
+// Recorded height fields (--record-field, --field): frames per second of
+// the recording, and passes --bench-field reads the file in
+#define FIELD_FPS 60.0
+#define BENCH_FIELD_PASSES 2
+
+// Most MSAA samples the dynamic resolution mode will use
+#define DYNRES_MAX_SAMPLES 4
+
+// Starting size of the per frame arena, it grows if a frame needs more
+#define FRAME_ARENA_SIZE (1 << 20)
+
+// Shapes a cell can be with --batch, and frames timed per --bench-draws run
+#define CELL_MESHES 6
+#define BENCH_DRAW_FRAMES 50
+
+// Grid resolutions --bench-surface goes through
+#define BENCH_SURFACE_MIN 256
+#define BENCH_SURFACE_MAX 4096
+
+// Frames timed per --bench-soft run
+#define BENCH_SOFT_FRAMES 20
+
+// Frames timed per --bench-views run
+#define BENCH_VIEW_FRAMES 30
+
+// --bench-heap: meshes drawn per frame, how many of them are replaced every
+// frame, and frames timed
+#define BENCH_HEAP_MESHES 1024
+#define BENCH_HEAP_CHURN 32
+#define BENCH_HEAP_FRAMES 50
+
+// Offline rendering with --farm: frames per second of animation, MSAA
+// samples, and the most workers --bench-farm tries
+#define FARM_FPS 60.0f
+#define FARM_SAMPLES 4
+#define BENCH_FARM_MAX_WORKERS 8
+
+// Frames per second of animation with --soft-frames
+#define SOFT_FRAMES_FPS 60.0f
+
+// Program counts --bench-compile starts up with
+static const int bench_compile_counts[] = { 1, 10, 100 };
+
+// Point lights with --lights: screen tile size in pixels, and how many
+// lights reach a point of the plane on average, whatever their number. Then
+// the counts --bench-lights compares, and frames timed for each.
+#define LIGHT_TILE 16
+#define LIGHT_OVERLAP 4.0f
+static const int bench_light_counts[] = { 64, 512, 4096 };
+#define BENCH_LIGHT_FRAMES 5
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -14,209 +111,2242 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+#include "../common/trace.h"
+#include "../common/frame_pacing.h"
 
 class GLUint;
 
-void print_compilation_error(unsigned int shader) {
-    char buffer[512];
-    glGetShaderInfoLog(shader, 512, NULL, buffer);
-    printf("Compilation Error:\n\n%s\n", buffer);
+#include "heightfield.h"
+#include "sim_thread.h"
+#include "surface.h"
+#include "soft_shaders.h"
+#include "../common/capture.h"
+#include "../common/dynres.h"
+#include "../common/mesh_batch.h"
+#include "../common/frame_uniforms.h"
+#include "../common/multiview.h"
+#include "../common/frame_arena.h"
+#include "../common/render_farm.h"
+#include "../common/alloc_stats.h"
+#include "../common/scene.h"
+#include "../common/shader_compile.h"
+#include "../common/shader_variants.h"
+#include "../common/field_stream.h"
+#include "../common/gpu_heap.h"
+#include "../common/light_tiles.h"
+#include "../common/draw_sort.h"
+#include "../common/overdraw.h"
+
+// Every cell is this quad, moved into place by vert.glsl
+static const float cell_vertices[] = {
+    //Position    //Texcoords
+    -0.1f,  0.1f, 0.0f, 0.0f,
+     0.1f,  0.1f, 1.0f, 0.0f,
+     0.1f, -0.1f, 1.0f, 1.0f,
+    -0.1f, -0.1f, 0.0f, 1.0f
+};
+static const GLuint cell_elements[] = {
+    0, 1, 2,
+    2, 3, 0
+};
+
+glm::vec3 get_color(int x, int y, float time) {
+    return glm::vec3(sin(0.2f * time + x/20.0f + y/20.0f), 0.7f, 1.0f);
 }
 
-std::string read_file_to_cstr(const char* filename)
+// get_color() already turned into RGB, for frag.glsl with PRECOMPUTED_RGB
+glm::vec3 get_rgb(int x, int y, float time) {
+    return soft_hsv2rgb(get_color(x, y, time));
+}
+
+// Between 0 and 1, the same every time for the same light and k
+float light_random(int light, int k)
 {
-    std::ifstream fs(filename);
-    std::stringstream ss;
-    ss << fs.rdbuf();
-    std::string frag = ss.str();
-    return frag;
+    unsigned int h = light * 0x9e3779b9u + k * 0x85ebca6bu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h & 0xffffff) / (float)0x1000000;
 }
 
-unsigned int compile_fragment_shader()
+// Lights circling over the plane, in the plane's own space, spread out and
+// sized so about LIGHT_OVERLAP of them reach any point of it
+void place_lights(LightTiles& t, int gridSize, float time)
 {
-    GLint status;
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    float extent = gridSize * X_STRIDE;
+    float radius = sqrt(LIGHT_OVERLAP * 4.0f * extent * extent / (3.14159f * t.count));
+    for (int i = 0; i < t.count; i++) {
+        float angle = light_random(i, 2) * 6.2832f + time * (0.5f + light_random(i, 3));
+        float orbit = radius * (0.25f + 0.5f * light_random(i, 4));
+        glm::vec3 position((2.0f * light_random(i, 0) - 1.0f) * extent + orbit * cos(angle),
+                           (2.0f * light_random(i, 1) - 1.0f) * extent + orbit * sin(angle),
+                           radius * (0.2f + 0.3f * light_random(i, 5)));
+        glm::vec3 color = soft_hsv2rgb(glm::vec3(light_random(i, 6), 0.6f, 1.0f));
+        light_tiles_set(t, i, position, radius, color);
+    }
+}
 
-    std::string frag = read_file_to_cstr("frag.glsl");
-    const char* frag_src = frag.c_str();
+// A polygon fanned out from its center, with corners alternating between the
+// outer and inner radius (equal for a regular polygon, different for a star)
+void add_cell_polygon(MeshBatch& b, int corners, float outer, float inner)
+{
+    std::vector<float> vertices;
+    std::vector<GLuint> indices;
+    vertices.push_back(0.0f);
+    vertices.push_back(0.0f);
+    for (int i = 0; i < corners; i++) {
+        float r = (i % 2) ? inner : outer;
+        float angle = glm::radians(360.0f) * i / corners;
+        vertices.push_back(r * cos(angle));
+        vertices.push_back(r * sin(angle));
+        indices.push_back(0);
+        indices.push_back(1 + i);
+        indices.push_back(1 + (i + 1) % corners);
+    }
+    mesh_batch_add(b, vertices.data(), corners + 1, indices.data(), indices.size());
+}
+
+// All the shapes a cell can be, roughly the size of the original quad
+void add_cell_meshes(MeshBatch& b)
+{
+    float quad[] = {
+        -0.1f,  0.1f,
+         0.1f,  0.1f,
+         0.1f, -0.1f,
+        -0.1f, -0.1f
+    };
+    GLuint quadIndices[] = {
+        0, 1, 2,
+        2, 3, 0
+    };
+    mesh_batch_add(b, quad, 4, quadIndices, 6);
 
-    glShaderSource(fragmentShader, 1, &frag_src, NULL);
-    glCompileShader(fragmentShader);
+    add_cell_polygon(b, 3, 0.12f, 0.12f);
+    add_cell_polygon(b, 5, 0.11f, 0.11f);
+    add_cell_polygon(b, 6, 0.11f, 0.11f);
+    add_cell_polygon(b, 8, 0.1f, 0.1f);
+    add_cell_polygon(b, 10, 0.13f, 0.06f);
+}
 
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &status);
-    if (status == GL_TRUE) {
-        printf("compiled fragment shader\n"); 
-    } else {
-        printf("fragment shader compilation failed!\n");
-        print_compilation_error(fragmentShader);
-        exit(1);
+int cell_mesh(int x, int y)
+{
+    return ((x * 7 + y * 13) % CELL_MESHES + CELL_MESHES) % CELL_MESHES;
+}
+
+// Time the simulation on its own at a few sizes
+void bench_heightfield(GLuint simProgram, GLuint dropProgram)
+{
+    int sizes[] = { 512, 2048, 4096 };
+
+    for (int size : sizes) {
+        HeightField hf;
+        heightfield_init(hf, size, simProgram, dropProgram);
+        heightfield_constants(hf, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+        heightfield_drop(hf, size/2.0f, size/2.0f, size/32.0f, 1.0f);
+
+        // warm up
+        heightfield_step(hf, 10);
+        glFinish();
+
+        int steps = 0;
+        float elapsed;
+        auto t_start = std::chrono::high_resolution_clock::now();
+        do {
+            heightfield_step(hf, 10);
+            glFinish();
+            steps += 10;
+            auto t_now = std::chrono::high_resolution_clock::now();
+            elapsed = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
+        } while (elapsed < 2.0f);
+
+        printf("%4d x %-4d: %8.1f steps/s, %8.1f Mcells/s\n", size, size,
+               steps / elapsed, steps / elapsed * size * size / 1e6f);
+
+        heightfield_destroy(hf);
     }
+}
 
-    return fragmentShader;
+// Compare the CPU time it takes to submit a grid of mixed meshes: one draw
+// per mesh with its data in uniforms, the batch's fallback loops (with and
+// without base instance), and a single multi-draw indirect call
+void bench_draws(GLuint uniformProgram, GLuint batchProgram, FrameUniformBuffer& frameUniforms)
+{
+    glm::mat4 model;
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    MeshBatch batch;
+    mesh_batch_init(batch, 2, 5);
+    add_cell_meshes(batch);
+    mesh_batch_upload(batch);
+    mesh_batch_vertex_attrib(batch, glGetAttribLocation(batchProgram, "position"), 2, 0);
+    mesh_batch_draw_attrib(batch, glGetAttribLocation(batchProgram, "cell"), 2, 0);
+    mesh_batch_draw_attrib(batch, glGetAttribLocation(batchProgram, "color"), 3, 2);
+    bool multiDraw = batch.multiDraw;
+    bool baseInstance = batch.baseInstance;
+
+    // the per mesh draws read the same buffers through a vertex array of
+    // their own
+    GLuint meshVao;
+    glGenVertexArrays(1, &meshVao);
+    glstate_bind_vertex_array(meshVao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, batch.vbo);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch.ebo);
+    GLint posAttrib = glGetAttribLocation(uniformProgram, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 2*sizeof(float), 0);
+    GLint uniCell = glGetUniformLocation(uniformProgram, "Cell");
+    GLint uniColor = glGetUniformLocation(uniformProgram, "Color");
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_enable(GL_DEPTH_TEST);
+
+    int gridSizes[] = { 20, 40, 80 };
+    for (int gridSize : gridSizes) {
+        GLuint programs[] = { uniformProgram, batchProgram };
+        for (GLuint program : programs) {
+            glstate_use_program(program);
+            glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+            glUniform2f(glGetUniformLocation(program, "Stride"), X_STRIDE, Y_STRIDE);
+            glUniform1f(glGetUniformLocation(program, "GridSize"), gridSize);
+            glUniform1f(glGetUniformLocation(program, "HeightScale"), 1.0f);
+        }
+        int draws = 4 * gridSize * gridSize;
+
+        const char* names[] = { "per mesh", "loop", "loop + base instance", "multi-draw" };
+        for (int method = 0; method < 4; method++) {
+            if ((method == 2 && !baseInstance) || (method == 3 && !multiDraw)) {
+                printf("%5d draws, %-20s: not supported\n", draws, names[method]);
+                continue;
+            }
+            batch.baseInstance = method == 2;
+            batch.multiDraw = method == 3;
+
+            float submitTotal = 0.0f, frameTotal = 0.0f;
+            for (int frame = -5; frame < BENCH_DRAW_FRAMES; frame++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                auto t_start = std::chrono::high_resolution_clock::now();
+                if (method == 0) {
+                    glstate_use_program(uniformProgram);
+                    glstate_bind_vertex_array(meshVao);
+                    for (int x = -gridSize; x < gridSize; x++) {
+                        for (int y = -gridSize; y < gridSize; y++) {
+                            const MeshRange& mesh = batch.meshes[cell_mesh(x, y)];
+                            glUniform2f(uniCell, x, y);
+                            glUniform3fv(uniColor, 1, glm::value_ptr(get_color(x, y, frame)));
+                            glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+                                                     (void*)(mesh.firstIndex * sizeof(GLuint)), mesh.baseVertex);
+                        }
+                    }
+                } else {
+                    glstate_use_program(batchProgram);
+                    mesh_batch_begin(batch);
+                    for (int x = -gridSize; x < gridSize; x++) {
+                        for (int y = -gridSize; y < gridSize; y++) {
+                            float* d = mesh_batch_draw(batch, cell_mesh(x, y));
+                            glm::vec3 color = get_color(x, y, frame);
+                            d[0] = x; d[1] = y;
+                            d[2] = color.x; d[3] = color.y; d[4] = color.z;
+                        }
+                    }
+                    mesh_batch_submit(batch);
+                }
+                auto t_submitted = std::chrono::high_resolution_clock::now();
+                glFinish();
+                auto t_done = std::chrono::high_resolution_clock::now();
+
+                if (frame >= 0) {
+                    submitTotal += std::chrono::duration<float, std::milli>(t_submitted - t_start).count();
+                    frameTotal += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+                }
+            }
+
+            float submit = submitTotal / BENCH_DRAW_FRAMES;
+            printf("%5d draws, %-20s: submit %7.3f ms (%6.1f ns per draw), frame %7.2f ms\n",
+                   draws, names[method], submit, 1e6f * submit / draws, frameTotal / BENCH_DRAW_FRAMES);
+        }
+    }
+
+    glstate_delete_vertex_arrays(1, &meshVao);
+    mesh_batch_destroy(batch);
+}
+
+// A vertex array reading positions and indices out of the same buffer
+GLuint bench_heap_vao(GLuint buffer, GLint posAttrib)
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glstate_bind_vertex_array(vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 2*sizeof(float), 0);
+    return vao;
 }
 
-unsigned int compile_vertex_shader()
+// Draw BENCH_HEAP_MESHES meshes (the cell shapes over and over), replacing
+// BENCH_HEAP_CHURN of them every frame. First with a vertex buffer, an
+// element buffer and a vertex array per mesh, created and deleted as they
+// come and go, then sub-allocated from a GpuHeap, where the meshes share
+// a vertex array per block and replaced ones are recycled behind fences.
+void bench_heap(GLuint program, FrameUniformBuffer& frameUniforms)
 {
-    GLint status;
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glm::mat4 model;
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    std::string vert = read_file_to_cstr("vert.glsl");
-    const char* vert_src = vert.c_str();
+    // only the shapes' vertices and indices are used, not its buffers
+    MeshBatch shapes;
+    mesh_batch_init(shapes, 2, 0);
+    add_cell_meshes(shapes);
 
-    glShaderSource(vertexShader, 1, &vert_src, NULL);
-    glCompileShader(vertexShader);
+    int side = (int)ceilf(sqrtf((float)BENCH_HEAP_MESHES));
+    glstate_use_program(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniform2f(glGetUniformLocation(program, "Stride"), X_STRIDE, Y_STRIDE);
+    glUniform1f(glGetUniformLocation(program, "GridSize"), side / 2);
+    glUniform1f(glGetUniformLocation(program, "HeightScale"), 0.0f);
+    GLint uniCell = glGetUniformLocation(program, "Cell");
+    GLint uniColor = glGetUniformLocation(program, "Color");
+    GLint posAttrib = glGetAttribLocation(program, "position");
 
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &status);
-    if (status == GL_TRUE) {
-        printf("compiled vertex shader\n"); 
-    } else {
-        printf("vertex shader compilation failed!\n");
-        print_compilation_error(vertexShader);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_enable(GL_DEPTH_TEST);
+
+    struct Mesh {
+        int shape;
+        GLuint vao, vbo, ebo;
+        GpuAlloc vertices, elements;
+    };
+    std::vector<Mesh> meshes(BENCH_HEAP_MESHES);
+    GpuHeap heap;
+    gpu_heap_init(heap, 0);
+    std::vector<GLuint> blockVaos;
+
+    const char* names[] = { "per mesh", "gpu heap" };
+    for (int method = 0; method < 2; method++) {
+        auto create = [&](Mesh& m, int shape) {
+            const MeshRange& range = shapes.meshes[shape];
+            int end = shape + 1 < (int)shapes.meshes.size() ? shapes.meshes[shape + 1].baseVertex
+                                                             : shapes.vertices.size() / 2;
+            const float* vertices = &shapes.vertices[range.baseVertex * 2];
+            GLsizeiptr vertexBytes = (end - range.baseVertex) * 2 * sizeof(float);
+            const GLuint* indices = &shapes.indices[range.firstIndex];
+            GLsizeiptr indexBytes = range.indexCount * sizeof(GLuint);
+            m.shape = shape;
+            if (method == 0) {
+                glGenVertexArrays(1, &m.vao);
+                glstate_bind_vertex_array(m.vao);
+                glGenBuffers(1, &m.vbo);
+                glstate_bind_buffer(GL_ARRAY_BUFFER, m.vbo);
+                glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertices, GL_STATIC_DRAW);
+                glGenBuffers(1, &m.ebo);
+                glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, m.ebo);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices, GL_STATIC_DRAW);
+                glEnableVertexAttribArray(posAttrib);
+                glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 2*sizeof(float), 0);
+            } else {
+                // in the same block, which the block's vertex array draws
+                // both from
+                if (!gpu_heap_alloc_pair(heap, GPU_VERTEX, vertexBytes, m.vertices, GPU_INDEX, indexBytes,
+                                         m.elements) ||
+                    !gpu_heap_upload(m.vertices, vertices, vertexBytes) ||
+                    !gpu_heap_upload(m.elements, indices, indexBytes)) {
+                    exit(1);
+                }
+                while (blockVaos.size() < heap.blocks.size()) {
+                    blockVaos.push_back(bench_heap_vao(heap.blocks[blockVaos.size()].buffer, posAttrib));
+                }
+            }
+        };
+        auto destroy = [&](Mesh& m) {
+            if (method == 0) {
+                glstate_delete_vertex_arrays(1, &m.vao);
+                GLuint buffers[] = { m.vbo, m.ebo };
+                glstate_delete_buffers(2, buffers);
+            } else {
+                gpu_heap_free(heap, m.vertices);
+                gpu_heap_free(heap, m.elements);
+            }
+        };
+
+        for (int i = 0; i < BENCH_HEAP_MESHES; i++) {
+            create(meshes[i], i % CELL_MESHES);
+        }
+
+        float submitTotal = 0.0f, frameTotal = 0.0f;
+        long binds = 0;
+        int replaced = 0;
+        for (int frame = -5; frame < BENCH_HEAP_FRAMES; frame++) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glstate_frame();
+
+            auto t_start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < BENCH_HEAP_CHURN; i++, replaced++) {
+                Mesh& m = meshes[replaced % BENCH_HEAP_MESHES];
+                int shape = (m.shape + 1) % CELL_MESHES;
+                destroy(m);
+                create(m, shape);
+            }
+            for (int i = 0; i < BENCH_HEAP_MESHES; i++) {
+                const Mesh& m = meshes[i];
+                const MeshRange& range = shapes.meshes[m.shape];
+                int x = i % side - side / 2, y = i / side - side / 2;
+                glUniform2f(uniCell, x, y);
+                glUniform3fv(uniColor, 1, glm::value_ptr(get_color(x, y, frame)));
+                if (method == 0) {
+                    glstate_bind_vertex_array(m.vao);
+                    glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, 0);
+                } else {
+                    glstate_bind_vertex_array(blockVaos[m.vertices.block]);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+                                             (void*)m.elements.offset, m.vertices.offset / (2*sizeof(float)));
+                }
+            }
+            auto t_submitted = std::chrono::high_resolution_clock::now();
+            // outside the submit time, since a software GL renders the whole
+            // frame as soon as it's fenced
+            if (method == 1) {
+                gpu_heap_frame(heap);
+            }
+            glFinish();
+            auto t_done = std::chrono::high_resolution_clock::now();
+
+            glstate_frame();
+            if (frame >= 0) {
+                binds += glstate().frameBinds;
+                submitTotal += std::chrono::duration<float, std::milli>(t_submitted - t_start).count();
+                frameTotal += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+            }
+        }
+        printf("%d meshes, %d replaced per frame, %-8s: %7.1f binds per frame, submit %7.3f ms, frame %7.2f ms\n",
+               BENCH_HEAP_MESHES, BENCH_HEAP_CHURN, names[method], (float)binds / BENCH_HEAP_FRAMES,
+               submitTotal / BENCH_HEAP_FRAMES, frameTotal / BENCH_HEAP_FRAMES);
+
+        for (int i = 0; i < BENCH_HEAP_MESHES; i++) {
+            destroy(meshes[i]);
+        }
+    }
+
+    gpu_heap_frame(heap);
+    gpu_heap_report(heap);
+    glstate_delete_vertex_arrays(blockVaos.size(), blockVaos.data());
+    gpu_heap_destroy(heap);
+    mesh_batch_destroy(shapes);
+}
+
+// Camera `i` of `count` for --views, spread evenly around the plane and all
+// looking at its middle. The first one is the usual camera.
+void view_camera(int i, int count, float aspect, glm::mat4& view, glm::mat4& proj)
+{
+    float angle = 2.0f * (float)M_PI * i / count;
+    glm::vec3 eye(0.6f * cosf(angle) - 0.6f * sinf(angle), 0.6f * sinf(angle) + 0.6f * cosf(angle), 1.6f);
+    view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    proj = glm::perspective(glm::radians(45.0f), aspect, 0.01f, 20.0f);
+}
+
+// Time the cell grid drawn into a grid of views as one pass per view, the
+// camera and viewport changing in between, against one pass with an
+// instance per view
+void bench_views(GLuint program, GLuint multiviewProgram, const GpuAlloc& vertices, const GpuAlloc& elements,
+                 FrameUniformBuffer& frameUniforms, int gridSize)
+{
+    glm::mat4 model;
+    GLuint programs[] = { program, multiviewProgram };
+
+    // the two programs needn't agree on where position goes, so each gets
+    // a vertex array of its own
+    GLuint vaos[2];
+    glGenVertexArrays(2, vaos);
+    for (int i = 0; i < 2; i++) {
+        glstate_bind_vertex_array(vaos[i]);
+        glstate_bind_buffer(GL_ARRAY_BUFFER, vertices.buffer);
+        glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, elements.buffer);
+        GLint posAttrib = glGetAttribLocation(programs[i], "position");
+        glEnableVertexAttribArray(posAttrib);
+        glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)vertices.offset);
+    }
+    const void* indices = (const void*)elements.offset;
+
+    for (GLuint p : programs) {
+        glstate_use_program(p);
+        glUniformMatrix4fv(glGetUniformLocation(p, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniform2f(glGetUniformLocation(p, "Stride"), X_STRIDE, Y_STRIDE);
+        glUniform1f(glGetUniformLocation(p, "GridSize"), gridSize);
+        glUniform1f(glGetUniformLocation(p, "HeightScale"), 1.0f);
+    }
+    GLint uniCell[] = { glGetUniformLocation(program, "Cell"), glGetUniformLocation(multiviewProgram, "Cell") };
+    GLint uniColor[] = { glGetUniformLocation(program, "Color"), glGetUniformLocation(multiviewProgram, "Color") };
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_enable(GL_DEPTH_TEST);
+
+    int counts[] = { 1, 2, 4, 9, 16 };
+    for (int count : counts) {
+        MultiView m;
+        multiview_init(m, count, WINDOW_WIDTH, WINDOW_HEIGHT);
+        for (int i = 0; i < count; i++) {
+            glm::mat4 view, proj;
+            view_camera(i, count, multiview_aspect(m), view, proj);
+            multiview_set_camera(m, i, view, proj);
+        }
+        multiview_update(m);
+
+        float submit[2], frameTime[2];
+        for (int method = 0; method < 2; method++) {
+            glstate_use_program(programs[method]);
+            glstate_bind_vertex_array(vaos[method]);
+            float submitTotal = 0.0f, frameTotal = 0.0f;
+            for (int frame = -5; frame < BENCH_VIEW_FRAMES; frame++) {
+                glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                auto t_start = std::chrono::high_resolution_clock::now();
+                if (method == 0) {
+                    for (int i = 0; i < count; i++) {
+                        int x, y, w, h;
+                        multiview_viewport(m, i, x, y, w, h);
+                        glstate_viewport(x, y, w, h);
+                        glm::mat4 view, proj;
+                        view_camera(i, count, multiview_aspect(m), view, proj);
+                        frame_uniforms_set_camera(frameUniforms, view, proj);
+                        frame_uniforms_update(frameUniforms, frame, w, h);
+                        for (int cx = -gridSize; cx < gridSize; cx++) {
+                            for (int cy = -gridSize; cy < gridSize; cy++) {
+                                glUniform2f(uniCell[0], cx, cy);
+                                glUniform3fv(uniColor[0], 1, glm::value_ptr(get_color(cx, cy, frame)));
+                                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
+                            }
+                        }
+                    }
+                } else {
+                    multiview_begin();
+                    for (int cx = -gridSize; cx < gridSize; cx++) {
+                        for (int cy = -gridSize; cy < gridSize; cy++) {
+                            glUniform2f(uniCell[1], cx, cy);
+                            glUniform3fv(uniColor[1], 1, glm::value_ptr(get_color(cx, cy, frame)));
+                            glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices, count);
+                        }
+                    }
+                    multiview_end();
+                }
+                auto t_submitted = std::chrono::high_resolution_clock::now();
+                glFinish();
+                auto t_done = std::chrono::high_resolution_clock::now();
+
+                if (frame >= 0) {
+                    submitTotal += std::chrono::duration<float, std::milli>(t_submitted - t_start).count();
+                    frameTotal += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+                }
+            }
+            submit[method] = submitTotal / BENCH_VIEW_FRAMES;
+            frameTime[method] = frameTotal / BENCH_VIEW_FRAMES;
+        }
+
+        printf("%2d views: %2d passes submit %7.3f ms, frame %7.2f ms; one pass submit %7.3f ms, "
+               "frame %7.2f ms (%.2fx)\n", count, count, submit[0], frameTime[0], submit[1], frameTime[1],
+               frameTime[0] / frameTime[1]);
+        multiview_destroy(m);
+    }
+
+    glstate_delete_vertex_arrays(2, vaos);
+}
+
+// The cells for --farm, drawn as in the main loop. The heights come from a
+// CPU simulation every worker runs for itself, with drops from a seed of its
+// own so they land in the same places in all of them.
+struct FarmScene {
+    int gridSize;
+    int simSize;
+    const float* vertices;      // position, texcoord, 4 corners
+    const GLuint* elements;     // 6
+
+    Columns sim;
+    unsigned seed;
+    float lastDrop;
+
+    ShaderVariants variants;
+    GLuint program;
+    GLuint vao;
+    GLuint buffers[2];
+    GLuint heightTex;
+    FrameUniformBuffer frameUniforms;
+    GLint uniModel;
+    GLint uniCell;
+    GLint uniColor;
+
+    void init()
+    {
+        columns_init(sim, simSize, simSize, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+        seed = 1;
+        lastDrop = 0.0f;
+
+        shader_variants_init(variants, "vert.glsl", "frag.glsl", "position texcoord");
+        program = shader_variant(variants, "PRECOMPUTED_RGB");
+        glstate_use_program(program);
+        frame_uniforms_init(frameUniforms);
+        frame_uniforms_bind_program(program);
+        glm::mat4 view = glm::lookAt(
+            glm::vec3(0.6f, 0.6f, 1.6f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f)
+        );
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+        frame_uniforms_set_camera(frameUniforms, view, proj);
+
+        glGenVertexArrays(1, &vao);
+        glstate_bind_vertex_array(vao);
+        glGenBuffers(2, buffers);
+        glstate_bind_buffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, 16 * sizeof(float), vertices, GL_STATIC_DRAW);
+        glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * sizeof(GLuint), elements, GL_STATIC_DRAW);
+        GLint posAttrib = glGetAttribLocation(program, "position");
+        glEnableVertexAttribArray(posAttrib);
+        glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
+
+        glGenTextures(1, &heightTex);
+        glstate_bind_texture(0, GL_TEXTURE_2D, heightTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, simSize, simSize, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        uniModel = glGetUniformLocation(program, "model");
+        uniCell = glGetUniformLocation(program, "Cell");
+        uniColor = glGetUniformLocation(program, "Color");
+        glUniform2f(glGetUniformLocation(program, "Stride"), X_STRIDE, Y_STRIDE);
+        glUniform1f(glGetUniformLocation(program, "GridSize"), gridSize);
+        glUniform1i(glGetUniformLocation(program, "heights"), 0);
+        glUniform1f(glGetUniformLocation(program, "HeightScale"), 1.0f);
+
+        glstate_enable(GL_DEPTH_TEST);
+    }
+
+    void advance(int, float time)
+    {
+        if (time - lastDrop > DROP_INTERVAL) {
+            float radius = simSize / 40.0f;
+            columns_drop(sim,
+                radius + rand_r(&seed) % (int)(simSize - 2*radius),
+                radius + rand_r(&seed) % (int)(simSize - 2*radius),
+                radius, 1.5f);
+            lastDrop = time;
+        }
+        for (int i = 0; i < SIM_STEPS_PER_FRAME; i++)
+            columns_step(sim);
+    }
+
+    void draw(int, float time)
+    {
+        glstate_use_program(program);
+        glstate_bind_vertex_array(vao);
+        glstate_bind_texture(0, GL_TEXTURE_2D, heightTex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, simSize, simSize, GL_RED, GL_FLOAT, sim.heights.data());
+
+        glm::mat4 model;
+        model = glm::rotate(model, time*glm::radians(10.0f), glm::vec3(0.1f, 0.3f, 1.0f));
+        glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
+        frame_uniforms_update(frameUniforms, time, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+        glstate_depth_func(GL_LESS);
+        glstate_clear_depth(1.0f);
+        glstate_clear_color(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for (int x = -gridSize; x < gridSize; x++) {
+            for (int y = -gridSize; y < gridSize; y++) {
+                glUniform2f(uniCell, x, y);
+                glUniform3fv(uniColor, 1, glm::value_ptr(get_rgb(x, y, time)));
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            }
+        }
+    }
+
+    void destroy()
+    {
+        frame_uniforms_destroy(frameUniforms);
+        glstate_delete_textures(1, &heightTex);
+        glstate_delete_buffers(2, buffers);
+        glstate_delete_vertex_arrays(1, &vao);
+        shader_variants_destroy(variants);
+    }
+};
+
+// Set up a program using surface_vert.glsl to draw `surface`
+void surface_uniforms(GLuint program, const Surface& surface, int gridSize, int simSize)
+{
+    glstate_use_program(program);
+    glUniform1i(glGetUniformLocation(program, "Resolution"), surface.resolution);
+    glUniform1f(glGetUniformLocation(program, "Extent"), gridSize * X_STRIDE);
+    glUniform1f(glGetUniformLocation(program, "TexelSize"), 1.0f / simSize);
+}
+
+// Draw the surface at increasing resolutions, with full width strips and
+// then in cache sized bands, for the vertex rate and how well the vertex
+// cache does
+void bench_surface(GLuint surfaceProgram, HeightField& hf, FrameUniformBuffer& frameUniforms, int gridSize)
+{
+    glm::mat4 model;
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    // something to displace
+    for (int i = 0; i < 8; i++)
+        heightfield_drop(hf, (i + 1) * hf.size / 9.0f, (i % 3 + 1) * hf.size / 4.0f, hf.size / 40.0f, 1.5f);
+    heightfield_step(hf, 50);
+
+    glstate_use_program(surfaceProgram);
+    glUniformMatrix4fv(glGetUniformLocation(surfaceProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniform1i(glGetUniformLocation(surfaceProgram, "heights"), 0);
+    glUniform1f(glGetUniformLocation(surfaceProgram, "HeightScale"), 1.0f);
+    glstate_bind_texture(0, GL_TEXTURE_2D, heightfield_texture(hf));
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_enable(GL_DEPTH_TEST);
+
+    for (int resolution = BENCH_SURFACE_MIN; resolution <= BENCH_SURFACE_MAX; resolution *= 2) {
+        int bands[] = { resolution - 1, surface_band(SURFACE_VERTEX_CACHE) };
+        for (int band : bands) {
+            Surface surface;
+            surface_init(surface, resolution, band);
+            surface_uniforms(surfaceProgram, surface, gridSize, hf.size);
+
+            // warm up
+            surface_draw(surface);
+            glFinish();
+
+            int frames = 0;
+            float elapsed;
+            auto t_start = std::chrono::high_resolution_clock::now();
+            do {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                surface_draw(surface);
+                glFinish();
+                frames++;
+                auto t_now = std::chrono::high_resolution_clock::now();
+                elapsed = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
+            } while (elapsed < 1.0f || frames < 3);
+
+            float vertices = (float)resolution * resolution * frames / elapsed;
+            printf("%4d x %-4d %-5s: %8.2f ms, %8.1f Mvertices/s, %8.1f Mtriangles/s, "
+                   "ACMR %.3f, cache hits %5.1f%%\n",
+                   resolution, resolution, band == resolution - 1 ? "rows" : "bands",
+                   1000.0f * elapsed / frames, vertices / 1e6f, surface.triangles * frames / elapsed / 1e6f,
+                   surface_acmr(surface), 100.0f * surface_hit_ratio(surface));
+
+            surface_destroy(surface);
+        }
+    }
+}
+
+// The cell grid through the software rasterizer, one draw per cell like
+// the GL loop
+void soft_draw_cells(SoftRenderer& r, SoftCellShader& shader, const GLuint* elements, int gridSize, float time)
+{
+    for (int x = -gridSize; x < gridSize; x++) {
+        for (int y = -gridSize; y < gridSize; y++) {
+            shader.cell = glm::vec2(x, y);
+            shader.rgb = get_rgb(x, y, time);
+            soft_draw_elements(r, shader, elements, 6);
+        }
+    }
+}
+
+// Time the cell grid drawn by GL against the software rasterizer on one
+// thread and on `threads`, with the same heights
+void bench_soft(GLuint program, GLuint vao, const void* indices, const float* vertices, const GLuint* elements,
+                FrameUniformBuffer& frameUniforms, int threads)
+{
+    glm::mat4 model;
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    // something to displace
+    Columns c;
+    columns_init(c, SIM_SIZE, SIM_SIZE, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+    for (int i = 0; i < 8; i++)
+        columns_drop(c, (i + 1) * SIM_SIZE / 9.0f, (i % 3 + 1) * SIM_SIZE / 4.0f, SIM_SIZE / 40.0f, 1.5f);
+    for (int i = 0; i < 50; i++)
+        columns_step(c);
+
+    GLuint heightTex;
+    glGenTextures(1, &heightTex);
+    glstate_bind_texture(0, GL_TEXTURE_2D, heightTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, SIM_SIZE, SIM_SIZE, 0, GL_RED, GL_FLOAT, c.heights.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    SoftTexture heights;
+    soft_texture_wrap(heights, c.heights.data(), SIM_SIZE, SIM_SIZE, 1, false);
+    SoftCellShader shader;
+    shader.mvp = frameUniforms.data.viewProj * model;
+    shader.stride = glm::vec2(X_STRIDE, Y_STRIDE);
+    shader.heightScale = 1.0f;
+    shader.heights = &heights;
+    shader.vertices = vertices;
+
+    glstate_use_program(program);
+    glstate_bind_vertex_array(vao);
+    glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniform1f(glGetUniformLocation(program, "HeightScale"), 1.0f);
+    GLint uniGridSize = glGetUniformLocation(program, "GridSize");
+    GLint uniCell = glGetUniformLocation(program, "Cell");
+    GLint uniColor = glGetUniformLocation(program, "Color");
+
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_enable(GL_DEPTH_TEST);
+
+    SoftRenderer single, multi;
+    soft_init(single, WINDOW_WIDTH, WINDOW_HEIGHT, 1);
+    soft_init(multi, WINDOW_WIDTH, WINDOW_HEIGHT, threads);
+    SoftRenderer* renderers[] = { &single, &multi };
+    for (SoftRenderer* r : renderers) {
+        r->state.depthTest = true;
+    }
+
+    int gridSizes[] = { 20, 40, 80 };
+    for (int gridSize : gridSizes) {
+        glUniform1f(uniGridSize, gridSize);
+        shader.gridSize = gridSize;
+
+        float ms[3];
+        for (int method = 0; method < 3; method++) {
+            float total = 0.0f;
+            for (int frame = -2; frame < BENCH_SOFT_FRAMES; frame++) {
+                auto t_start = std::chrono::high_resolution_clock::now();
+                if (method == 0) {
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    for (int x = -gridSize; x < gridSize; x++) {
+                        for (int y = -gridSize; y < gridSize; y++) {
+                            glUniform2f(uniCell, x, y);
+                            glUniform3fv(uniColor, 1, glm::value_ptr(get_rgb(x, y, frame)));
+                            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
+                        }
+                    }
+                    glFinish();
+                } else {
+                    SoftRenderer& r = *renderers[method - 1];
+                    soft_clear(r, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+                    soft_draw_cells(r, shader, elements, gridSize, frame);
+                    soft_flush(r);
+                }
+                auto t_done = std::chrono::high_resolution_clock::now();
+                if (frame >= 0) {
+                    total += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+                }
+            }
+            ms[method] = total / BENCH_SOFT_FRAMES;
+        }
+
+        printf("%5d cells: GL %7.2f ms, software %7.2f ms on 1 thread, %7.2f ms on %d threads (%.2fx GL)\n",
+               4 * gridSize * gridSize, ms[0], ms[1], ms[2], threads, ms[0] / ms[2]);
+    }
+
+    soft_destroy(single);
+    soft_destroy(multi);
+    glstate_delete_textures(1, &heightTex);
+}
+
+// --soft-frames: draw `frames` frames of the CPU simulation in software and
+// save them into `dir`, without a window or any GL at all
+void soft_frames(int frames, const char* dir, bool png, int gridSize, int simSize, int threads)
+{
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+
+    Columns sim;
+    columns_init(sim, simSize, simSize, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+    SoftTexture heights;
+
+    SoftRenderer r;
+    soft_init(r, WINDOW_WIDTH, WINDOW_HEIGHT, threads);
+    r.state.depthTest = true;
+    SoftCellShader shader;
+    shader.stride = glm::vec2(X_STRIDE, Y_STRIDE);
+    shader.gridSize = gridSize;
+    shader.heightScale = 1.0f;
+    shader.heights = &heights;
+    shader.vertices = cell_vertices;
+
+    // written the same way --capture writes them, only from this thread
+    Capture capture;
+    capture.width = WINDOW_WIDTH;
+    capture.height = WINDOW_HEIGHT;
+    capture.dir = dir;
+    capture.png = png;
+    CaptureFrame frame;
+    frame.pixels.resize(4 * WINDOW_WIDTH * WINDOW_HEIGHT);
+    std::vector<unsigned char> rows, deflated;
+
+    printf("drawing %d frames in software on %d threads into %s\n", frames, threads, dir);
+    float drawMs = 0.0f;
+    float lastDrop = -DROP_INTERVAL;
+    for (int i = 0; i < frames; i++) {
+        float time = i / SOFT_FRAMES_FPS;
+        if (time - lastDrop > DROP_INTERVAL) {
+            float radius = simSize / 40.0f;
+            columns_drop(sim,
+                radius + rand() % (int)(simSize - 2*radius),
+                radius + rand() % (int)(simSize - 2*radius),
+                radius, 1.5f);
+            lastDrop = time;
+        }
+        for (int step = 0; step < SIM_STEPS_PER_FRAME; step++)
+            columns_step(sim);
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+        soft_texture_wrap(heights, sim.heights.data(), simSize, simSize, 1, false);
+        glm::mat4 model;
+        model = glm::rotate(model, time*glm::radians(10.0f), glm::vec3(0.1f, 0.3f, 1.0f));
+        shader.mvp = proj * view * model;
+        soft_clear(r, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        soft_draw_cells(r, shader, cell_elements, gridSize, time);
+        soft_read_pixels(r, frame.pixels.data());
+        drawMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+
+        frame.index = i;
+        capture_write(capture, frame, rows, deflated);
+    }
+    printf("drew %d frames, %.2f ms each\n", frames, drawMs / frames);
+
+    soft_destroy(r);
+}
+
+// Record a run of the CPU simulation as fast as it goes, then read it back
+// at random
+void bench_stream(const char* path, int size)
+{
+    Columns c;
+    columns_init(c, size, size, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+
+    for (int compress = 0; compress < 2; compress++) {
+        StreamWriter w;
+        if (!stream_writer_open(w, path, size, size, 1.0 / CPU_SIM_RATE, KEYFRAME_INTERVAL, compress)) {
+            exit(1);
+        }
+
+        int steps = (int)(BENCH_STREAM_SECONDS * CPU_SIM_RATE);
+        int dropEvery = (int)(DROP_INTERVAL * CPU_SIM_RATE);
+        auto t_start = std::chrono::high_resolution_clock::now();
+        for (int step = 0; step < steps; step++) {
+            if (step % dropEvery == 0) {
+                float radius = size / 40.0f;
+                columns_drop(c,
+                    radius + rand() % (int)(size - 2*radius),
+                    radius + rand() % (int)(size - 2*radius),
+                    radius, 1.5f);
+            }
+            columns_step(c);
+            stream_writer_push(w, step, c.heights.data(), c.velocities.data());
+        }
+        stream_writer_close(w);
+        auto t_end = std::chrono::high_resolution_clock::now();
+        float elapsed = std::chrono::duration_cast<std::chrono::duration<float>>(t_end - t_start).count();
+
+        float rawMB = (float)steps * 2 * size * size * sizeof(float) / 1e6f;
+        float fileMB = w.offset / 1e6f;
+        printf("%s: %d steps in %.2f s, writer busy %.2f s, %.1f MB/s raw, %.1f MB/s to disk, "
+               "%.2f MB per simulated second (%.1f%% of raw), %ld stalls\n",
+               compress ? "deflated" : "plain", steps, elapsed, w.busySeconds,
+               rawMB / w.busySeconds, fileMB / w.busySeconds,
+               fileMB / BENCH_STREAM_SECONDS, 100.0f * fileMB / rawMB, w.stalls);
+
+        StreamReader r;
+        if (!stream_reader_open(r, path)) {
+            exit(1);
+        }
+        float worst = 0.0f, total = 0.0f;
+        for (int i = 0; i < BENCH_STREAM_SEEKS; i++) {
+            long n = rand() % r.trailer.records;
+            auto t_seek = std::chrono::high_resolution_clock::now();
+            if (!stream_reader_seek(r, n)) {
+                exit(1);
+            }
+            auto t_done = std::chrono::high_resolution_clock::now();
+            float us = std::chrono::duration_cast<std::chrono::duration<float, std::micro>>(t_done - t_seek).count();
+            total += us;
+            worst = std::max(worst, us);
+        }
+        printf("%s: random seek %.1f us average, %.1f us worst\n",
+               compress ? "deflated" : "plain", total / BENCH_STREAM_SEEKS, worst);
+        stream_reader_close(r);
+    }
+}
+
+// Time frag.glsl with and without PRECOMPUTED_RGB, drawing one cell over the
+// whole window layer upon layer so the frame is all fragment work. Draws
+// with whatever vertex array is bound, `indices` into its element buffer.
+void bench_variants(ShaderVariants& cells, const void* indices, FrameUniformBuffer& frameUniforms)
+{
+    // a cell is 0.2 across, scaled up it fills clip space
+    frame_uniforms_set_camera(frameUniforms, glm::mat4(), glm::mat4());
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glm::mat4 model = glm::scale(glm::mat4(), glm::vec3(10.0f, 10.0f, 1.0f));
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_disable(GL_DEPTH_TEST);
+
+    const char* features[] = { "", "PRECOMPUTED_RGB" };
+    float reference = 0.0f;
+    for (int v = 0; v < 2; v++) {
+        GLuint program = shader_variant(cells, features[v]);
+        glstate_use_program(program);
+        frame_uniforms_bind_program(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniform2f(glGetUniformLocation(program, "Cell"), 0.0f, 0.0f);
+        glUniform1f(glGetUniformLocation(program, "HeightScale"), 0.0f);
+        glm::vec3 color = v == 0 ? get_color(0, 0, 0.0f) : get_rgb(0, 0, 0.0f);
+        glUniform3fv(glGetUniformLocation(program, "Color"), 1, glm::value_ptr(color));
+
+        float total = 0.0f;
+        for (int frame = -2; frame < BENCH_VARIANT_FRAMES; frame++) {
+            glClear(GL_COLOR_BUFFER_BIT);
+            glFinish();
+            auto t_start = std::chrono::high_resolution_clock::now();
+            for (int layer = 0; layer < BENCH_VARIANT_LAYERS; layer++) {
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
+            }
+            glFinish();
+            auto t_done = std::chrono::high_resolution_clock::now();
+            if (frame >= 0)
+                total += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+        }
+        float ms = total / BENCH_VARIANT_FRAMES;
+        if (v == 0)
+            reference = ms;
+        float ns = 1e6f * ms / ((float)BENCH_VARIANT_LAYERS * WINDOW_WIDTH * WINDOW_HEIGHT);
+        printf("%-16s %7.2f ms per frame, %6.3f ns per fragment (%.2fx hsv2rgb per fragment)\n",
+               v ? features[v] : "(general)", ms, ns, reference / ms);
+    }
+    glstate_enable(GL_DEPTH_TEST);
+}
+
+// Start up with 1, 10 and 100 cell programs each way programs can be
+// compiled, timing from before the first is submitted to when the last has
+// been fetched. Every program has a define of its own, so nothing comes out
+// of the driver's shader cache.
+void bench_compile(GLFWwindow* window)
+{
+    std::string vertexSource = shader_compile_read("vert.glsl");
+    std::string fragmentSource = shader_compile_read("frag.glsl");
+    int workers = std::max(1, std::min((int)std::thread::hardware_concurrency(), SHADER_COMPILE_MAX_WORKERS));
+    int modes[] = { 0, -1, workers };
+    int run = 0;
+    printf("%d hardware threads\n", (int)std::thread::hardware_concurrency());
+
+    for (size_t n = 0; n < sizeof(bench_compile_counts) / sizeof(bench_compile_counts[0]); n++) {
+        int count = bench_compile_counts[n];
+        float reference = 0.0f;
+        for (int m = 0; m < 3; m++) {
+            auto t_start = std::chrono::high_resolution_clock::now();
+            ShaderCompiler compiler;
+            shader_compile_init(compiler, window, modes[m]);
+            std::vector<int> jobs;
+            for (int i = 0; i < count; i++) {
+                std::vector<std::string> salt(1, "BENCH_" + std::to_string(getpid()) + "_" + std::to_string(run++));
+                jobs.push_back(shader_compile_submit(compiler, "bench", shader_variants_specialize(vertexSource, salt),
+                                                     shader_variants_specialize(fragmentSource, salt),
+                                                     "position texcoord"));
+            }
+            std::vector<GLuint> programs;
+            for (int i = 0; i < count; i++) {
+                programs.push_back(shader_compile_program(compiler, jobs[i]));
+            }
+            auto t_done = std::chrono::high_resolution_clock::now();
+            float ms = std::chrono::duration<float, std::milli>(t_done - t_start).count();
+            if (m == 0)
+                reference = ms;
+
+            char mode[32];
+            snprintf(mode, sizeof(mode), compiler.mode == SHADER_COMPILE_WORKERS ? "%s (%d)" : "%s",
+                     shader_compile_mode_names[compiler.mode], (int)compiler.contexts.size());
+            printf("%3d programs, %-12s %8.1f ms, %6.1f ms waiting, %.2fx\n", count, mode, ms,
+                   compiler.blocked * 1e3, reference / ms);
+
+            shader_compile_destroy(compiler);
+            for (int i = 0; i < count; i++) {
+                glstate_delete_program(programs[i]);
+            }
+        }
+    }
+}
+
+// Light the window's cells with 64, 512 and 4096 moving lights, every light
+// for every fragment and then only the lights binned to its tile. Frame
+// times include placing, culling and uploading the lights. Draws with
+// whatever vertex array is bound, `indices` into its element buffer.
+void bench_lights(ShaderVariants& cells, const void* indices, FrameUniformBuffer& frameUniforms, int gridSize)
+{
+    glm::mat4 view = glm::lookAt(
+        glm::vec3(0.6f, 0.6f, 1.6f),
+        glm::vec3(0.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    );
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
+    frame_uniforms_update(frameUniforms, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    const char* features[] = { "PRECOMPUTED_RGB LIGHTING", "PRECOMPUTED_RGB LIGHTING TILED_LIGHTS" };
+    FrameArena arena;
+    frame_arena_init(arena, FRAME_ARENA_SIZE);
+    for (size_t n = 0; n < sizeof(bench_light_counts) / sizeof(bench_light_counts[0]); n++) {
+        LightTiles lights;
+        light_tiles_init(lights, bench_light_counts[n], WINDOW_WIDTH, WINDOW_HEIGHT, LIGHT_TILE);
+
+        float ms[2], cullMs = 0.0f, average = 0.0f;
+        int most = 0;
+        for (int tiled = 0; tiled < 2; tiled++) {
+            GLuint program = shader_variant(cells, features[tiled]);
+            frame_uniforms_bind_program(program);
+            light_tiles_bind_program(lights, program, 1);
+            glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4()));
+            glUniform2f(glGetUniformLocation(program, "Stride"), X_STRIDE, Y_STRIDE);
+            glUniform1f(glGetUniformLocation(program, "GridSize"), gridSize);
+            glUniform1f(glGetUniformLocation(program, "HeightScale"), 0.0f);
+            GLint uniCell = glGetUniformLocation(program, "Cell");
+            GLint uniColor = glGetUniformLocation(program, "Color");
+
+            float total = 0.0f;
+            for (int frame = -1; frame < BENCH_LIGHT_FRAMES; frame++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glFinish();
+                auto t_start = std::chrono::high_resolution_clock::now();
+                frame_arena_reset(arena);
+                place_lights(lights, gridSize, frame / 60.0f);
+                if (tiled)
+                    light_tiles_cull(lights, view, proj);
+                auto t_culled = std::chrono::high_resolution_clock::now();
+                light_tiles_upload(lights, arena);
+                light_tiles_bind(lights, 1);
+                for (int x = -gridSize; x < gridSize; x++) {
+                    for (int y = -gridSize; y < gridSize; y++) {
+                        glUniform2f(uniCell, x, y);
+                        glUniform3fv(uniColor, 1, glm::value_ptr(get_rgb(x, y, frame)));
+                        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
+                    }
+                }
+                glFinish();
+                auto t_done = std::chrono::high_resolution_clock::now();
+                if (frame >= 0) {
+                    total += std::chrono::duration<float, std::milli>(t_done - t_start).count();
+                    if (tiled)
+                        cullMs += std::chrono::duration<float, std::milli>(t_culled - t_start).count();
+                }
+            }
+            ms[tiled] = total / BENCH_LIGHT_FRAMES;
+        }
+        light_tiles_stats(lights, average, most);
+        printf("%5d lights: every light %8.1f ms, tiled %7.1f ms (placing and culling %.2f ms, "
+               "%.1f lights per tile, at most %d), %.1fx\n", lights.count, ms[0], ms[1],
+               cullMs / BENCH_LIGHT_FRAMES, average, most, ms[0] / ms[1]);
+        light_tiles_destroy(lights);
+    }
+    frame_arena_destroy(arena);
+}
+
+// Run the CPU simulation for `frames` frames at FIELD_FPS, dropping things
+// in as the window does, and write every frame's heights to a field file
+void record_field(const char* path, int frames, int size)
+{
+    FieldWriter w;
+    if (!field_writer_open(w, path, size, size, 1.0 / FIELD_FPS)) {
         exit(1);
     }
+    Columns c;
+    columns_init(c, size, size, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+    int dropEvery = std::max(1, (int)(DROP_INTERVAL * FIELD_FPS));
+    for (int frame = 0; frame < frames; frame++) {
+        if (frame % dropEvery == 0) {
+            float radius = size / 40.0f;
+            columns_drop(c,
+                radius + rand() % (int)(size - 2*radius),
+                radius + rand() % (int)(size - 2*radius),
+                radius, 1.5f);
+        }
+        for (int i = 0; i < SIM_STEPS_PER_FRAME; i++)
+            columns_step(c);
+        field_writer_push(w, c.heights.data());
+    }
+    field_writer_close(w);
+    printf("recorded %d frames of %d x %d to %s, %.1f MB\n", frames, size, size, path, w.offset / 1e6);
+}
 
-    return vertexShader;
+// Read a field file front to back from disk as playback would, touching
+// every page of every frame, without and then with the prefetch
+void bench_field(const char* path)
+{
+    FieldReader r;
+    if (!field_reader_open(r, path)) {
+        exit(1);
+    }
+    size_t floats = r.frameBytes / sizeof(float);
+    for (int prefetch = 0; prefetch < 2; prefetch++) {
+        for (int pass = 0; pass < BENCH_FIELD_PASSES; pass++) {
+            field_reader_evict(r);
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            float sum = 0.0f;
+            auto t_start = std::chrono::high_resolution_clock::now();
+            for (long n = 0; n < (long)r.header.frames; n++) {
+                const float* heights = prefetch ? field_reader_frame(r, n) : (const float*)(r.data + r.offsets[n]);
+                for (size_t i = 0; i < floats; i += FIELD_ALIGN / sizeof(float)) {
+                    sum += heights[i];
+                }
+            }
+            auto t_end = std::chrono::high_resolution_clock::now();
+            getrusage(RUSAGE_SELF, &after);
+            float seconds = std::chrono::duration<float>(t_end - t_start).count();
+            printf("%s: %.0f frames/s, %.1f MB/s, %ld major and %ld minor page faults (%g)\n",
+                   prefetch ? "prefetched" : "on demand", r.header.frames / seconds,
+                   r.header.frames * r.frameBytes / seconds / 1e6,
+                   after.ru_majflt - before.ru_majflt, after.ru_minflt - before.ru_minflt, sum);
+        }
+    }
+    field_reader_close(r);
 }
 
-glm::vec3 get_translation(int x, int y, float time) {
-    return glm::vec3(x*X_STRIDE, y*Y_STRIDE, 1.5f *sin(0.5f * time + x/7.0f + y/9.0f + 1.6f));
+// Step a 10^7 column domain with one small drop in the middle, once as a
+// single row and once as a square, with and without sleeping
+void bench_active()
+{
+    int side = (int)ceilf(sqrtf((float)BENCH_ACTIVE_COLUMNS));
+    int shapes[2][2] = { { BENCH_ACTIVE_COLUMNS, 1 }, { side, side } };
+
+    for (int s = 0; s < 2; s++) {
+        int w = shapes[s][0], h = shapes[s][1];
+        Columns dense, sleeping;
+        columns_init(dense, w, h, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+        columns_init(sleeping, w, h, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+        columns_sleep_init(sleeping, SIM_SLEEP_EPSILON);
+        // the first step finds the whole domain at rest
+        columns_step_active(sleeping);
+        columns_step(dense);
+
+        float cx = w / 2.0f, cy = h / 2.0f;
+        columns_drop(dense, cx, cy, BENCH_ACTIVE_RADIUS, 1.5f);
+        columns_drop(sleeping, cx, cy, BENCH_ACTIVE_RADIUS, 1.5f);
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < BENCH_ACTIVE_DENSE_STEPS; i++) {
+            columns_step(dense);
+        }
+        auto t_end = std::chrono::high_resolution_clock::now();
+        float denseMs = std::chrono::duration<float, std::milli>(t_end - t_start).count() / BENCH_ACTIVE_DENSE_STEPS;
+        printf("%d x %d: every column %8.3f ms per step\n", w, h, denseMs);
+
+        int step = 0;
+        for (int report = BENCH_ACTIVE_DENSE_STEPS; report <= BENCH_ACTIVE_STEPS; report *= 10) {
+            t_start = std::chrono::high_resolution_clock::now();
+            int steps = report - step;
+            for (; step < report; step++) {
+                columns_step_active(sleeping);
+            }
+            t_end = std::chrono::high_resolution_clock::now();
+            float ms = std::chrono::duration<float, std::milli>(t_end - t_start).count() / steps;
+
+            long awake = (long)sleeping.active.size() * sleeping.tileWidth * sleeping.tileHeight;
+            printf("%d x %d: sleeping to step %4d %8.3f ms per step (%.0fx), %ld columns awake\n",
+                   w, h, report, ms, denseMs / ms, awake);
+
+            if (report == BENCH_ACTIVE_DENSE_STEPS) {
+                float worst = 0.0f;
+                for (size_t i = 0; i < dense.heights.size(); i++) {
+                    worst = std::max(worst, fabsf(dense.heights[i] - sleeping.heights[i]));
+                }
+                printf("%d x %d: largest height difference from stepping every column %g\n", w, h, worst);
+            }
+        }
+    }
 }
 
-glm::vec3 get_color(int x, int y, float time) {
-    return glm::vec3(sin(0.2f * time + x/20.0f + y/20.0f), 0.7f, 1.0f);
+// Update random hierarchies of 10^5 and 10^6 nodes with a small fraction
+// of them moving every frame, against recomputing every world transform
+void bench_scene()
+{
+    int sizes[] = { 100000, 1000000 };
+    float fractions[] = { 0.001f, 0.01f, 0.1f, 1.0f };
+
+    for (int size : sizes) {
+        // each node goes under some node on the path down to the last one,
+        // which keeps the order depth first
+        SceneStore scene;
+        scene_init(scene, size);
+        std::vector<int> path;
+        srand(1);
+        for (int i = 0; i < size; i++) {
+            int depth = path.empty() ? 0 : rand() % std::min((int)path.size() + 1, BENCH_SCENE_DEPTH);
+            path.resize(depth);
+            glm::mat4 local = glm::rotate(glm::translate(glm::mat4(), glm::vec3(X_STRIDE, 0.0f, 0.1f)),
+                                          0.01f * i, glm::vec3(0.0f, 0.0f, 1.0f));
+            path.push_back(scene_add(scene, depth == 0 ? -1 : path[depth - 1], local));
+        }
+        scene_update(scene);
+
+        std::vector<int> changed;
+        for (float fraction : fractions) {
+            int count = std::max(1, (int)(fraction * size));
+            float total = 0.0f;
+            long recomputed = 0;
+            for (int frame = 0; frame < BENCH_SCENE_FRAMES; frame++) {
+                changed.clear();
+                for (int i = 0; i < count; i++) {
+                    changed.push_back(fraction < 1.0f ? rand() % size : i);
+                }
+
+                auto t_start = std::chrono::high_resolution_clock::now();
+                for (int node : changed) {
+                    scene_set_local(scene, node, glm::rotate(scene.local[node], 0.01f, glm::vec3(0.0f, 0.0f, 1.0f)));
+                }
+                recomputed += scene_update(scene);
+                auto t_end = std::chrono::high_resolution_clock::now();
+                total += std::chrono::duration<float, std::milli>(t_end - t_start).count();
+            }
+            printf("%7d nodes, %6.1f%% changing: %8.3f ms per update, %8ld world transforms recomputed\n",
+                   size, 100.0f * fraction, total / BENCH_SCENE_FRAMES, recomputed / BENCH_SCENE_FRAMES);
+        }
+    }
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    TRACE_BEGIN("startup");
+    bool benchSim = false;
+    bool benchDraws = false;
+    bool batchMode = false;
+    bool noMultiDraw = false;
+    bool benchSurface = false;
+    int surfaceResolution = 0;
+    bool cpuSim = false;
+    int throttle = 0;
+    int simSize = SIM_SIZE;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* fieldPath = NULL;
+    const char* captureDir = NULL;
+    bool capturePng = false;
+    bool stats = false;
+    float budget = 0.0f;
+    int maxSamples = DYNRES_MAX_SAMPLES;
+    int gridSize = GRID_SIZE;
+    bool soft = false;
+    bool benchSoft = false;
+    int softFrames = 0;
+    int softThreads = std::max(1u, std::thread::hardware_concurrency());
+    int views = 1;
+    bool benchViews = false;
+    bool benchVariants = false;
+    bool benchHeap = false;
+    bool benchCompile = false;
+    int lightCount = 0;
+    bool bruteLights = false;
+    bool benchLights = false;
+    bool sorted = false;
+    bool overdrawMode = false;
+    int shaderWorkers = -1;
+    float vramBudget = 0.0f;
+    int farmFrames = 0;
+    int farmWorkers = std::max(1u, std::thread::hardware_concurrency());
+    int benchFarmFrames = 0;
+    int swapInterval = -1;
+    int maxQueued = 0;
+    bool latency = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-sim") == 0) {
+            benchSim = true;
+        } else if (strcmp(argv[i], "--bench-draws") == 0) {
+            benchDraws = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batchMode = true;
+        } else if (strcmp(argv[i], "--no-mdi") == 0) {
+            noMultiDraw = true;
+        } else if (strcmp(argv[i], "--surface") == 0 && i + 1 < argc) {
+            surfaceResolution = std::min(std::max(2, atoi(argv[++i])), SURFACE_MAX_RESOLUTION);
+        } else if (strcmp(argv[i], "--bench-surface") == 0) {
+            benchSurface = true;
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            simSize = std::min(std::max(SIM_MIN_SIZE, atoi(argv[++i])), SIM_MAX_SIZE);
+        } else if (strcmp(argv[i], "--cpu-sim") == 0) {
+            cpuSim = true;
+        } else if (strcmp(argv[i], "--throttle") == 0 && i + 1 < argc) {
+            throttle = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+            cpuSim = true;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--field") == 0 && i + 1 < argc) {
+            fieldPath = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            captureDir = argv[++i];
+        } else if (strcmp(argv[i], "--png") == 0) {
+            capturePng = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-samples") == 0 && i + 1 < argc) {
+            maxSamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--soft") == 0) {
+            soft = true;
+        } else if (strcmp(argv[i], "--soft-threads") == 0 && i + 1 < argc) {
+            softThreads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--soft-frames") == 0 && i + 1 < argc) {
+            softFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bench-soft") == 0) {
+            benchSoft = true;
+        } else if (strcmp(argv[i], "--views") == 0 && i + 1 < argc) {
+            views = std::min(std::max(1, atoi(argv[++i])), MULTIVIEW_MAX_VIEWS);
+        } else if (strcmp(argv[i], "--bench-views") == 0) {
+            benchViews = true;
+        } else if (strcmp(argv[i], "--bench-variants") == 0) {
+            benchVariants = true;
+        } else if (strcmp(argv[i], "--vram-budget") == 0 && i + 1 < argc) {
+            vramBudget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-heap") == 0) {
+            benchHeap = true;
+        } else if (strcmp(argv[i], "--bench-compile") == 0) {
+            benchCompile = true;
+        } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            lightCount = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--brute-lights") == 0) {
+            bruteLights = true;
+        } else if (strcmp(argv[i], "--bench-lights") == 0) {
+            benchLights = true;
+        } else if (strcmp(argv[i], "--sorted") == 0) {
+            sorted = true;
+        } else if (strcmp(argv[i], "--overdraw") == 0) {
+            overdrawMode = true;
+        } else if (strcmp(argv[i], "--farm") == 0 && i + 1 < argc) {
+            farmFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--farm-workers") == 0 && i + 1 < argc) {
+            farmWorkers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bench-farm") == 0 && i + 1 < argc) {
+            benchFarmFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            gridSize = std::min(std::max(1, atoi(argv[++i])), GRID_MAX_SIZE);
+        } else if (strcmp(argv[i], "--bench-stream") == 0 && i + 1 < argc) {
+            bench_stream(argv[++i], simSize);
+            return 0;
+        } else if (strcmp(argv[i], "--record-field") == 0 && i + 2 < argc) {
+            record_field(argv[i + 1], std::max(1, atoi(argv[i + 2])), simSize);
+            return 0;
+        } else if (strcmp(argv[i], "--bench-field") == 0 && i + 1 < argc) {
+            bench_field(argv[++i]);
+            return 0;
+        } else if (strcmp(argv[i], "--bench-active") == 0) {
+            bench_active();
+            return 0;
+        } else if (strcmp(argv[i], "--bench-scene") == 0) {
+            bench_scene();
+            return 0;
+        } else if (!shader_compile_arg(argc, argv, i, shaderWorkers) &&
+                   !frame_pacing_arg(argc, argv, i, swapInterval, maxQueued, latency)) {
+            printf("usage: %s [--sim SIZE] [--bench-sim] [--bench-draws] [--cpu-sim] [--throttle MS]\n"
+                   "       [--record FILE] [--replay FILE] [--bench-stream FILE] [--bench-active]\n"
+                   "       [--bench-scene] [--field FILE] [--record-field FILE FRAMES] [--bench-field FILE]\n"
+                   "       [--capture DIR [--png]] [--stats] [--grid N] [--vram-budget MB] [--bench-heap]\n"
+                   "       [--budget MS [--max-samples N]] [--batch [--no-mdi]]\n"
+                   "       [--surface RESOLUTION] [--bench-surface]\n"
+                   "       [--soft [--soft-threads N] [--soft-frames N --capture DIR [--png]]] [--bench-soft]\n"
+                   "       [--views N] [--bench-views] [--bench-variants]\n"
+                   "       [--lights N [--brute-lights]] [--bench-lights]\n"
+                   "       [--sorted] [--overdraw]\n"
+                   "       [--farm FRAMES [--farm-workers K] [--capture DIR [--png]]] [--bench-farm FRAMES]\n"
+                   "       " SHADER_COMPILE_USAGE " [--bench-compile]\n"
+                   "       " FRAME_PACING_USAGE "\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The software rasterizer only draws the cells, from heights on the CPU
+    if (soft && (batchMode || surfaceResolution > 0 || budget > 0.0f)) {
+        printf("--soft can't be combined with --batch, --surface or --budget\n");
+        return 1;
+    }
+    // and the views only split up the cells
+    if (views > 1 && (soft || batchMode || surfaceResolution > 0)) {
+        printf("--views can't be combined with --soft, --batch or --surface\n");
+        return 1;
+    }
+    // and the lights only light the cells, in one view at full resolution
+    if (lightCount > 0 && (soft || batchMode || surfaceResolution > 0 || views > 1 || budget > 0.0f)) {
+        printf("--lights can't be combined with --soft, --batch, --surface, --views or --budget\n");
+        return 1;
+    }
+    // and the overdraw is counted for the cells drawn one by one
+    if (overdrawMode && (soft || batchMode || surfaceResolution > 0 || views > 1 || budget > 0.0f)) {
+        printf("--overdraw can't be combined with --soft, --batch, --surface, --views or --budget\n");
+        return 1;
+    }
+    // and the farm runs a simulation of its own in every worker
+    if ((farmFrames > 0 || benchFarmFrames > 0) && (cpuSim || soft || recordPath || replayPath || fieldPath)) {
+        printf("--farm can't be combined with --cpu-sim, --soft, --record, --replay or --field\n");
+        return 1;
+    }
+    // and a field is the only source of heights
+    if (fieldPath && (cpuSim || recordPath || replayPath)) {
+        printf("--field can't be combined with --cpu-sim, --record or --replay\n");
+        return 1;
+    }
+    // and without a window the frames have to go somewhere
+    if (softFrames > 0 && (!soft || !captureDir || recordPath || replayPath || fieldPath)) {
+        printf("--soft-frames needs --soft and --capture, and can't be combined with --record, --replay or --field\n");
+        return 1;
+    }
+    if (soft && !replayPath && !fieldPath) {
+        cpuSim = true;
+    }
+
+    // which means no GL at all, not even a context
+    if (softFrames > 0) {
+        soft_frames(softFrames, captureDir, capturePng, gridSize, simSize, softThreads);
+        return 0;
+    }
+
+    // A replay brings its own size
+    StreamReader replay;
+    if (replayPath) {
+        if (!stream_reader_open(replay, replayPath)) {
+            return 1;
+        }
+        if (replay.header.width != replay.header.height) {
+            printf("%s isn't square, the simulation is\n", replayPath);
+            return 1;
+        }
+        simSize = replay.header.width;
+        cpuSim = false;
+    }
+    // and so does a field, whose frames go to the height texture straight
+    // out of the mapping
+    FieldReader field;
+    if (fieldPath) {
+        if (!field_reader_open(field, fieldPath)) {
+            return 1;
+        }
+        if (field.header.width != field.header.height) {
+            printf("%s is %u x %u, only square fields can be shown\n", fieldPath, field.header.width,
+                   field.header.height);
+            return 1;
+        }
+        simSize = field.header.width;
+        cpuSim = false;
+    }
+
+    TRACE_BEGIN("glfwInit");
     glfwInit();
+    TRACE_END();
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // with a frame time budget the scene is multisampled offscreen instead
+    glfwWindowHint(GLFW_SAMPLES, budget > 0.0f ? 0 : 4);
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    if (benchSim || benchDraws || benchSurface || benchSoft || benchViews || benchVariants || benchCompile || benchLights || farmFrames > 0 || benchFarmFrames > 0) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    }
 
-    GLFWwindow* window = glfwCreateWindow(1920, 1080, "ripples", nullptr, nullptr);
+    TRACE_BEGIN("glfwCreateWindow");
+    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "ripples", nullptr, nullptr);
+    TRACE_END();
 
     glfwMakeContextCurrent(window);
 
     // Set up glew
     glewExperimental = GL_TRUE;
+    TRACE_BEGIN("glewInit");
     glewInit();
+    TRACE_END();
+
+    FramePacing pacing;
+    frame_pacing_init(pacing, swapInterval, maxQueued, latency);
+
+    // State changes go through a cache that drops the redundant ones. It
+    // starts out knowing nothing about the context.
+    glstate_invalidate();
+
+    if (benchCompile) {
+        bench_compile(window);
+        glfwTerminate();
+        return 0;
+    }
+
+    // Every program startup might need is submitted here, before anything
+    // else, and each is only waited for where it's first used (see
+    // common/shader_compile.h). The cells' programs are variants of
+    // vert.glsl and frag.glsl (see common/shader_variants.h), the general
+    // one takes the HSV colors get_color() gives.
+    ShaderCompiler compiler;
+    shader_compile_init(compiler, window, shaderWorkers);
+    ShaderCompileGuard compilerGuard(compiler);
+    ShaderVariants cellVariants;
+    shader_variants_init(cellVariants, "vert.glsl", "frag.glsl", "position texcoord", &compiler);
+    ShaderVariants multiviewVariants;
+    shader_variants_init(multiviewVariants, "multiview_vert.glsl", "frag.glsl", "position texcoord", &compiler);
+    shader_variant_submit(cellVariants, "");
+    shader_variant_submit(multiviewVariants, "");
+    // the window's cells get their colors in RGB already, which saves
+    // frag.glsl an hsv2rgb for every fragment
+    const char* cellFeatures = "PRECOMPUTED_RGB";
+    if (lightCount > 0) {
+        cellFeatures = bruteLights ? "PRECOMPUTED_RGB LIGHTING" : "PRECOMPUTED_RGB LIGHTING TILED_LIGHTS";
+    }
+    shader_variant_submit(views > 1 ? multiviewVariants : cellVariants, cellFeatures);
+    int batchJob = shader_compile_files(compiler, "batch_vert.glsl", "batch_frag.glsl", "");
+    int surfaceJob = shader_compile_files(compiler, "surface_vert.glsl", "surface_frag.glsl", "");
+    int simJob = shader_compile_files(compiler, "quad_vert.glsl", "sim_frag.glsl", "");
+    int dropJob = shader_compile_files(compiler, "quad_vert.glsl", "drop_frag.glsl", "");
+    int upscaleJob = -1;
+    if (budget > 0.0f) {
+        upscaleJob = shader_compile_files(compiler, "../common/upscale_vert.glsl", "../common/upscale_frag.glsl", "");
+    }
+
+    // Vertex and index data is sub-allocated from a few shared buffers, and
+    // what's on the GPU is tallied against --vram-budget
+    GpuHeap heap;
+    gpu_heap_init(heap, (GLsizeiptr)(vramBudget * 1e6f));
 
     // Set up the vertex array object to save
     // how we set up attributes for our shader
     GLuint vao;
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glstate_bind_vertex_array(vao);
  
-    float vertices[] = {
-        //Position    //Texcoords
-        -0.1f,  0.1f, 0.0f, 0.0f,
-         0.1f,  0.1f, 1.0f, 0.0f,
-         0.1f, -0.1f, 1.0f, 1.0f,
-        -0.1f, -0.1f, 0.0f, 1.0f
-    };
+    // Set up the main vertex buffer
+    const float* vertices = cell_vertices;
+    GpuAlloc cellVertices;
+    if (!gpu_heap_alloc(heap, GPU_VERTEX, sizeof(cell_vertices), cellVertices) ||
+        !gpu_heap_upload(cellVertices, vertices, sizeof(cell_vertices))) {
+        return 1;
+    }
 
+    GLuint shaderProgram = shader_variant(cellVariants, "");
 
-    // Set up the main vertex buffer
-    GLuint vertexBuffer;
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Compile the shaders
-    GLuint fragmentShader = compile_fragment_shader();
-    GLuint vertexShader = compile_vertex_shader();
- 
-    // Initializing the shader program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
+    // With --batch the cells are a mix of shapes, drawn all at once with
+    // their positions and colors coming from a buffer instead of uniforms
+    GLuint batchProgram = shader_compile_program(compiler, batchJob);
+
+    // With --surface the plane is one continuous mesh instead of cells
+    GLuint surfaceProgram = shader_compile_program(compiler, surfaceJob);
+
+    // With --views the cells are drawn once per view in the same draw,
+    // each view's camera coming from a uniform buffer of their own
+    GLuint multiviewProgram = shader_variant(multiviewVariants, "");
+    multiview_bind_program(multiviewProgram);
+
+    // They all read the camera from the per frame uniform buffer
+    FrameUniformBuffer frameUniforms;
+    frame_uniforms_init(frameUniforms);
+    frame_uniforms_bind_program(shaderProgram);
+    frame_uniforms_bind_program(batchProgram);
+    frame_uniforms_bind_program(surfaceProgram);
+
+    if (benchDraws) {
+        bench_draws(shaderProgram, batchProgram, frameUniforms);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+    if (benchHeap) {
+        bench_heap(shaderProgram, frameUniforms);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+    if (batchMode) {
+        shaderProgram = batchProgram;
+    } else if (surfaceResolution > 0) {
+        shaderProgram = surfaceProgram;
+    } else {
+        shaderProgram = shader_variant(views > 1 ? multiviewVariants : cellVariants, cellFeatures);
+        frame_uniforms_bind_program(shaderProgram);
+        multiview_bind_program(shaderProgram);
+    }
+
+    // The simulation passes, both on the fullscreen vertex shader
+    GLuint simProgram = shader_compile_program(compiler, simJob);
+    GLuint dropProgram = shader_compile_program(compiler, dropJob);
+
+    if (benchSim) {
+        bench_heightfield(simProgram, dropProgram);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+
+    HeightField hf;
+    heightfield_init(hf, simSize, simProgram, dropProgram);
+    if (!gpu_heap_track(heap, GPU_TEXTURE, 2L * simSize * simSize * 2 * sizeof(float))) {
+        return 1;
+    }
+    heightfield_constants(hf, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
 
-    // select an output from the fragment shader (unnecessary here since there's only one)
-    glBindFragDataLocation(shaderProgram, 0, "outColor");
-    glLinkProgram(shaderProgram);
-    glUseProgram(shaderProgram);
+    if (benchSurface) {
+        bench_surface(surfaceProgram, hf, frameUniforms, gridSize);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+
+    // With --cpu-sim the heights come from the simulation thread instead,
+    // and get uploaded into their own texture every frame
+    SimThread st;
+    StreamWriter recorder;
+    GLuint cpuHeightTex = 0;
+    if (cpuSim || replayPath || fieldPath) {
+        if (!gpu_heap_track(heap, GPU_TEXTURE, (long)simSize * simSize * sizeof(float))) {
+            return 1;
+        }
+        glGenTextures(1, &cpuHeightTex);
+        glstate_bind_texture(0, GL_TEXTURE_2D, cpuHeightTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, simSize, simSize, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    }
+    if (recordPath && !stream_writer_open(recorder, recordPath, simSize, simSize, 1.0 / CPU_SIM_RATE,
+                                          KEYFRAME_INTERVAL, true)) {
+        return 1;
+    }
+    if (cpuSim) {
+        sim_thread_start(st, simSize, CPU_SIM_RATE, recordPath ? &recorder : NULL);
+    }
 
+    glstate_use_program(shaderProgram);
+    glstate_bind_vertex_array(vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, cellVertices.buffer);
 
     // identify the position attribute in our vertex buffer
+    // (the surface has none)
     GLint posAttrib = glGetAttribLocation(shaderProgram, "position");
-    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);   
-    glEnableVertexAttribArray(posAttrib);
+    if (posAttrib >= 0) {
+        glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)cellVertices.offset);
+        glEnableVertexAttribArray(posAttrib);
+    }
  
     // identify the texture coordinate attribute in our vertex buffer
+    // (the fragment shader doesn't read it, so the linker may have dropped it)
     GLint texAttrib = glGetAttribLocation(shaderProgram, "texcoord");
-    glEnableVertexAttribArray(texAttrib);
-    glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)(2*sizeof(float)));
+    if (texAttrib >= 0) {
+        glEnableVertexAttribArray(texAttrib);
+        glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float),
+                              (void*)(cellVertices.offset + 2*sizeof(float)));
+    }
 
     glm::mat4 view = glm::lookAt(
         glm::vec3(0.6f, 0.6f, 1.6f),
         glm::vec3(0.0f, 0.0f, 0.0f),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    GLint uniView = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
-    
-    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1920.0f/1080.0f, 0.01f, 20.0f);
-    GLint uniProj = glGetUniformLocation(shaderProgram, "proj");
-    glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH/WINDOW_HEIGHT, 0.01f, 20.0f);
+    frame_uniforms_set_camera(frameUniforms, view, proj);
 
-    // Set up the element buffer
-    GLuint elements[] = {
-        0, 1, 2,
-        2, 3, 0
-    };
+    MultiView multiView;
+    if (views > 1) {
+        multiview_init(multiView, views, WINDOW_WIDTH, WINDOW_HEIGHT);
+        for (int i = 0; i < views; i++) {
+            view_camera(i, views, multiview_aspect(multiView), view, proj);
+            multiview_set_camera(multiView, i, view, proj);
+        }
+        multiview_update(multiView);
+        printf("drawing %d views in one pass, %d x %d\n", views, multiView.columns, multiView.rows);
+    }
 
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);    
+    // Set up the element buffer, bound as the vertex array's element buffer
+    // whichever block it's in
+    const GLuint* elements = cell_elements;
+    GpuAlloc cellElements;
+    if (!gpu_heap_alloc(heap, GPU_INDEX, sizeof(cell_elements), cellElements) ||
+        !gpu_heap_upload(cellElements, elements, sizeof(cell_elements))) {
+        return 1;
+    }
+    glstate_bind_vertex_array(vao);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, cellElements.buffer);
+    const void* cellIndices = (const void*)cellElements.offset;
+
+    // --farm renders offline, into captureDir if there is one, instead of
+    // opening the window
+    if (farmFrames > 0 || benchFarmFrames > 0) {
+        FarmScene scene;
+        scene.gridSize = gridSize;
+        scene.simSize = simSize;
+        scene.vertices = vertices;
+        scene.elements = elements;
+        if (farmFrames > 0) {
+            RenderFarm farm;
+            render_farm_init(farm, WINDOW_WIDTH, WINDOW_HEIGHT, FARM_SAMPLES, farmFrames, FARM_FPS,
+                             captureDir, capturePng);
+            render_farm_run(farm, scene, farmWorkers);
+            printf("rendered %d frames on %d workers in %.2f s, %.1f frames per second\n",
+                   farmFrames, farmWorkers, farm.seconds, farmFrames / farm.seconds);
+        } else {
+            render_farm_bench(scene, WINDOW_WIDTH, WINDOW_HEIGHT, FARM_SAMPLES, benchFarmFrames, FARM_FPS,
+                              std::min(BENCH_FARM_MAX_WORKERS, std::max(4, (int)std::thread::hardware_concurrency())));
+        }
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
 
     GLint uniModel = glGetUniformLocation(shaderProgram, "model");
     GLint uniFade = glGetUniformLocation(shaderProgram, "Fade");
     GLint uniColor = glGetUniformLocation(shaderProgram, "Color");
+    GLint uniCell = glGetUniformLocation(shaderProgram, "Cell");
+
+    glUniform2f(glGetUniformLocation(shaderProgram, "Stride"), X_STRIDE, Y_STRIDE);
+    glUniform1f(glGetUniformLocation(shaderProgram, "GridSize"), gridSize);
+    glUniform1i(glGetUniformLocation(shaderProgram, "heights"), 0);
+    glUniform1f(glGetUniformLocation(shaderProgram, "HeightScale"), 1.0f);
+
+    // With --lights the cells are lit by point lights moving over them,
+    // binned into screen tiles every frame unless --brute-lights
+    LightTiles lights;
+    if (lightCount > 0) {
+        light_tiles_init(lights, lightCount, WINDOW_WIDTH, WINDOW_HEIGHT, LIGHT_TILE);
+        light_tiles_bind_program(lights, shaderProgram, 1);
+        printf("lighting with %d lights, %s\n", lightCount, bruteLights ? "every one for every fragment" : "tiled");
+    }
+
+    // With --sorted the cells are drawn nearest first, so the depth test keeps
+    // the ones behind from being shaded. From this camera the plane hardly
+    // covers itself, so otherwise they go in grid order and skip the sort's
+    // CPU time. With --overdraw the window shows how many times each pixel
+    // was shaded instead.
+    DrawSort cellOrder;
+    Overdraw overdraw;
+    if (overdrawMode) {
+        overdraw_init(overdraw, WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+
+    // Every shape in one set of buffers, per cell position and color after
+    // that
+    MeshBatch batch;
+    if (batchMode) {
+        mesh_batch_init(batch, 2, 5);
+        add_cell_meshes(batch);
+        mesh_batch_upload(batch);
+        mesh_batch_vertex_attrib(batch, glGetAttribLocation(shaderProgram, "position"), 2, 0);
+        mesh_batch_draw_attrib(batch, glGetAttribLocation(shaderProgram, "cell"), 2, 0);
+        mesh_batch_draw_attrib(batch, glGetAttribLocation(shaderProgram, "color"), 3, 2);
+        if (noMultiDraw) {
+            batch.multiDraw = false;
+        }
+        printf("drawing %d cells %s\n", 4 * gridSize * gridSize,
+               batch.multiDraw ? "with one multi-draw indirect call" : "in a loop");
+    }
+
+    Surface surface;
+    if (surfaceResolution > 0) {
+        surface_init(surface, surfaceResolution, surface_band(SURFACE_VERTEX_CACHE));
+        surface_uniforms(shaderProgram, surface, gridSize, simSize);
+        printf("drawing a %d x %d surface, ACMR %.3f, cache hits %.1f%%\n", surfaceResolution,
+               surfaceResolution, surface_acmr(surface), 100.0f * surface_hit_ratio(surface));
+    }
+
+    // With --capture every frame is also saved into captureDir
+    Capture capture;
+    if (captureDir) {
+        capture_init(capture, WINDOW_WIDTH, WINDOW_HEIGHT, captureDir, capturePng);
+    }
+
+    // With --budget the scene is rendered offscreen at whatever resolution
+    // keeps the GPU time per frame under budget milliseconds
+    DynRes dynres;
+    float lastDynresReport = 0.0f;
+    if (budget > 0.0f) {
+        GLuint upscaleProgram = shader_compile_program(compiler, upscaleJob);
+        dynres_init(dynres, WINDOW_WIDTH, WINDOW_HEIGHT, budget, maxSamples, upscaleProgram);
+    }
+
+    // the last of startup's programs has been fetched
+    shader_compile_report(compiler);
+
+    // the plane the cells sit on, turning slowly
+    SceneStore scene;
+    scene_init(scene, 1);
+    int plane = scene_add(scene, -1, glm::mat4());
 
     auto t_start = std::chrono::high_resolution_clock::now();
+    float lastDrop = 0.0f;
+    float lastReport = 0.0f;
+    int frames = 0;
+
+    // frame time statistics for --stats
+    float lastFrame = 0.0f;
+    float lastStats = 0.0f;
+    float frameTimeTotal = 0.0f;
+    float frameTimeMax = 0.0f;
+    long stateIssued = 0;
+    long stateFiltered = 0;
+    long stateBinds = 0;
+    int statFrames = 0;
     int x, y;    
     
-    glEnable(GL_MULTISAMPLE);
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glstate_enable(GL_MULTISAMPLE);
+    glstate_enable(GL_DEPTH_TEST);
+
+    if (benchViews) {
+        bench_views(shader_variant(cellVariants, ""), multiviewProgram, cellVertices, cellElements, frameUniforms,
+                    gridSize);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+    if (benchVariants) {
+        bench_variants(cellVariants, cellIndices, frameUniforms);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+    if (benchLights) {
+        bench_lights(cellVariants, cellIndices, frameUniforms, gridSize);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+    if (benchSoft) {
+        bench_soft(shaderProgram, vao, cellIndices, vertices, elements, frameUniforms, softThreads);
+        shader_compile_destroy(compiler);
+        glfwTerminate();
+        return 0;
+    }
+
+    // With --soft everything is drawn on the CPU, and the finished frame is
+    // just copied into the window
+    SoftRenderer softRenderer;
+    SoftTexture softHeights;
+    SoftCellShader cellShader;
+    if (soft) {
+        soft_init(softRenderer, WINDOW_WIDTH, WINDOW_HEIGHT, softThreads);
+        softRenderer.state.depthTest = true;
+        cellShader.stride = glm::vec2(X_STRIDE, Y_STRIDE);
+        cellShader.gridSize = gridSize;
+        cellShader.heightScale = 1.0f;
+        cellShader.heights = &softHeights;
+        cellShader.vertices = vertices;
+        printf("drawing in software on %d threads\n", softThreads);
+    }
+
+    // Anything that only lives for one frame comes from here
+    FrameArena frameArena;
+    frame_arena_init(frameArena, FRAME_ARENA_SIZE);
+
+    TRACE_END();
 
     while(!glfwWindowShouldClose(window))
     {
+        TRACE_SCOPE("frame");
+
+        frame_pacing_poll(pacing);
+        frame_arena_reset(frameArena);
+
         auto t_now = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
-        
-        glm::mat4 model;
-        glm::mat4 trns;
 
-        model = glm::rotate(model, time*glm::radians(10.0f), glm::vec3(0.1f, 0.3f, 1.0f));
+        if (stats) {
+            float frameTime = time - lastFrame;
+            lastFrame = time;
+            frameTimeTotal += frameTime;
+            frameTimeMax = std::max(frameTimeMax, frameTime);
+            stateIssued += glstate().frameIssued;
+            stateFiltered += glstate().frameFiltered;
+            stateBinds += glstate().frameBinds;
+            statFrames++;
+            if (time - lastStats >= 1.0f) {
+                printf("frame time %6.2f ms average, %6.2f ms worst over %d frames, "
+                       "state calls per frame %.1f issued (%.1f binds), %.1f filtered\n",
+                       1000.0f * frameTimeTotal / statFrames, 1000.0f * frameTimeMax, statFrames,
+                       (float)stateIssued / statFrames, (float)stateBinds / statFrames,
+                       (float)stateFiltered / statFrames);
+                gpu_heap_report(heap);
+                lastStats = time;
+                frameTimeTotal = frameTimeMax = 0.0f;
+                stateIssued = stateFiltered = stateBinds = 0;
+                statFrames = 0;
+            }
+        }
+
+        TRACE_BEGIN("simulation");
+        const float* cpuHeights = NULL;
+        if (fieldPath) {
+            // Whichever frame of the field falls on this time, uploaded from
+            // the mapping itself
+            const float* heights = field_reader_frame(field, (long)(time / field.header.dt));
+            cpuHeights = heights;
+            glstate_bind_texture(0, GL_TEXTURE_2D, cpuHeightTex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, simSize, simSize, GL_RED, GL_FLOAT, heights);
+            field_reader_report(field);
+        } else if (replayPath) {
+            // Show whichever step of the recording falls on this time
+            const float* heights = stream_reader_seek(replay, (long)(time / replay.header.dt));
+            if (!heights) {
+                break;
+            }
+            cpuHeights = heights;
+            glstate_bind_texture(0, GL_TEXTURE_2D, cpuHeightTex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, simSize, simSize, GL_RED, GL_FLOAT, heights);
+        } else if (cpuSim) {
+            // Pick up whatever the simulation thread has published
+            float* heights = (float*)frame_arena_alloc(frameArena, simSize * simSize * sizeof(float));
+            sim_thread_sample(st, heights);
+            cpuHeights = heights;
+            glstate_bind_texture(0, GL_TEXTURE_2D, cpuHeightTex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, simSize, simSize, GL_RED, GL_FLOAT, heights);
+
+            frames++;
+            if (time - lastReport >= 1.0f) {
+                sim_thread_report(st, frames / (time - lastReport));
+                frames = 0;
+                lastReport = time;
+            }
+        } else {
+            // Advance the simulation, every so often dropping something in
+            if (time - lastDrop > DROP_INTERVAL) {
+                float radius = simSize / 40.0f;
+                heightfield_drop(hf,
+                    radius + rand() % (int)(simSize - 2*radius),
+                    radius + rand() % (int)(simSize - 2*radius),
+                    radius, 1.5f);
+                lastDrop = time;
+            }
+            heightfield_step(hf, SIM_STEPS_PER_FRAME);
+            glstate_bind_texture(0, GL_TEXTURE_2D, heightfield_texture(hf));
+        }
+        TRACE_END();
+
+        // Slow the render loop down on purpose, to check the simulation
+        // keeps its pace
+        if (throttle > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(throttle));
+        }
+
+        // Back to the window
+        glstate_bind_framebuffer(GL_FRAMEBUFFER, 0);
+        glstate_viewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+        glstate_use_program(shaderProgram);
+        glstate_bind_vertex_array(vao);
         
+        scene_set_local(scene, plane, glm::rotate(glm::mat4(), time*glm::radians(10.0f), glm::vec3(0.1f, 0.3f, 1.0f)));
+        scene_update(scene);
+        const glm::mat4& model = scene_world(scene, plane);
+
         glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
 
         glUniform1f(uniFade, (sin(0.5f * time) + 1.0f) / 2.0f);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        glDepthFunc(GL_LESS);
-        glClearDepth(1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (budget > 0.0f) {
+            TRACE_BEGIN("dynres_begin");
+            dynres_begin(dynres);
+            TRACE_END();
+            if (time - lastDynresReport >= 1.0f) {
+                char status[256];
+                dynres_status(dynres, status, sizeof(status));
+                printf("%s\n", status);
+                glfwSetWindowTitle(window, status);
+                lastDynresReport = time;
+            }
+        }
+
+        // One upload of everything the frame's programs share
+        if (budget > 0.0f) {
+            frame_uniforms_update(frameUniforms, time, dynres.renderWidth, dynres.renderHeight);
+        } else {
+            frame_uniforms_update(frameUniforms, time, WINDOW_WIDTH, WINDOW_HEIGHT);
+        }
+
+        TRACE_BEGIN("draw");
+        if (overdrawMode) {
+            overdraw_begin(overdraw);
+        }
+        if (!soft) {
+            glstate_depth_func(GL_LESS);
+            glstate_clear_depth(1.0f);
+            glstate_clear_color(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
 
         //int size = (int)(10*sin(3.0f*time) + 10);
 
-        for (x = -GRID_SIZE; x < GRID_SIZE; x++) {
-            for (y = -GRID_SIZE; y <GRID_SIZE; y++) {
-                trns = glm::translate(model, get_translation(x, y, time));
-                glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(trns));
-                glUniform3fv(uniColor, 1, glm::value_ptr(get_color(x, y, time)));
-                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        if (soft) {
+            soft_texture_wrap(softHeights, cpuHeights, simSize, simSize, 1, false);
+            cellShader.mvp = frameUniforms.data.viewProj * model;
+            soft_clear(softRenderer, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            soft_draw_cells(softRenderer, cellShader, elements, gridSize, time);
+            soft_present(softRenderer);
+        } else if (surfaceResolution > 0) {
+            surface_draw(surface);
+        } else if (batchMode) {
+            mesh_batch_begin(batch);
+            for (x = -gridSize; x < gridSize; x++) {
+                for (y = -gridSize; y < gridSize; y++) {
+                    float* d = mesh_batch_draw(batch, cell_mesh(x, y));
+                    glm::vec3 color = get_color(x, y, time);
+                    d[0] = x; d[1] = y;
+                    d[2] = color.x; d[3] = color.y; d[4] = color.z;
+                }
+            }
+            mesh_batch_submit(batch);
+        } else if (views > 1) {
+            multiview_begin();
+            for (x = -gridSize; x < gridSize; x++) {
+                for (y = -gridSize; y < gridSize; y++) {
+                    glUniform2f(uniCell, x, y);
+                    glUniform3fv(uniColor, 1, glm::value_ptr(get_rgb(x, y, time)));
+                    glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, cellIndices, views);
+                }
+            }
+            multiview_end();
+        } else {
+            if (lightCount > 0) {
+                TRACE_BEGIN("lights");
+                place_lights(lights, gridSize, time);
+                if (!bruteLights)
+                    light_tiles_cull(lights, frameUniforms.data.view * model, frameUniforms.data.proj);
+                light_tiles_upload(lights, frameArena);
+                light_tiles_bind(lights, 1);
+                TRACE_END();
             }
+            // by the distance to each cell's center, the heights left out
+            int side = 2 * gridSize;
+            if (sorted) {
+                TRACE_BEGIN("sort");
+                glm::mat4 viewModel = frameUniforms.data.view * model;
+                draw_sort_begin(cellOrder);
+                for (x = -gridSize; x < gridSize; x++) {
+                    for (y = -gridSize; y < gridSize; y++) {
+                        glm::vec4 center = viewModel * glm::vec4(x * X_STRIDE, y * Y_STRIDE, 0.0f, 1.0f);
+                        draw_sort_add(cellOrder, -center.z);
+                    }
+                }
+                draw_sort_sort(cellOrder);
+                TRACE_END();
+            }
+            for (int k = 0; k < side * side; k++) {
+                int cell = sorted ? draw_sort_at(cellOrder, k) : k;
+                x = cell / side - gridSize;
+                y = cell % side - gridSize;
+                glUniform2f(uniCell, x, y);
+                glUniform3fv(uniColor, 1, glm::value_ptr(get_rgb(x, y, time)));
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, cellIndices);
+            }
+        }
+        if (overdrawMode) {
+            overdraw_end(overdraw);
+            overdraw_report(overdraw, sorted ? "front to back" : "fixed order");
         }
+        TRACE_END();
+
+        if (budget > 0.0f) {
+            TRACE_BEGIN("dynres_end");
+            dynres_end(dynres);
+            TRACE_END();
+        }
+
+        if (captureDir) {
+            capture_frame(capture);
+        }
+
+        frame_pacing_swap(pacing, window);
+        glstate_frame();
+        gpu_heap_frame(heap);
+        alloc_stats_frame();
+    }
+
+    if (captureDir) {
+        capture_finish(capture);
+        printf("captured %d frames into %s: %ld written, %ld dropped, %ld stalls\n",
+               capture.frames, captureDir, capture.written, capture.dropped, capture.stalls);
+    }
+
+    frame_arena_destroy(frameArena);
+    if (soft) {
+        soft_destroy(softRenderer);
+    }
+    if (budget > 0.0f) {
+        dynres_destroy(dynres);
+    }
+    if (batchMode) {
+        mesh_batch_destroy(batch);
+    }
+    if (surfaceResolution > 0) {
+        surface_destroy(surface);
+    }
+    if (views > 1) {
+        multiview_destroy(multiView);
+    }
+
+    if (cpuSim) {
+        sim_thread_stop(st);
+    }
+    if (recordPath) {
+        stream_writer_close(recorder);
+        printf("recorded %lu steps to %s\n", (unsigned long)recorder.records, recordPath);
+    }
+    if (replayPath) {
+        stream_reader_close(replay);
+    }
+    if (fieldPath) {
+        field_reader_close(field);
+    }
+
+    if (lightCount > 0) {
+        light_tiles_destroy(lights);
+    }
+    if (overdrawMode) {
+        overdraw_destroy(overdraw);
     }
+    glstate_delete_vertex_arrays(1, &vao);
+    gpu_heap_destroy(heap);
+    shader_compile_destroy(compiler);
 
+    frame_pacing_destroy(pacing);
     glfwTerminate();
 }
@@ -0,0 +1,39 @@
+#version 150
+
+// One step of the column model from py/ripples.py, with four neighbors
+// instead of two. r is the height, g the velocity.
+
+out vec4 outState;
+
+uniform sampler2D state;
+uniform float K;
+uniform float Dashpot;
+uniform float NeighborK;
+
+// Height after this step's position update. Fetches are clamped, so a
+// missing neighbor at the border looks like the column itself and pulls
+// with no force, like a Column without a left or right.
+float next_height(ivec2 p, ivec2 size)
+{
+    vec2 s = texelFetch(state, clamp(p, ivec2(0), size - 1), 0).rg;
+    return s.r + s.g;
+}
+
+void main()
+{
+    ivec2 size = textureSize(state, 0);
+    ivec2 p = ivec2(gl_FragCoord.xy);
+
+    vec2 s = texelFetch(state, p, 0).rg;
+    float height = s.r + s.g;
+    float velocity = s.g;
+
+    float neighbors = 4.0 * height
+        - next_height(p + ivec2(1, 0), size)
+        - next_height(p - ivec2(1, 0), size)
+        - next_height(p + ivec2(0, 1), size)
+        - next_height(p - ivec2(0, 1), size);
+
+    float acceleration = -(height*K + velocity*Dashpot + NeighborK*neighbors);
+    outState = vec4(height, velocity + acceleration, 0.0, 0.0);
+}
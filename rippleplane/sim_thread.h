@@ -0,0 +1,191 @@
+// CPU simulation running on its own thread at a fixed rate.
+//
+// The simulation thread steps the columns every 1/rate seconds no matter how
+// long frames take, and publishes a copy of the heights after each step
+// through a triple buffer. The render thread picks up the latest copy
+// without ever locking, and draws in between the last two copies it has
+// seen so the motion stays smooth when the frame rate and step rate differ.
+
+#include "../common/columns.h"
+#include "../common/triple_buffer.h"
+#include "../common/sim_stream.h"
+#include "../common/trace.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct SimSnapshot {
+    double time;
+    long step;
+    std::vector<float> heights;
+
+    // step rate and the spread of step intervals over the last second
+    float stepsPerSecond;
+    float minInterval;
+    float maxInterval;
+};
+
+struct SimThread {
+    Columns columns;
+    double dt;
+    std::chrono::steady_clock::time_point t_start;
+    TripleBuffer<SimSnapshot> snapshots;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    // when set, every step is also written out here
+    StreamWriter* recorder;
+
+    // render side: the two most recent snapshots
+    SimSnapshot prev;
+    SimSnapshot cur;
+
+    // the range the interpolation has covered since sim_thread_report()
+    float minAlpha;
+    float maxAlpha;
+};
+
+void sim_thread_run(SimThread* st)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point next = st->t_start;
+    clock::time_point last = st->t_start;
+    clock::time_point window = st->t_start;
+    std::chrono::duration<double> dt(st->dt);
+
+    Columns& c = st->columns;
+    long step = 0;
+    long windowSteps = 0;
+    float minInterval = 1e9f, maxInterval = 0.0f;
+    float stepsPerSecond = 0.0f, reportedMin = 0.0f, reportedMax = 0.0f;
+    double lastDrop = 0.0;
+
+    TRACE_THREAD("simulation");
+    while (st->running) {
+        TRACE_BEGIN("sim step");
+        double time = step * st->dt;
+        if (time - lastDrop > DROP_INTERVAL) {
+            float radius = c.width / 40.0f;
+            columns_drop(c,
+                radius + rand() % (int)(c.width - 2*radius),
+                radius + rand() % (int)(c.height - 2*radius),
+                radius, 1.5f);
+            lastDrop = time;
+        }
+        columns_step_active(c);
+        step++;
+
+        if (st->recorder)
+            stream_writer_push(*st->recorder, step, c.heights.data(), c.velocities.data());
+
+        // stamped with when the step started, which is about when it's
+        // published, so sampling a step behind finds it with the one before
+        // it on the other side
+        SimSnapshot& out = st->snapshots.write_buffer();
+        out.time = time;
+        out.step = step;
+        out.heights.assign(c.heights.begin(), c.heights.end());
+
+        // keep track of how steady the step rate is
+        clock::time_point now = clock::now();
+        float interval = std::chrono::duration<float>(now - last).count();
+        last = now;
+        minInterval = std::min(minInterval, interval);
+        maxInterval = std::max(maxInterval, interval);
+        windowSteps++;
+        float windowLength = std::chrono::duration<float>(now - window).count();
+        if (windowLength >= 1.0f) {
+            stepsPerSecond = windowSteps / windowLength;
+            reportedMin = minInterval;
+            reportedMax = maxInterval;
+            windowSteps = 0;
+            minInterval = 1e9f;
+            maxInterval = 0.0f;
+            window = now;
+        }
+        out.stepsPerSecond = stepsPerSecond;
+        out.minInterval = reportedMin;
+        out.maxInterval = reportedMax;
+
+        st->snapshots.publish();
+        TRACE_END();
+
+        // if we fell far behind don't try to catch up all at once
+        next += std::chrono::duration_cast<clock::duration>(dt);
+        if (now - next > 10 * dt)
+            next = now;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void sim_thread_start(SimThread& st, int size, double rate, StreamWriter* recorder = NULL)
+{
+    st.recorder = recorder;
+    columns_init(st.columns, size, size, SIM_K, SIM_DASHPOT, SIM_NEIGHBOR_K);
+    columns_sleep_init(st.columns, SIM_SLEEP_EPSILON);
+    st.dt = 1.0 / rate;
+
+    st.prev.time = st.cur.time = 0.0;
+    st.prev.step = st.cur.step = 0;
+    st.prev.heights.assign(size * size, 0.0f);
+    st.cur.heights.assign(size * size, 0.0f);
+    st.cur.stepsPerSecond = 0.0f;
+    st.cur.minInterval = st.cur.maxInterval = 0.0f;
+    st.minAlpha = 1.0f;
+    st.maxAlpha = 0.0f;
+
+    st.t_start = std::chrono::steady_clock::now();
+    st.running = true;
+    st.thread = std::thread(sim_thread_run, &st);
+}
+
+void sim_thread_stop(SimThread& st)
+{
+    st.running = false;
+    st.thread.join();
+}
+
+// Fill `heights` (one float per cell) with the current state, interpolated
+// between the last two snapshots. We render one step behind the simulation
+// so there is usually a snapshot on either side.
+void sim_thread_sample(SimThread& st, float* heights)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - st.t_start;
+    double time = elapsed.count() - st.dt;
+
+    if (st.snapshots.update()) {
+        std::swap(st.prev, st.cur);
+        const SimSnapshot& in = st.snapshots.read_buffer();
+        st.cur.time = in.time;
+        st.cur.step = in.step;
+        st.cur.heights.assign(in.heights.begin(), in.heights.end());
+        st.cur.stepsPerSecond = in.stepsPerSecond;
+        st.cur.minInterval = in.minInterval;
+        st.cur.maxInterval = in.maxInterval;
+    }
+
+    float alpha = 1.0f;
+    if (st.cur.time > st.prev.time)
+        alpha = glm::clamp((float)((time - st.prev.time) / (st.cur.time - st.prev.time)), 0.0f, 1.0f);
+    st.minAlpha = std::min(st.minAlpha, alpha);
+    st.maxAlpha = std::max(st.maxAlpha, alpha);
+
+    for (size_t i = 0; i < st.cur.heights.size(); i++)
+        heights[i] = st.prev.heights[i] + alpha * (st.cur.heights[i] - st.prev.heights[i]);
+}
+
+// Print the render and step rates. While the simulation keeps its rate the
+// interpolation should move through the inside of (0, 1); if it sits at an
+// end, frames show the snapshots as they are and the motion stutters.
+void sim_thread_report(SimThread& st, float fps)
+{
+    printf("render %6.1f fps, sim %6.1f steps/s (step interval %.2f - %.2f ms), interpolation %.2f - %.2f\n",
+           fps, st.cur.stepsPerSecond, st.cur.minInterval * 1000.0f, st.cur.maxInterval * 1000.0f,
+           st.minAlpha, st.maxAlpha);
+    bool steady = st.cur.stepsPerSecond > 0.0f && st.cur.maxInterval < 2.0f * st.dt;
+    if (steady && (st.maxAlpha <= 0.0f || st.minAlpha >= 1.0f))
+        printf("warning: the simulation is steady but frames aren't being interpolated\n");
+    st.minAlpha = 1.0f;
+    st.maxAlpha = 0.0f;
+}
@@ -0,0 +1,58 @@
+// vert.glsl and frag.glsl for the software rasterizer (common/softraster.h).
+//
+// One cell per draw, the same as the GL loop: the cell's position and color
+// are uniforms, the quad's corners come from the vertex buffer's array and
+// the height is sampled from the CPU simulation's heights at the cell's
+// center. Texcoord is left out since frag.glsl never reads it, and since
+// the color is a uniform its hsv2rgb is worked out once per draw instead of
+// once per pixel.
+
+#include "../common/softraster.h"
+
+// fract() without going through floorf, which is a library call unless
+// SSE4.1 is enabled
+float soft_fract(float x)
+{
+    float f = x - (float)(int)x;
+    return f < 0.0f ? f + 1.0f : f;
+}
+
+glm::vec3 soft_hsv2rgb(glm::vec3 c)
+{
+    const float k[3] = { 1.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float rgb[3];
+    for (int i = 0; i < 3; i++) {
+        float p = fabsf(soft_fract(c.x + k[i]) * 6.0f - 3.0f);
+        rgb[i] = c.z * (1.0f + c.y * (std::min(std::max(p - 1.0f, 0.0f), 1.0f) - 1.0f));
+    }
+    return glm::vec3(rgb[0], rgb[1], rgb[2]);
+}
+
+struct SoftCellShader {
+    static const int VARYINGS = 0;
+
+    glm::mat4 mvp;              // viewProj * model
+    glm::vec2 cell;
+    glm::vec2 stride;
+    float gridSize;
+    float heightScale;
+    glm::vec3 rgb;              // hsv2rgb(Color)
+    const SoftTexture* heights;
+    const float* vertices;      // position, texcoord
+
+    void vertex(int index, SoftVertex& out) const
+    {
+        // each cell samples the simulation at its center and moves as a whole
+        glm::vec2 uv((cell.x + gridSize + 0.5f) / (2.0f * gridSize),
+                     (cell.y + gridSize + 0.5f) / (2.0f * gridSize));
+        float height = heightScale * soft_texture_sample(*heights, uv).x;
+
+        const float* v = vertices + 4 * index;
+        out.position = mvp * glm::vec4(cell.x * stride.x + v[0], cell.y * stride.y + v[1], height, 1.0f);
+    }
+
+    glm::vec4 fragment(const float*) const
+    {
+        return glm::vec4(rgb, 1.0f);
+    }
+};
@@ -0,0 +1,152 @@
+// Continuous heightfield surface.
+//
+// One grid of resolution x resolution vertices over the whole plane, drawn
+// as triangle strips joined by primitive restart in a single glDrawElements.
+// The vertices have no attributes at all: surface_vert.glsl works out where
+// each one is from gl_VertexID, lifts it by the simulated height there and
+// takes its normal from the heights around it.
+//
+// Strips running the full width of the grid get nothing out of the
+// post-transform vertex cache, since by the time the next strip comes back
+// to a row its vertices have long been pushed out. So the grid is cut into
+// bands of columns narrow enough that a band's row stays cached while the
+// strip below it goes by, and each vertex is shaded about once instead of
+// twice.
+
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <vector>
+#include <algorithm>
+
+#include "../common/glstate.h"
+
+#define SURFACE_RESTART 0xffffffffu
+
+// entries in the FIFO vertex cache the bands are sized for and the cache
+// statistics are measured against
+#define SURFACE_VERTEX_CACHE 32
+
+// most vertices across a grid; 4096 x 4096 is already 16.8M vertices and
+// well under the limits of the int and GLsizei counts
+#define SURFACE_MAX_RESOLUTION 4096
+
+struct Surface {
+    int resolution;
+    int band;           // quads across each band
+    GLsizei indexCount;
+
+    // from running the indices through a simulated vertex cache
+    long triangles;
+    long references;
+    long misses;
+
+    GLuint vao;
+    GLuint ebo;
+};
+
+// The widest band whose row still fits in the cache next to the row below.
+// The first strip of a band brings in both its rows interleaved, which costs
+// another column: if a FIFO cache loses one vertex of the row it's about to
+// need, every strip after that misses on every vertex.
+inline int surface_band(int cacheSize)
+{
+    return cacheSize / 2 - 2;
+}
+
+// Strips `band` quads wide from the bottom of the grid to the top, one band
+// of columns after another
+inline void surface_indices(std::vector<GLuint>& indices, int n, int band)
+{
+    long count = 0;
+    for (int c0 = 0; c0 < n - 1; c0 += band)
+        count += (long)(n - 1) * (2 * (std::min(c0 + band, n - 1) - c0 + 1) + 1);
+    indices.clear();
+    indices.reserve(count);
+
+    for (int c0 = 0; c0 < n - 1; c0 += band) {
+        int c1 = std::min(c0 + band, n - 1);
+        for (int r = 0; r < n - 1; r++) {
+            // counterclockwise seen from above
+            for (int c = c0; c <= c1; c++) {
+                indices.push_back((r + 1) * n + c);
+                indices.push_back(r * n + c);
+            }
+            indices.push_back(SURFACE_RESTART);
+        }
+    }
+}
+
+// Count how many vertex references miss a FIFO cache of cacheSize entries
+inline void surface_cache_stats(Surface& s, const std::vector<GLuint>& indices, int vertexCount, int cacheSize)
+{
+    // a vertex is still cached if fewer than cacheSize others went in after
+    // it did
+    std::vector<int> insertedAt(vertexCount, -cacheSize - 1);
+    int inserted = 0;
+    int stripLength = 0;
+
+    s.triangles = s.references = s.misses = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        GLuint index = indices[i];
+        if (index == SURFACE_RESTART) {
+            stripLength = 0;
+            continue;
+        }
+        if (++stripLength >= 3)
+            s.triangles++;
+        s.references++;
+        if (insertedAt[index] < inserted - cacheSize) {
+            insertedAt[index] = inserted++;
+            s.misses++;
+        }
+    }
+}
+
+// Average cache misses per triangle: 0.5 is the best a grid can do, 1 is
+// what full width strips get
+inline float surface_acmr(const Surface& s)
+{
+    return (float)s.misses / s.triangles;
+}
+
+inline float surface_hit_ratio(const Surface& s)
+{
+    return 1.0f - (float)s.misses / s.references;
+}
+
+inline void surface_init(Surface& s, int resolution, int band)
+{
+    s.resolution = resolution;
+    s.band = band;
+
+    std::vector<GLuint> indices;
+    surface_indices(indices, resolution, band);
+    s.indexCount = indices.size();
+    surface_cache_stats(s, indices, resolution * resolution, SURFACE_VERTEX_CACHE);
+
+    // the element buffer is all the vertex array holds
+    glGenVertexArrays(1, &s.vao);
+    glstate_bind_vertex_array(s.vao);
+    glGenBuffers(1, &s.ebo);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, s.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+    glPrimitiveRestartIndex(SURFACE_RESTART);
+}
+
+// Draw with a program using surface_vert.glsl, its Resolution set to match
+inline void surface_draw(Surface& s)
+{
+    glstate_bind_vertex_array(s.vao);
+    glstate_enable(GL_PRIMITIVE_RESTART);
+    glDrawElements(GL_TRIANGLE_STRIP, s.indexCount, GL_UNSIGNED_INT, 0);
+}
+
+inline void surface_destroy(Surface& s)
+{
+    glstate_delete_buffers(1, &s.ebo);
+    glstate_delete_vertex_arrays(1, &s.vao);
+}
+
+#endif
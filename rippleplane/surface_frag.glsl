@@ -0,0 +1,23 @@
+#version 150
+
+in vec3 Normal;
+in float Height;
+
+out vec4 outColor;
+
+const vec3 light = vec3(0.29, 0.48, 0.83);
+
+vec3 hsv2rgb(vec3 c)
+{
+    vec4 K = vec4(1.0, 2.0 / 3.0, 1.0 / 3.0, 3.0);
+    vec3 p = abs(fract(c.xxx + K.xyz) * 6.0 - K.www);
+    return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
+}
+
+void main()
+{
+    // hue follows the height, brightness the angle to the light
+    float diffuse = max(dot(normalize(Normal), light), 0.0);
+    vec3 color = hsv2rgb(vec3(0.6 - Height, 0.7, 1.0));
+    outColor = vec4(color * (0.25 + 0.75 * diffuse), 1.0);
+}
@@ -0,0 +1,45 @@
+#version 150
+
+out vec3 Normal;
+out float Height;
+
+uniform mat4 model;
+
+// shared by every program, see common/frame_uniforms.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 viewport;
+    float time;
+};
+
+// vertices along each side of the grid, and half its width
+uniform int Resolution;
+uniform float Extent;
+
+// simulation state, r = height
+uniform sampler2D heights;
+uniform float HeightScale;
+uniform float TexelSize;
+
+float height_at(vec2 uv)
+{
+    return HeightScale * texture(heights, uv).r;
+}
+
+void main()
+{
+    // the grid has no vertex data, the index says where a vertex is
+    vec2 uv = vec2(gl_VertexID % Resolution, gl_VertexID / Resolution) / float(Resolution - 1);
+    vec2 position = (2.0 * uv - 1.0) * Extent;
+    Height = height_at(uv);
+
+    // slopes from central differences one simulation cell either side
+    float cell = 2.0 * Extent * TexelSize;
+    float dx = height_at(uv + vec2(TexelSize, 0.0)) - height_at(uv - vec2(TexelSize, 0.0));
+    float dy = height_at(uv + vec2(0.0, TexelSize)) - height_at(uv - vec2(0.0, TexelSize));
+    Normal = mat3(model) * normalize(vec3(-dx, -dy, 2.0 * cell));
+
+    gl_Position = viewProj * model * vec4(position, Height, 1.0);
+}
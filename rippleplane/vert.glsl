@@ -4,16 +4,40 @@ in vec2 position;
 in vec2 texcoord;
 
 out vec2 Texcoord;
+#ifdef LIGHTING
+out vec3 Position;      // on the plane, before model, where the lights are
+#endif
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
 
+// shared by every program, see common/frame_uniforms.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 viewport;
+    float time;
+};
+
+uniform vec2 Cell;
+uniform vec2 Stride;
+uniform float GridSize;
+
+// simulation state, r = height
+uniform sampler2D heights;
+uniform float HeightScale;
 
 void main()
 {
     Texcoord = texcoord;
-    gl_Position = proj * view * model * vec4(position, 0.0, 1.0);
-}
 
+    // each cell samples the simulation at its center and moves as a whole
+    vec2 uv = (Cell + GridSize + 0.5) / (2.0 * GridSize);
+    float height = HeightScale * texture(heights, uv).r;
 
+    vec3 local = vec3(Cell * Stride + position, height);
+#ifdef LIGHTING
+    Position = local;
+#endif
+    gl_Position = viewProj * model * vec4(local, 1.0);
+}